@@ -0,0 +1,3593 @@
+/************************************************************************
+ * filename: anagram.c													*
+ *																		*
+ * The anagram library: builds anagram groups from dictionaries or from	*
+ * words added one at a time (see anagram.h and anagramcore.h), prints	*
+ * them, and answers lookups on a frozen AnagramSet.					*
+ *																		*
+ * Author(s): Caitlin Crowe and Emily Peterson							*
+ ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "anagramcore.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define INITIAL_ARRAY_SIZE 1000000
+#define PRINT_ROUND_GROUPS 16384
+#define ARENA_BLOCK_SIZE (1 << 20)	// bytes in a regular arena block
+#define PERFECT_BUCKET_KEYS 4	// average keys per bucket of a PerfectHash
+#define PERFECT_SPARE 32	// a PerfectHash table has 1/32 more places than keys
+#define PERFECT_MAX_SEEDS 64
+#define PIPELINE_BLOCK_SIZE (1 << 20)	// bytes read at a time by a pipelined build
+#define PIPELINE_BATCH 256	// words handed between pipeline stages at a time
+#define PIPELINE_BATCHES_PER_WORKER 8
+#define QUEUE_SPINS 64	// times a waiting pipeline stage spins before it yields
+
+// anagram groups behind the AnagramSet interface (see anagram.h)
+//		- builder field collects the words until the set is frozen
+//		- store field holds the groups once the set is frozen, each at
+//		  the position the perfect hash gives its key; the words of each
+//		  group keep the order in which they were added
+//		- keys field holds the anagram key of each group
+//		- hash field maps the key of every group to the group
+//		- kernel field computes signatures (chosen for the running CPU)
+struct anagramSet {
+    bool frozen;
+    ArrayBuilder builder;
+    GroupStore store;
+    AnagramKey *keys;
+    PerfectHash hash;
+    SignatureKernel kernel;
+};
+
+// anagram group handed from the chunk that built it to the shard that
+// owns its signature during a parallel build
+//		- chunk and group fields locate the group in the chunk that
+//		  first saw it (this pair orders groups by first appearance)
+//		- head, tail and size fields describe its linked list
+typedef struct {
+    AnagramKey key;
+    unsigned int hash;
+    int chunk;
+    int group;
+    int size;
+    Node *head;
+    Node *tail;
+} ShardEntry;
+
+// growable array of ShardEntry; nbrAllocations field counts the
+// reallocs of entries
+typedef struct {
+    ShardEntry *entries;
+    int count;
+    int capacity;
+    int nbrAllocations;
+} ShardList;
+
+// state shared by the threads of a parallel build; thread t builds
+// chunk t of the input and afterwards owns shard t of the signatures
+//		- chunkStart field holds nbrThreads+1 chunk boundaries
+//		- chunks field holds the builder used for each chunk
+//		- lists field holds nbrThreads*nbrThreads lists; list
+//		  [t*nbrThreads+s] has the groups of chunk t owned by shard s
+//		- shards field holds the merged groups of each shard
+//		- rank field holds, per chunk, the final array position of each
+//		  of its groups that started a merged group
+//		- nbrRanked field holds, per chunk, how many of those there are
+//		- corpus field is set for raw text (see
+//		  buildAnagramArrayFromCorpusParallel): chunks end between
+//		  words, and a word found in several chunks is kept once
+typedef struct {
+    int nbrThreads;
+    bool corpus;
+    char **chunkStart;
+    ArrayBuilder *chunks;
+    ShardList *lists;
+    ShardList *shards;
+    int **rank;
+    int *nbrRanked;
+    AryElement *ary;
+    int aryLen;
+    pthread_barrier_t barrier;
+} ParallelBuild;
+
+// argument of one thread of a parallel build
+typedef struct {
+    ParallelBuild *build;
+    int id;
+} ParallelWorker;
+
+// shared state of a parallel print (see printAnagramArrayParallel)
+//		- nbrRounds field stores number of rounds; in each round every
+//		  thread formats PRINT_ROUND_GROUPS groups
+//		- buffers field holds two buffers per thread: round r is
+//		  formatted into buffers[(r % 2) * nbrThreads + id]
+typedef struct {
+    AryElement *ary;
+    int aryLen;
+    int nbrThreads;
+    int nbrRounds;
+    OutputBuffer *buffers;
+    pthread_barrier_t barrier;
+} ParallelPrint;
+
+// argument of one formatting thread of a parallel print
+typedef struct {
+    ParallelPrint *print;
+    int id;
+} PrintWorker;
+
+// bounded single-producer/single-consumer queue of pointers
+//		- capacity field is a power of two
+//		- head field counts the items the consumer has taken and tail
+//		  field the items the producer has added; each side writes only
+//		  its own counter, and the two sit on separate cache lines
+//		- seenTail field is the consumer's last look at tail and
+//		  seenHead field the producer's last look at head, so the other
+//		  side's cache line is only read when the queue looks empty
+//		  (or full)
+typedef struct {
+    void **items;
+    uint64_t capacity;
+    char pad1[64];
+    uint64_t head;
+    uint64_t seenTail;
+    char pad2[64];
+    uint64_t tail;
+    uint64_t seenHead;
+    char pad3[64];
+} SpscQueue;
+
+// batch of words passed along a pipelined build
+//		- nodes field holds the words, as nodes viewing the blocks the
+//		  reader read them into
+//		- keys and hashes fields are filled in by a signature worker
+typedef struct {
+    int nbrWords;
+    Node *nodes;
+    AnagramKey keys[PIPELINE_BATCH];
+    unsigned int hashes[PIPELINE_BATCH];
+} PipelineBatch;
+
+// state shared by the stages of a pipelined build (see
+// buildAnagramArrayPipelined)
+//		- arena field belongs to the reader: it owns the read blocks and
+//		  the nodes, and is handed to the array at the end
+//		- toWorker[w] carries batches from the reader to worker w and
+//		  toAggregator[w] from worker w to the aggregator; batches go to
+//		  the workers in turn, so taking them back in turn keeps them in
+//		  input order; NULL marks the end of the input
+//		- freeBatches carries used batches back to the reader
+typedef struct {
+    char *infile;
+    int nbrWorkers;
+    Arena arena;
+    SignatureKernel kernel;
+    PipelineBatch *batches;
+    int nbrBatches;
+    SpscQueue *toWorker;
+    SpscQueue *toAggregator;
+    SpscQueue freeBatches;
+} Pipeline;
+
+// argument of one signature worker of a pipelined build
+typedef struct {
+    Pipeline *pipeline;
+    int id;
+} PipelineWorker;
+
+// anagram groups found by the first pass of buildCompactStore
+//		- slots field is an open-addressing table of capacity entries (a
+//		  power of two, at most 3/4 full); a used entry holds the 32-bit
+//		  hash of the anagram key of a group above the group plus one,
+//		  and an empty one is 0
+//		- first and length fields locate the first word of each group in
+//		  the mapped input, and size field counts the words of each group
+//		- nbrAllocations field counts the malloc calls made so far
+typedef struct {
+    uint64_t *slots;
+    uint64_t capacity;
+    uint64_t used;
+    char **first;
+    int *length;
+    int *size;
+    int nbrGroups;
+    int groupCapacity;
+    uint64_t nbrAllocations;
+} CompactGrouping;
+
+// word already seen in a corpus; hash field caches the hash of its text
+typedef struct {
+    uint64_t hash;
+    Node *node;
+} SeenWord;
+
+// open-addressing set of the distinct words of a corpus (entries whose
+// node field is NULL are empty); it is at most half full
+typedef struct {
+    SeenWord *entries;
+    size_t capacity;
+    size_t used;
+} WordSet;
+
+// words of a corpus waiting to be looked up in a WordSet
+//		- text field holds the words back to back (used bytes of
+//		  capacity); the last word may still be growing
+//		- offset and length fields locate each of the nbrWords words
+//		- hash field holds the hash of each word's text
+typedef struct {
+    char *text;
+    size_t used;
+    size_t capacity;
+    int nbrWords;
+    size_t offset[WORD_BATCH];
+    int length[WORD_BATCH];
+    uint64_t hash[WORD_BATCH];
+} CorpusBatch;
+
+/************************************************************************
+ * YOU MUST NOT DEFINE ANY GLOBAL VARIABLES (i.e., OUTSIDE FUNCTIONS).  *
+ * COMMUNICATION BETWEEN FUNCTIONS MUST HAPPEN ONLY VIA PARAMETERS.     *
+ ************************************************************************/
+
+/************************************************************************
+ * Function declarations/prototypes										*
+ ************************************************************************/
+
+void *parallelPrintWorker(void *arg);
+
+void *parallelBuildWorker(void *arg);
+
+void appendShardEntry(ShardList *list, ShardEntry *entry);
+
+AryElement *buildArrayInChunks(char *infile, int *aryLen, int nbrThreads, bool corpus);
+
+void appendUnseenWords(ShardEntry *merged, ShardEntry *entry, WordSet *seen);
+
+void *pipelineReader(void *arg);
+
+void *pipelineWorker(void *arg);
+
+void initSpscQueue(SpscQueue *queue, uint64_t capacity);
+
+void pushSpscQueue(SpscQueue *queue, void *item);
+
+void *popSpscQueue(SpscQueue *queue);
+
+void waitForQueue(int *spins);
+
+void endCorpusWord(ArrayBuilder *builder, WordSet *set, CorpusBatch *batch, int length);
+
+void addCorpusBatch(ArrayBuilder *builder, WordSet *set, CorpusBatch *batch);
+
+void initWordSet(WordSet *set);
+
+void growWordSet(WordSet *set);
+
+bool addSeenWord(WordSet *set, Node *node);
+
+uint64_t hashWordText(char *text, int length);
+
+int addCompactWord(CompactGrouping *grouping, SignatureKernel kernel, char *word, int length);
+
+void growCompactGrouping(CompactGrouping *grouping);
+
+unsigned char *encodeCompactGroup(unsigned char *p, Node *words, int size);
+
+/************************************************************************
+ * Adds the time since the last lap to a part of the build				*
+ * (PHASE_READ, PHASE_SIGNATURE or PHASE_GROUP) and starts the next		*
+ * lap. Does nothing if stats is NULL, which is all it costs when		*
+ * --stats is not given.												*
+ ************************************************************************/
+void lapRunStats(RunStats *stats, int phase)
+{
+    if (stats == NULL) {
+        return;
+    }
+    if (stats->phaseTime[phase] < 0) {
+        stats->phaseTime[phase] = 0;
+    }
+    stats->phaseTime[phase] += elapsedSeconds(&stats->lap);
+    clock_gettime(CLOCK_MONOTONIC, &stats->lap);
+}
+
+/************************************************************************
+ * Returns the number of seconds elapsed since start (CLOCK_MONOTONIC).	*
+ ************************************************************************/
+double elapsedSeconds(struct timespec *start)
+{
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/************************************************************************
+ * Adds count values of ns nanoseconds to a latency histogram.			*
+ ************************************************************************/
+void recordLatency(LatencyHistogram *histogram, uint64_t ns, uint64_t count)
+{
+    histogram->count[latencyBucket(ns)] += count;
+    histogram->total += count;
+}
+
+/************************************************************************
+ * Returns the bucket of ns nanoseconds in a LatencyHistogram: values	*
+ * below 8 have a bucket each, and every range [2^e, 2^(e+1)) above		*
+ * that is cut into 8 buckets of equal width.							*
+ ************************************************************************/
+int latencyBucket(uint64_t ns)
+{
+    int e;
+    
+    if (ns < 8) {
+        return ns;
+    }
+    e = 63 - __builtin_clzll(ns);
+    return (e - 2) * 8 + (int)((ns >> (e - 3)) & 7);
+}
+
+/************************************************************************
+ * Returns the latency (in microseconds) below which the given fraction	*
+ * of the values of a histogram lie, taken as the middle of the bucket	*
+ * where that fraction is reached, or 0 for an empty histogram.			*
+ ************************************************************************/
+double latencyPercentile(LatencyHistogram *histogram, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * histogram->total);
+    uint64_t seen = 0;
+    double low, width;
+    int b;
+    
+    if (histogram->total == 0) {
+        return 0;
+    }
+    if (rank >= histogram->total) {
+        rank = histogram->total - 1;
+    }
+    for (b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        seen += histogram->count[b];
+        if (seen > rank) {
+            break;
+        }
+    }
+    if (b < 8) {
+        return b / 1e3;
+    }
+    width = (double)(1ull << (b / 8 - 1));
+    low = (8 + b % 8) * width;
+    return (low + width / 2) / 1e3;
+}
+
+/************************************************************************
+ * Takes a filename that contains one word (of lower case letters) per	*
+ * line, reads the file contents, and builds an array of linked lists	*
+ * and returns a pointer to this array. It also sets the aryLen 		*
+ * parameter to size/length of the array returned from the function.	*
+ ************************************************************************/
+AryElement *buildAnagramArray(char *infile, int *aryLen)
+{
+    return buildAnagramArrayWithStats(infile, aryLen, false, NULL);
+}
+
+/************************************************************************
+ * Adds every non-empty line of infile to the builder, as a copy in the	*
+ * builder's arena.														*
+ ************************************************************************/
+void addFileLines(ArrayBuilder *builder, char *infile)
+{
+    char *word = NULL; // stores a line read from the input file (grown by getline)
+    size_t wordCap = 0, oldCap = 0;
+    ssize_t len;
+    Node *batch[WORD_BATCH];
+    int n = 0;
+    
+    // prepare the input file for reading
+    FILE *fp = fopen(infile,"r");
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    
+    // one pass over the input: the words go to their groups a batch
+    // at a time
+    while((len = getline(&word, &wordCap, fp)) != -1){
+        if (wordCap != oldCap) {
+            builder->arena.nbrAllocations++;
+            oldCap = wordCap;
+        }
+        while (len > 0 && (word[len-1] == '\n' || word[len-1] == '\r')) {
+            word[--len] = '\0';
+        }
+        if (len > 0) {
+            batch[n++] = createNodeInArena(&builder->arena, word, len);
+            if (n == WORD_BATCH) {
+                addNodesToArray(builder, batch, n);
+                n = 0;
+            }
+        }
+    }
+    addNodesToArray(builder, batch, n);
+    
+    free(word);
+    fclose(fp);
+}
+
+/************************************************************************
+ * Same as buildAnagramArray, but maps the input file into memory		*
+ * and makes every Node a view (pointer and length) into the mapping	*
+ * instead of a copy of the word. All nodes share one arena block		*
+ * sized by the number of lines, so building performs no per-word		*
+ * allocation or copying and words may be of any length. The mapping	*
+ * stays alive until freeAnagramArray is called.						*
+ ************************************************************************/
+AryElement *buildAnagramArrayMapped(char *infile, int *aryLen)
+{
+    return buildAnagramArrayWithStats(infile, aryLen, true, NULL);
+}
+
+/************************************************************************
+ * Does the work of buildAnagramArray (or of buildAnagramArrayMapped if	*
+ * mapped is true) and, unless stats is NULL, adds the reading,			*
+ * signature and grouping times and the number of key comparisons of	*
+ * the build to stats.													*
+ ************************************************************************/
+AryElement *buildAnagramArrayWithStats(char *infile, int *aryLen, bool mapped, RunStats *stats)
+{
+    ArrayBuilder builder;
+    AryElement *ary;
+    AryHeader *header;
+    size_t mapLen;
+    char *map;
+    
+    initArrayBuilder(&builder);
+    builder.stats = stats;
+    if (!mapped) {
+        addFileLines(&builder, infile);
+        return finishArrayBuilder(&builder, aryLen);
+    }
+    
+    map = mapInputFile(infile, &mapLen);
+    addMappedLines(&builder, map, map + mapLen);
+    ary = finishArrayBuilder(&builder, aryLen);
+    header = getAryHeader(ary);
+    header->map = map;
+    header->mapLen = mapLen;
+    return ary;
+}
+
+/************************************************************************
+ * Same as buildAnagramArrayMapped, but splits the mapped input into	*
+ * one chunk of whole lines per thread (see buildArrayInChunks).		*
+ ************************************************************************/
+AryElement *buildAnagramArrayParallel(char *infile, int *aryLen, int nbrThreads)
+{
+    return buildArrayInChunks(infile, aryLen, nbrThreads, false);
+}
+
+/************************************************************************
+ * Same as buildAnagramArrayFromCorpus, but splits the mapped text into	*
+ * one chunk per thread, cut between words (see buildArrayInChunks).	*
+ * Each thread tokenizes its chunk and keeps the distinct words of it;	*
+ * a word found in several chunks is then kept once, by the thread that	*
+ * owns its signature, at its first appearance.							*
+ ************************************************************************/
+AryElement *buildAnagramArrayFromCorpusParallel(char *infile, int *aryLen, int nbrThreads)
+{
+    return buildArrayInChunks(infile, aryLen, nbrThreads, true);
+}
+
+/************************************************************************
+ * Builds the array of infile with nbrThreads threads, one chunk of the	*
+ * mapped input per thread: chunks of whole lines, or with corpus set	*
+ * chunks of raw text cut between words. Each thread groups its chunk	*
+ * with a private builder and arena, then hands every group to the		*
+ * shard that owns its signature. Each thread then merges the groups of	*
+ * its shard, visiting the chunks in input order so that every merged	*
+ * group keeps its words in input order. Finally the merged groups are	*
+ * ranked by first appearance and stored in the array, so the result is	*
+ * identical to the one built by a single thread. The words of a corpus	*
+ * are copied, so its mapping is released before returning.				*
+ ************************************************************************/
+AryElement *buildArrayInChunks(char *infile, int *aryLen, int nbrThreads, bool corpus)
+{
+    ParallelBuild build;
+    ParallelWorker *workers = malloc(nbrThreads * sizeof(ParallelWorker));
+    pthread_t *threads = malloc(nbrThreads * sizeof(pthread_t));
+    AryHeader *header;
+    size_t mapLen;
+    char *map = mapInputFile(infile, &mapLen);
+    char *end = map + mapLen;
+    char *p;
+    int t;
+    
+    build.nbrThreads = nbrThreads;
+    build.corpus = corpus;
+    build.chunkStart = malloc((nbrThreads + 1) * sizeof(char *));
+    build.chunks = malloc(nbrThreads * sizeof(ArrayBuilder));
+    build.lists = calloc(nbrThreads * nbrThreads, sizeof(ShardList));
+    build.shards = calloc(nbrThreads, sizeof(ShardList));
+    build.rank = calloc(nbrThreads, sizeof(int *));
+    build.nbrRanked = calloc(nbrThreads, sizeof(int));
+    build.ary = NULL;
+    build.aryLen = 0;
+    if (workers == NULL || threads == NULL || build.chunkStart == NULL || build.chunks == NULL
+            || build.lists == NULL || build.shards == NULL || build.rank == NULL
+            || build.nbrRanked == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // cut the input into chunks of roughly equal size at line breaks
+    // (for a corpus, after any byte that is not a letter)
+    build.chunkStart[0] = map;
+    for (t = 1; t < nbrThreads; t++) {
+        p = map + mapLen / nbrThreads * t;
+        if (p < build.chunkStart[t-1]) {
+            p = build.chunkStart[t-1];
+        }
+        while (p > map && p < end && (corpus ? (unsigned char)((p[-1] | 0x20) - 'a') < ALPHABET_SIZE
+                                             : p[-1] != '\n')) {
+            p++;
+        }
+        build.chunkStart[t] = p;
+    }
+    build.chunkStart[nbrThreads] = end;
+    
+    pthread_barrier_init(&build.barrier, NULL, nbrThreads);
+    for (t = 0; t < nbrThreads; t++) {
+        workers[t].build = &build;
+        workers[t].id = t;
+        if (pthread_create(&threads[t], NULL, parallelBuildWorker, &workers[t]) != 0) {
+            fprintf(stderr,"Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (t = 0; t < nbrThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_barrier_destroy(&build.barrier);
+    
+    // the array takes over the nodes of every chunk, and its count of
+    // allocations gains those of the build: the array itself, the eight
+    // arrays above and the shard lists
+    header = getAryHeader(build.ary);
+    if (corpus) {
+        if (map != NULL) {
+            munmap(map, mapLen);
+        }
+    } else {
+        header->map = map;
+        header->mapLen = mapLen;
+    }
+    header->arena.nbrAllocations = 9;
+    for (t = 0; t < nbrThreads; t++) {
+        spliceArena(&header->arena, &build.chunks[t].arena);
+        header->arena.nbrAllocations += build.shards[t].nbrAllocations;
+        free(build.shards[t].entries);
+        free(build.rank[t]);
+    }
+    for (t = 0; t < nbrThreads * nbrThreads; t++) {
+        header->arena.nbrAllocations += build.lists[t].nbrAllocations;
+        free(build.lists[t].entries);
+    }
+    free(build.chunkStart);
+    free(build.chunks);
+    free(build.lists);
+    free(build.shards);
+    free(build.rank);
+    free(build.nbrRanked);
+    free(workers);
+    free(threads);
+    
+    *aryLen = build.aryLen;
+    return build.ary;
+}
+
+/************************************************************************
+ * Same as buildAnagramArray, but overlaps reading the input with		*
+ * computing keys and grouping, in three stages connected by bounded	*
+ * single-producer/single-consumer queues:								*
+ *		- a reader thread read()s the input in PIPELINE_BLOCK_SIZE		*
+ *		  blocks and cuts the lines into batches of PIPELINE_BATCH		*
+ *		  words, which it deals out to the workers in turn				*
+ *		- nbrWorkers signature workers compute the keys of a batch at	*
+ *		  a time														*
+ *		- the calling thread, the aggregator, takes the batches back	*
+ *		  from the workers in the same turn (which is input order) and	*
+ *		  adds their words to the groups								*
+ * While the reader waits for the disk the other stages keep working,	*
+ * which pays off most when the input is not in the page cache. The		*
+ * words stay in the blocks they were read into (no per-word copy), and	*
+ * the groups come out exactly as buildAnagramArray makes them.			*
+ ************************************************************************/
+AryElement *buildAnagramArrayPipelined(char *infile, int *aryLen, int nbrWorkers)
+{
+    Pipeline pipeline;
+    PipelineWorker *workers = malloc(nbrWorkers * sizeof(PipelineWorker));
+    pthread_t *threads = malloc((nbrWorkers + 1) * sizeof(pthread_t));
+    ArrayBuilder builder;
+    PipelineBatch *batch;
+    uint64_t capacity = 1;
+    int w, i;
+    
+    pipeline.infile = infile;
+    pipeline.nbrWorkers = nbrWorkers;
+    pipeline.nbrBatches = PIPELINE_BATCHES_PER_WORKER * nbrWorkers;
+    pipeline.batches = malloc(pipeline.nbrBatches * sizeof(PipelineBatch));
+    pipeline.toWorker = malloc(nbrWorkers * sizeof(SpscQueue));
+    pipeline.toAggregator = malloc(nbrWorkers * sizeof(SpscQueue));
+    if (workers == NULL || threads == NULL || pipeline.batches == NULL
+            || pipeline.toWorker == NULL || pipeline.toAggregator == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    // no queue can ever be full: every batch and the end mark fit in it
+    while (capacity < (uint64_t)pipeline.nbrBatches + 1) {
+        capacity *= 2;
+    }
+    initSpscQueue(&pipeline.freeBatches, capacity);
+    for (w = 0; w < nbrWorkers; w++) {
+        initSpscQueue(&pipeline.toWorker[w], capacity);
+        initSpscQueue(&pipeline.toAggregator[w], capacity);
+    }
+    for (i = 0; i < pipeline.nbrBatches; i++) {
+        pushSpscQueue(&pipeline.freeBatches, &pipeline.batches[i]);
+    }
+    initArena(&pipeline.arena);
+    initArrayBuilder(&builder);
+    // the five arrays above and the queues
+    builder.arena.nbrAllocations += 5 + 2 * nbrWorkers + 1;
+    pipeline.kernel = builder.kernel;
+    
+    if (pthread_create(&threads[nbrWorkers], NULL, pipelineReader, &pipeline) != 0) {
+        fprintf(stderr,"Error creating thread\n");
+        exit(EXIT_FAILURE);
+    }
+    for (w = 0; w < nbrWorkers; w++) {
+        workers[w].pipeline = &pipeline;
+        workers[w].id = w;
+        if (pthread_create(&threads[w], NULL, pipelineWorker, &workers[w]) != 0) {
+            fprintf(stderr,"Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    for (w = 0; (batch = popSpscQueue(&pipeline.toAggregator[w])) != NULL; w = (w + 1) % nbrWorkers) {
+        for (i = 0; i < batch->nbrWords; i++) {
+            if (i + 4 < batch->nbrWords) {
+                __builtin_prefetch(&builder.table.slots[batch->hashes[i+4] & (builder.table.capacity - 1)]);
+            }
+            addKeyedNodeToArray(&builder, &batch->nodes[i], &batch->keys[i], batch->hashes[i]);
+        }
+        pushSpscQueue(&pipeline.freeBatches, batch);
+    }
+    
+    for (w = 0; w <= nbrWorkers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+    for (w = 0; w < nbrWorkers; w++) {
+        free(pipeline.toWorker[w].items);
+        free(pipeline.toAggregator[w].items);
+    }
+    free(pipeline.freeBatches.items);
+    free(pipeline.toWorker);
+    free(pipeline.toAggregator);
+    free(pipeline.batches);
+    free(workers);
+    free(threads);
+    spliceArena(&builder.arena, &pipeline.arena);
+    return finishArrayBuilder(&builder, aryLen);
+}
+
+/************************************************************************
+ * Body of the reader of a pipelined build (arg is its Pipeline). Each	*
+ * block starts with the unfinished last line of the previous one, so	*
+ * lines may be as long as they like. Empty lines are skipped and a		*
+ * "\r" before the "\n" is dropped, as in the other builders.			*
+ ************************************************************************/
+void *pipelineReader(void *arg)
+{
+    Pipeline *pipeline = arg;
+    PipelineBatch *batch = NULL;
+    char *block, *line, *end, *newline;
+    char *carry = "";
+    size_t carryLength = 0, size, used;
+    ssize_t n;
+    int length, i, w = 0;
+    bool atEnd = false;
+    int fd = open(pipeline->infile, O_RDONLY);
+    
+    if (fd < 0) {
+        fprintf(stderr,"Error opening file %s\n", pipeline->infile);
+        exit(EXIT_FAILURE);
+    }
+    while (!atEnd) {
+        size = (carryLength < PIPELINE_BLOCK_SIZE / 2) ? PIPELINE_BLOCK_SIZE : 2 * carryLength;
+        block = arenaAlloc(&pipeline->arena, size);
+        memcpy(block, carry, carryLength);
+        used = carryLength;
+        while (used < size) {
+            n = read(fd, block + used, size - used);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                fprintf(stderr,"Error reading file %s\n", pipeline->infile);
+                exit(EXIT_FAILURE);
+            }
+            if (n == 0) {
+                atEnd = true;
+                break;
+            }
+            used += n;
+        }
+        
+        line = block;
+        end = block + used;
+        while (line < end) {
+            newline = memchr(line, '\n', end - line);
+            if (newline == NULL && !atEnd) {
+                break;
+            }
+            length = ((newline != NULL) ? newline : end) - line;
+            if (length > 0 && line[length-1] == '\r') {
+                length--;
+            }
+            if (length > 0) {
+                if (batch == NULL) {
+                    batch = popSpscQueue(&pipeline->freeBatches);
+                    batch->nodes = arenaAlloc(&pipeline->arena, PIPELINE_BATCH * sizeof(Node));
+                    batch->nbrWords = 0;
+                }
+                batch->nodes[batch->nbrWords].text = line;
+                batch->nodes[batch->nbrWords].length = length;
+                batch->nodes[batch->nbrWords].next = NULL;
+                if (++batch->nbrWords == PIPELINE_BATCH) {
+                    pushSpscQueue(&pipeline->toWorker[w], batch);
+                    w = (w + 1) % pipeline->nbrWorkers;
+                    batch = NULL;
+                }
+            }
+            line = (newline != NULL) ? newline + 1 : end;
+        }
+        carry = line;
+        carryLength = end - line;
+    }
+    close(fd);
+    
+    if (batch != NULL) {
+        pushSpscQueue(&pipeline->toWorker[w], batch);
+        w = (w + 1) % pipeline->nbrWorkers;
+    }
+    for (i = 0; i < pipeline->nbrWorkers; i++) {
+        pushSpscQueue(&pipeline->toWorker[w], NULL);
+        w = (w + 1) % pipeline->nbrWorkers;
+    }
+    return NULL;
+}
+
+/************************************************************************
+ * Body of a signature worker of a pipelined build (arg is its			*
+ * PipelineWorker): computes the keys and hashes of every batch it gets	*
+ * and passes the batch on, until the end mark, which it passes on too.	*
+ ************************************************************************/
+void *pipelineWorker(void *arg)
+{
+    PipelineWorker *worker = arg;
+    Pipeline *pipeline = worker->pipeline;
+    PipelineBatch *batch;
+    Signature sig;
+    int i;
+    
+    while ((batch = popSpscQueue(&pipeline->toWorker[worker->id])) != NULL) {
+        for (i = 0; i < batch->nbrWords; i++) {
+            pipeline->kernel(batch->nodes[i].text, batch->nodes[i].length, &sig);
+            computeAnagramKey(&sig, &batch->keys[i]);
+            batch->hashes[i] = hashAnagramKey(&batch->keys[i]);
+        }
+        pushSpscQueue(&pipeline->toAggregator[worker->id], batch);
+    }
+    pushSpscQueue(&pipeline->toAggregator[worker->id], NULL);
+    return NULL;
+}
+
+/************************************************************************
+ * Prepares an empty queue for capacity (a power of two) items.			*
+ ************************************************************************/
+void initSpscQueue(SpscQueue *queue, uint64_t capacity)
+{
+    queue->items = malloc(capacity * sizeof(void *));
+    if (queue->items == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    queue->capacity = capacity;
+    queue->head = queue->seenTail = 0;
+    queue->tail = queue->seenHead = 0;
+}
+
+/************************************************************************
+ * Adds an item to a queue; only its one producer thread may call this.	*
+ * Waits while the queue is full. The item is stored before the new		*
+ * tail is published (release), so the consumer never sees a slot that	*
+ * has not been written yet.											*
+ ************************************************************************/
+void pushSpscQueue(SpscQueue *queue, void *item)
+{
+    int spins = 0;
+    
+    while (queue->tail - queue->seenHead == queue->capacity) {
+        queue->seenHead = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (queue->tail - queue->seenHead == queue->capacity) {
+            waitForQueue(&spins);
+        }
+    }
+    queue->items[queue->tail & (queue->capacity - 1)] = item;
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+}
+
+/************************************************************************
+ * Takes the oldest item from a queue; only its one consumer thread may	*
+ * call this. Waits while the queue is empty.							*
+ ************************************************************************/
+void *popSpscQueue(SpscQueue *queue)
+{
+    void *item;
+    int spins = 0;
+    
+    while (queue->head == queue->seenTail) {
+        queue->seenTail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        if (queue->head == queue->seenTail) {
+            waitForQueue(&spins);
+        }
+    }
+    item = queue->items[queue->head & (queue->capacity - 1)];
+    __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+/************************************************************************
+ * Waits a little for the other side of a queue: the first QUEUE_SPINS	*
+ * times by spinning, after that by giving up the CPU, so that a stage	*
+ * that waits for the disk does not keep a core busy.					*
+ ************************************************************************/
+void waitForQueue(int *spins)
+{
+    if (++*spins < QUEUE_SPINS) {
+#ifdef HAVE_X86_SIMD
+        _mm_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+/************************************************************************
+ * Same as buildAnagramArray, but for raw text instead of a word list:	*
+ * the words of infile are its runs of letters 'a'..'z' and 'A'..'Z',	*
+ * folded to lower case; every other byte (digits, punctuation, white	*
+ * space, bytes of non-ASCII characters) ends a word and is dropped.	*
+ * Each distinct word is grouped once, at its first appearance. The		*
+ * file is mapped and scanned CORPUS_BLOCK bytes at a time with the		*
+ * letter kernel of the running CPU (see selectLetterKernel); the words	*
+ * are copied into the array's arena, so the mapping is released before	*
+ * returning. On one core this runs at about 75-140 MB/s, not at memory	*
+ * speed: classifying the bytes takes under a tenth of the time, and	*
+ * hashing every word and looking it up among the distinct words (see	*
+ * addCorpusBatch) the rest, which grows with the vocabulary. Both		*
+ * parts split over threads (see buildAnagramArrayFromCorpusParallel).	*
+ ************************************************************************/
+AryElement *buildAnagramArrayFromCorpus(char *infile, int *aryLen)
+{
+    ArrayBuilder builder;
+    size_t mapLen;
+    char *map = mapInputFile(infile, &mapLen);
+    
+    initArrayBuilder(&builder);
+    if (map != NULL) {
+        posix_madvise(map, mapLen, POSIX_MADV_SEQUENTIAL);
+        addCorpusText(&builder, map, map + mapLen);
+        munmap(map, mapLen);
+    }
+    return finishArrayBuilder(&builder, aryLen);
+}
+
+/************************************************************************
+ * Adds the distinct words of the text in [start, end) to the builder	*
+ * (see buildAnagramArrayFromCorpus). Each block of CORPUS_BLOCK bytes	*
+ * is classified at once into a bit mask of its letters, so runs of		*
+ * letters and of other bytes are skipped with one count of trailing	*
+ * zeros each. The folded words are gathered into batches of WORD_BATCH	*
+ * (see addCorpusBatch); a word may span any number of blocks.			*
+ ************************************************************************/
+void addCorpusText(ArrayBuilder *builder, char *start, char *end)
+{
+    LetterKernel kernel = selectLetterKernel();
+    char last[CORPUS_BLOCK], folded[CORPUS_BLOCK];
+    CorpusBatch batch;
+    WordSet set;
+    uint64_t mask, bits;
+    int wordLen = 0, pos, run;
+    char *p;
+    
+    initWordSet(&set);
+    builder->arena.nbrAllocations++;
+    batch.text = NULL;
+    batch.used = batch.capacity = 0;
+    batch.nbrWords = 0;
+    for (p = start; p < end; p += CORPUS_BLOCK) {
+        if (end - p >= CORPUS_BLOCK) {
+            mask = kernel(p, folded);
+        } else {
+            memset(last, 0, CORPUS_BLOCK);
+            memcpy(last, p, end - p);
+            mask = kernel(last, folded);
+        }
+        
+        pos = 0;
+        while (pos < CORPUS_BLOCK) {
+            bits = mask >> pos;
+            if ((bits & 1) == 0) {
+                if (wordLen > 0) {
+                    endCorpusWord(builder, &set, &batch, wordLen);
+                    wordLen = 0;
+                }
+                if (bits == 0) {
+                    break;
+                }
+                pos += __builtin_ctzll(bits);
+                continue;
+            }
+            run = (~bits == 0) ? CORPUS_BLOCK - pos : __builtin_ctzll(~bits);
+            if (batch.used + run > batch.capacity) {
+                batch.capacity = (batch.capacity == 0) ? 4096 : 2 * batch.capacity;
+                if (batch.capacity < batch.used + run) {
+                    batch.capacity = batch.used + run;
+                }
+                batch.text = realloc(batch.text, batch.capacity);
+                if (batch.text == NULL) {
+                    fprintf(stderr,"Out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                builder->arena.nbrAllocations++;
+            }
+            memcpy(batch.text + batch.used, folded + pos, run);
+            batch.used += run;
+            wordLen += run;
+            pos += run;
+        }
+    }
+    if (wordLen > 0) {
+        endCorpusWord(builder, &set, &batch, wordLen);
+    }
+    addCorpusBatch(builder, &set, &batch);
+    
+    free(batch.text);
+    free(set.entries);
+}
+
+/************************************************************************
+ * Ends the word made of the last length bytes of the batch's text, and	*
+ * passes the batch on once it holds WORD_BATCH words.					*
+ ************************************************************************/
+void endCorpusWord(ArrayBuilder *builder, WordSet *set, CorpusBatch *batch, int length)
+{
+    batch->offset[batch->nbrWords] = batch->used - length;
+    batch->length[batch->nbrWords] = length;
+    if (++batch->nbrWords == WORD_BATCH) {
+        addCorpusBatch(builder, set, batch);
+    }
+}
+
+/************************************************************************
+ * Adds the words of a batch that the set has not seen before to the	*
+ * builder and empties the batch. New words are copied into the			*
+ * builder's arena. As in addNodesToArray, the work goes in passes over	*
+ * the whole batch so that cache misses overlap: the hashes are			*
+ * computed and the set entries prefetched, then the text of the words	*
+ * in those entries is prefetched, and only then are the words looked	*
+ * up.																	*
+ ************************************************************************/
+void addCorpusBatch(ArrayBuilder *builder, WordSet *set, CorpusBatch *batch)
+{
+    Node *nodes[WORD_BATCH];
+    SeenWord *entry;
+    char *word;
+    size_t i;
+    int w, length, nbrNew = 0;
+    
+    for (w = 0; w < batch->nbrWords; w++) {
+        batch->hash[w] = hashWordText(batch->text + batch->offset[w], batch->length[w]);
+        __builtin_prefetch(&set->entries[(size_t)(batch->hash[w] >> 32) & (set->capacity - 1)]);
+    }
+    for (w = 0; w < batch->nbrWords; w++) {
+        entry = &set->entries[(size_t)(batch->hash[w] >> 32) & (set->capacity - 1)];
+        if (entry->node != NULL) {
+            __builtin_prefetch(entry->node->text);
+        }
+    }
+    
+    for (w = 0; w < batch->nbrWords; w++) {
+        word = batch->text + batch->offset[w];
+        length = batch->length[w];
+        i = (size_t)(batch->hash[w] >> 32) & (set->capacity - 1);
+        for (entry = &set->entries[i]; entry->node != NULL; entry = &set->entries[i]) {
+            if (entry->hash == batch->hash[w] && entry->node->length == length
+                    && memcmp(entry->node->text, word, length) == 0) {
+                break;
+            }
+            i = (i + 1) & (set->capacity - 1);
+        }
+        if (entry->node == NULL) {
+            entry->hash = batch->hash[w];
+            entry->node = createNodeInArena(&builder->arena, word, length);
+            nodes[nbrNew++] = entry->node;
+            if (++set->used * 2 > set->capacity) {
+                growWordSet(set);
+                builder->arena.nbrAllocations++;
+            }
+        }
+    }
+    addNodesToArray(builder, nodes, nbrNew);
+    batch->nbrWords = 0;
+    batch->used = 0;
+}
+
+/************************************************************************
+ * Prepares an empty set of words.										*
+ ************************************************************************/
+void initWordSet(WordSet *set)
+{
+    set->capacity = INITIAL_TABLE_SIZE;
+    set->used = 0;
+    set->entries = calloc(set->capacity, sizeof(SeenWord));
+    if (set->entries == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/************************************************************************
+ * Doubles the number of entries of a set of words and re-inserts every	*
+ * word, using the hashes kept in the entries.							*
+ ************************************************************************/
+void growWordSet(WordSet *set)
+{
+    SeenWord *old = set->entries;
+    size_t oldCapacity = set->capacity, i, j;
+    
+    set->capacity *= 2;
+    set->entries = calloc(set->capacity, sizeof(SeenWord));
+    if (set->entries == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i].node != NULL) {
+            j = (size_t)(old[i].hash >> 32) & (set->capacity - 1);
+            while (set->entries[j].node != NULL) {
+                j = (j + 1) & (set->capacity - 1);
+            }
+            set->entries[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+/************************************************************************
+ * Adds a word to a set of words and returns true, or returns false if	*
+ * the set already has a word of the same text.							*
+ ************************************************************************/
+bool addSeenWord(WordSet *set, Node *node)
+{
+    uint64_t hash = hashWordText(node->text, node->length);
+    size_t i = (size_t)(hash >> 32) & (set->capacity - 1);
+    SeenWord *entry;
+    
+    for (entry = &set->entries[i]; entry->node != NULL; entry = &set->entries[i]) {
+        if (entry->hash == hash && entry->node->length == node->length
+                && memcmp(entry->node->text, node->text, node->length) == 0) {
+            return false;
+        }
+        i = (i + 1) & (set->capacity - 1);
+    }
+    entry->hash = hash;
+    entry->node = node;
+    if (++set->used * 2 > set->capacity) {
+        growWordSet(set);
+    }
+    return true;
+}
+
+/************************************************************************
+ * Returns a 64-bit hash of the bytes of a word, taken 8 at a time.		*
+ ************************************************************************/
+uint64_t hashWordText(char *text, int length)
+{
+    uint64_t hash = (uint64_t)length * 0x9E3779B97F4A7C15ull;
+    uint64_t chunk;
+    int i;
+    
+    for (i = 0; i + 8 <= length; i += 8) {
+        memcpy(&chunk, text + i, 8);
+        hash = (hash ^ chunk) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 29;
+    }
+    if (i < length) {
+        chunk = 0;
+        memcpy(&chunk, text + i, length - i);
+        hash = (hash ^ chunk) * 0xFF51AFD7ED558CCDull;
+    }
+    hash ^= hash >> 32;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    return hash ^ (hash >> 29);
+}
+
+/************************************************************************
+ * Takes a filename used for output, a pointer to the array, and size	*
+ * of the array, and prints	the list of anagrams (see sample output) 	*
+ * to the file specified.												*
+ ************************************************************************/
+void printAnagramArray(char *outfile, AryElement *ary, int aryLen)
+{
+    OutputBuffer out;
+    
+    // groups are copied into one large buffer that is written with
+    // write(), which is much cheaper than an fprintf call per word
+    initOutputBuffer(&out, openOutputFile(outfile), OUTPUT_BUFFER_SIZE);
+    writeGroups(&out, ary, 0, aryLen);
+    flushOutput(&out);
+    free(out.data);
+    if (out.fd != STDOUT_FILENO) {
+        close(out.fd);
+    }
+}
+
+/************************************************************************
+ * Same as printAnagramArray, but formats the groups on nbrThreads		*
+ * threads. Output goes in rounds: in each round every thread formats	*
+ * the next PRINT_ROUND_GROUPS groups into a buffer of its own, and the	*
+ * calling thread writes the buffers of a round in thread order, so the	*
+ * output is identical to that of printAnagramArray. Each thread has	*
+ * two buffers, so the groups of the next round are formatted while		*
+ * the current round is being written.									*
+ ************************************************************************/
+void printAnagramArrayParallel(char *outfile, AryElement *ary, int aryLen, int nbrThreads)
+{
+    ParallelPrint print;
+    PrintWorker *workers = malloc(nbrThreads * sizeof(PrintWorker));
+    pthread_t *threads = malloc(nbrThreads * sizeof(pthread_t));
+    int fd = openOutputFile(outfile);
+    int perRound = PRINT_ROUND_GROUPS * nbrThreads;
+    OutputBuffer *buffer;
+    int r, t;
+    
+    print.ary = ary;
+    print.aryLen = aryLen;
+    print.nbrThreads = nbrThreads;
+    print.nbrRounds = (aryLen + perRound - 1) / perRound;
+    print.buffers = malloc(2 * nbrThreads * sizeof(OutputBuffer));
+    if (workers == NULL || threads == NULL || print.buffers == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (t = 0; t < 2 * nbrThreads; t++) {
+        initOutputBuffer(&print.buffers[t], -1, OUTPUT_BUFFER_SIZE);
+    }
+    pthread_barrier_init(&print.barrier, NULL, nbrThreads + 1);
+    for (t = 0; t < nbrThreads; t++) {
+        workers[t].print = &print;
+        workers[t].id = t;
+        if (pthread_create(&threads[t], NULL, parallelPrintWorker, &workers[t]) != 0) {
+            fprintf(stderr,"Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    for (r = 0; r < print.nbrRounds; r++) {
+        pthread_barrier_wait(&print.barrier);
+        for (t = 0; t < nbrThreads; t++) {
+            buffer = &print.buffers[(r % 2) * nbrThreads + t];
+            writeAll(fd, buffer->data, buffer->used);
+            buffer->used = 0;
+        }
+    }
+    
+    for (t = 0; t < nbrThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_barrier_destroy(&print.barrier);
+    for (t = 0; t < 2 * nbrThreads; t++) {
+        free(print.buffers[t].data);
+    }
+    free(print.buffers);
+    free(workers);
+    free(threads);
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * Body of a formatting thread of printAnagramArrayParallel. Waiting at	*
+ * the barrier after round r lets the writer have round r while this	*
+ * thread formats round r+1 into its other buffer; the writer reaches	*
+ * the next barrier only after writing round r, so the buffer is free	*
+ * again when round r+2 needs it.										*
+ ************************************************************************/
+void *parallelPrintWorker(void *arg)
+{
+    PrintWorker *worker = arg;
+    ParallelPrint *print = worker->print;
+    OutputBuffer *buffer;
+    int r, start, end;
+    
+    for (r = 0; r < print->nbrRounds; r++) {
+        buffer = &print->buffers[(r % 2) * print->nbrThreads + worker->id];
+        start = (r * print->nbrThreads + worker->id) * PRINT_ROUND_GROUPS;
+        end = (start + PRINT_ROUND_GROUPS < print->aryLen) ? start + PRINT_ROUND_GROUPS : print->aryLen;
+        writeGroups(buffer, print->ary, start, end);
+        pthread_barrier_wait(&print->barrier);
+    }
+    return NULL;
+}
+
+/************************************************************************
+ * Appends the groups start up to end-1 of an array that have at least	*
+ * two words to an output buffer. The nodes of a group are scattered	*
+ * in memory, so the first nodes and words of the groups a little		*
+ * further on are prefetched while the current group is copied.			*
+ ************************************************************************/
+void writeGroups(OutputBuffer *out, AryElement *ary, int start, int end)
+{
+    int g;
+    
+    for (g = start; g < end; g++) {
+        if (g + 16 < end && ary[g+16].size > 1) {
+            __builtin_prefetch(ary[g+16].head);
+        }
+        if (g + 8 < end && ary[g+8].size > 1) {
+            __builtin_prefetch(ary[g+8].head->text);
+            __builtin_prefetch(ary[g+8].head->next);
+        }
+        if (ary[g].size > 1) {
+            writeGroup(out, &ary[g]);
+        }
+    }
+}
+
+/************************************************************************
+ * Appends the words of a group to an output buffer in the format of	*
+ * printAnagramArray: each word followed by a space, then a newline.	*
+ * The room for the whole line is made once, then the words are copied.	*
+ ************************************************************************/
+void writeGroup(OutputBuffer *out, AryElement *element)
+{
+    Node *node;
+    size_t bytes = 1;
+    char *p;
+    
+    for (node = element->head; node != NULL; node = node->next) {
+        bytes += node->length + 1;
+    }
+    reserveOutput(out, bytes);
+    p = out->data + out->used;
+    for (node = element->head; node != NULL; node = node->next) {
+        memcpy(p, node->text, node->length);
+        p += node->length;
+        *p++ = ' ';
+    }
+    *p = '\n';
+    out->used += bytes;
+}
+
+/************************************************************************
+ * Releases memory allocated for the array and all the linked lists.	*
+ * This involves releasing the memory allocated for each Node of each	*
+ * linked list and the array itself. Before freeing up memory of a Node *
+ * object, make sure to release the memory allocated for the 			*
+ * "text" field of that node first.										*
+ * The nodes and their text all live in the array's arena, so this is	*
+ * done by releasing the arena's blocks in one sweep instead of walking	*
+ * the lists. Arrays built from a mapped file also unmap the file.		*
+ ************************************************************************/
+void freeAnagramArray(AryElement *ary, int aryLen)
+{
+    AryHeader *header = getAryHeader(ary);
+    (void)aryLen;
+    releaseArena(&header->arena);
+    if (header->map != NULL) {
+        munmap(header->map, header->mapLen);
+    }
+    free(header);
+}
+
+/************************************************************************
+ * Same as buildAnagramArrayMapped, but stores the groups in a			*
+ * GroupStore instead of an array of linked lists. The first pass over	*
+ * the mapped input finds the group of every word through the signature	*
+ * table and counts the words and bytes of each group, so adding a word	*
+ * is O(1). The second pass copies every word to the next free place of	*
+ * its group, which leaves each group in one run of the pool. The input	*
+ * is unmapped before returning.										*
+ ************************************************************************/
+void buildGroupStore(char *infile, GroupStore *store)
+{
+    SignatureKernel kernel = selectSignatureKernel();
+    SignatureTable table;
+    Arena arena;
+    Signature sig;
+    AnagramKey key;
+    unsigned int hash;
+    TableSlot *slot;
+    Node probe;
+    size_t mapLen;
+    char *map = mapInputFile(infile, &mapLen);
+    char *end = map + mapLen;
+    char *p, *word;
+    int *groupOf = NULL, *nextWord = NULL;
+    uint64_t *nextByte = NULL;
+    uint64_t bytes = 0, size;
+    int wordCapacity = 0, groupCapacity = 0;
+    int nbrWords = 0, nbrGroups = 0;
+    int length, g, w;
+    
+    initSignatureTable(&table, INITIAL_TABLE_SIZE);
+    initArena(&arena);
+    store->nbrAllocations = 1;
+    
+    p = map;
+    while ((word = nextMappedLine(&p, end, &length)) != NULL) {
+        kernel(word, length, &sig);
+        computeAnagramKey(&sig, &key);
+        hash = hashAnagramKey(&key);
+        probe.text = word;
+        probe.length = length;
+        probe.next = NULL;
+        slot = findSlot(&table, &key, hash, &probe);
+        
+        if (slot->index < 0) {
+            // new group: its first word stays in the slot for keysMatch
+            if (nbrGroups == groupCapacity) {
+                groupCapacity = (groupCapacity == 0) ? 64 : 2 * groupCapacity;
+                nextWord = realloc(nextWord, groupCapacity * sizeof(int));
+                nextByte = realloc(nextByte, groupCapacity * sizeof(uint64_t));
+                if (nextWord == NULL || nextByte == NULL) {
+                    fprintf(stderr,"Out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                store->nbrAllocations += 2;
+            }
+            nextWord[nbrGroups] = 0;
+            nextByte[nbrGroups] = 0;
+            slot->index = nbrGroups++;
+            slot->hash = hash;
+            slot->key = key;
+            slot->tail = arenaAlloc(&arena, sizeof(Node));
+            *slot->tail = probe;
+            table.used++;
+        }
+        g = slot->index;
+        if (4 * table.used > 3 * table.capacity) {
+            growSignatureTable(&table);
+            store->nbrAllocations++;
+        }
+        
+        if (nbrWords == wordCapacity) {
+            wordCapacity = (wordCapacity == 0) ? 64 : 2 * wordCapacity;
+            groupOf = realloc(groupOf, wordCapacity * sizeof(int));
+            if (groupOf == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            store->nbrAllocations++;
+        }
+        groupOf[nbrWords++] = g;
+        nextWord[g]++;
+        nextByte[g] += length + 1;
+    }
+    free(table.slots);
+    store->nbrAllocations += arena.nbrAllocations + 3;
+    releaseArena(&arena);
+    
+    // turn the word and byte counts of the groups into the positions
+    // where their first words go
+    store->nbrGroups = nbrGroups;
+    store->nbrWords = nbrWords;
+    store->groupStart = malloc((nbrGroups + 1) * sizeof(int));
+    store->wordOffset = malloc((nbrWords + 1) * sizeof(uint64_t));
+    if (store->groupStart == NULL || store->wordOffset == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    w = 0;
+    for (g = 0; g < nbrGroups; g++) {
+        store->groupStart[g] = w;
+        w += nextWord[g];
+        nextWord[g] = store->groupStart[g];
+        size = nextByte[g];
+        nextByte[g] = bytes;
+        bytes += size;
+    }
+    store->groupStart[nbrGroups] = nbrWords;
+    store->wordOffset[nbrWords] = bytes;
+    store->pool = malloc(bytes + 1);
+    if (store->pool == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    p = map;
+    w = 0;
+    while ((word = nextMappedLine(&p, end, &length)) != NULL) {
+        g = groupOf[w++];
+        store->wordOffset[nextWord[g]++] = nextByte[g];
+        memcpy(store->pool + nextByte[g], word, length);
+        store->pool[nextByte[g] + length] = ' ';
+        nextByte[g] += length + 1;
+    }
+    
+    free(groupOf);
+    free(nextWord);
+    free(nextByte);
+    if (map != NULL) {
+        munmap(map, mapLen);
+    }
+}
+
+/************************************************************************
+ * Same as printAnagramArray, but prints the groups of a GroupStore.	*
+ * The pool already holds every group in the output format, so each		*
+ * group is a single copy of one run of bytes.							*
+ ************************************************************************/
+void printGroupStore(char *outfile, GroupStore *store)
+{
+    OutputBuffer out;
+    uint64_t start, end;
+    int g;
+    
+    initOutputBuffer(&out, openOutputFile(outfile), OUTPUT_BUFFER_SIZE);
+    for (g = 0; g < store->nbrGroups; g++) {
+        if (store->groupStart[g+1] - store->groupStart[g] > 1) {
+            start = store->wordOffset[store->groupStart[g]];
+            end = store->wordOffset[store->groupStart[g+1]];
+            writeOutput(&out, store->pool + start, end - start);
+            writeOutput(&out, "\n", 1);
+        }
+    }
+    flushOutput(&out);
+    free(out.data);
+    if (out.fd != STDOUT_FILENO) {
+        close(out.fd);
+    }
+}
+
+/************************************************************************
+ * Releases the three arrays of a GroupStore.							*
+ ************************************************************************/
+void freeGroupStore(GroupStore *store)
+{
+    free(store->groupStart);
+    free(store->wordOffset);
+    free(store->pool);
+}
+
+/************************************************************************
+ * Builds the groups of infile in a CompactStore without ever holding	*
+ * its words whole. The first pass over the mapped input finds the		*
+ * group of every word (addCompactWord), which keeps only the first		*
+ * word of each group, as a pointer into the map, and counts the words	*
+ * of each group. Those counts place every group in one array of map	*
+ * offsets, which the second pass fills, so the words of each group		*
+ * are then at hand to be sorted and front-coded (encodeCompactGroup)	*
+ * straight into the pool. A front-coded word never takes more bytes	*
+ * than the word plus one, so the pool is allocated once at that size	*
+ * (plus the two varints of each group) and shrunk to fit at the end.	*
+ * The input is unmapped before returning.								*
+ ************************************************************************/
+void buildCompactStore(char *infile, CompactStore *store)
+{
+    SignatureKernel kernel = selectSignatureKernel();
+    CompactGrouping grouping;
+    size_t mapLen;
+    char *map = mapInputFile(infile, &mapLen);
+    char *end = map + mapLen;
+    char *p, *word;
+    int *groupOf = NULL, *size;
+    Node *words;
+    unsigned char *out;
+    uint64_t bytes = 0;
+    uint64_t *offset;
+    int wordCapacity = 0, nbrWords = 0, largest = 0;
+    int start, length, g, w;
+    
+    grouping.capacity = INITIAL_TABLE_SIZE;
+    grouping.used = 0;
+    grouping.slots = calloc(grouping.capacity, sizeof(uint64_t));
+    if (grouping.slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    grouping.first = NULL;
+    grouping.length = NULL;
+    grouping.size = NULL;
+    grouping.nbrGroups = 0;
+    grouping.groupCapacity = 0;
+    grouping.nbrAllocations = 1;
+    
+    p = map;
+    while ((word = nextMappedLine(&p, end, &length)) != NULL) {
+        if (nbrWords == wordCapacity) {
+            wordCapacity = (wordCapacity == 0) ? 64 : 2 * wordCapacity;
+            groupOf = realloc(groupOf, wordCapacity * sizeof(int));
+            if (groupOf == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            grouping.nbrAllocations++;
+        }
+        groupOf[nbrWords++] = addCompactWord(&grouping, kernel, word, length);
+        bytes += length + 1;
+    }
+    free(grouping.slots);
+    free(grouping.first);
+    
+    // size[g] becomes where the words of group g start in offset, and
+    // after they are placed, where the next group's words start
+    size = grouping.size;
+    start = 0;
+    for (g = 0; g < grouping.nbrGroups; g++) {
+        if (size[g] > largest) {
+            largest = size[g];
+        }
+        w = size[g];
+        size[g] = start;
+        start += w;
+    }
+    offset = malloc(nbrWords * sizeof(uint64_t));
+    if (offset == NULL && nbrWords > 0) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    p = map;
+    for (w = 0; w < nbrWords; w++) {
+        word = nextMappedLine(&p, end, &length);
+        offset[size[groupOf[w]]++] = word - map;
+    }
+    free(groupOf);
+    
+    store->nbrGroups = grouping.nbrGroups;
+    store->nbrWords = nbrWords;
+    store->slots = NULL;
+    store->tableSlots = 0;
+    store->groupStart = malloc((grouping.nbrGroups + 1) * sizeof(uint64_t));
+    store->pool = malloc(bytes + 2 * 5 * (uint64_t)grouping.nbrGroups + 1);
+    words = malloc(largest * sizeof(Node));
+    if (store->groupStart == NULL || store->pool == NULL || (words == NULL && largest > 0)) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    store->nbrAllocations = grouping.nbrAllocations + 4;
+    
+    out = store->pool;
+    start = 0;
+    for (g = 0; g < grouping.nbrGroups; g++) {
+        for (w = start; w < size[g]; w++) {
+            words[w - start].text = map + offset[w];
+            words[w - start].length = grouping.length[g];
+            words[w - start].next = NULL;
+        }
+        store->groupStart[g] = out - store->pool;
+        out = encodeCompactGroup(out, words, size[g] - start);
+        start = size[g];
+    }
+    store->groupStart[grouping.nbrGroups] = out - store->pool;
+    out = realloc(store->pool, store->groupStart[grouping.nbrGroups] + 1);
+    if (out == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    store->pool = out;
+    
+    free(words);
+    free(size);
+    free(grouping.length);
+    free(offset);
+    if (map != NULL) {
+        munmap(map, mapLen);
+    }
+}
+
+/************************************************************************
+ * Returns the group of a word during the first pass of					*
+ * buildCompactStore, starting a new group if no group matches. A slot	*
+ * whose hash matches is confirmed against the first word of its group,	*
+ * whose signature is computed again. Every word of a group must have	*
+ * the length of its first word, since a CompactStore stores one length	*
+ * per group; the program stops if one does not.						*
+ ************************************************************************/
+int addCompactWord(CompactGrouping *grouping, SignatureKernel kernel, char *word, int length)
+{
+    uint64_t mask = grouping->capacity - 1;
+    Signature sig, firstSig;
+    AnagramKey key;
+    unsigned int hash;
+    uint64_t s;
+    int g;
+    
+    kernel(word, length, &sig);
+    computeAnagramKey(&sig, &key);
+    hash = hashAnagramKey(&key);
+    for (s = hash & mask; grouping->slots[s] != 0; s = (s + 1) & mask) {
+        g = (int)(uint32_t)grouping->slots[s] - 1;
+        if ((grouping->slots[s] >> 32) == hash) {
+            kernel(grouping->first[g], grouping->length[g], &firstSig);
+            if (signaturesMatch(&firstSig, grouping->first[g], grouping->length[g], &sig, word, length)) {
+                if (length != grouping->length[g]) {
+                    fprintf(stderr,"Anagrams of different lengths: %.*s and %.*s\n",
+                            grouping->length[g], grouping->first[g], length, word);
+                    exit(EXIT_FAILURE);
+                }
+                grouping->size[g]++;
+                return g;
+            }
+        }
+    }
+    
+    if (grouping->nbrGroups == grouping->groupCapacity) {
+        grouping->groupCapacity = (grouping->groupCapacity == 0) ? 64 : 2 * grouping->groupCapacity;
+        grouping->first = realloc(grouping->first, grouping->groupCapacity * sizeof(char *));
+        grouping->length = realloc(grouping->length, grouping->groupCapacity * sizeof(int));
+        grouping->size = realloc(grouping->size, grouping->groupCapacity * sizeof(int));
+        if (grouping->first == NULL || grouping->length == NULL || grouping->size == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        grouping->nbrAllocations += 3;
+    }
+    g = grouping->nbrGroups++;
+    grouping->first[g] = word;
+    grouping->length[g] = length;
+    grouping->size[g] = 1;
+    grouping->slots[s] = ((uint64_t)hash << 32) | (uint32_t)(g + 1);
+    grouping->used++;
+    if (4 * grouping->used > 3 * grouping->capacity) {
+        growCompactGrouping(grouping);
+    }
+    return g;
+}
+
+/************************************************************************
+ * Doubles the number of slots of the table of a CompactGrouping and	*
+ * re-inserts every group, using the hashes kept in the slots.			*
+ ************************************************************************/
+void growCompactGrouping(CompactGrouping *grouping)
+{
+    uint64_t *old = grouping->slots;
+    uint64_t oldCapacity = grouping->capacity, i, j;
+    
+    grouping->capacity *= 2;
+    grouping->slots = calloc(grouping->capacity, sizeof(uint64_t));
+    if (grouping->slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    grouping->nbrAllocations++;
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i] != 0) {
+            j = (old[i] >> 32) & (grouping->capacity - 1);
+            while (grouping->slots[j] != 0) {
+                j = (j + 1) & (grouping->capacity - 1);
+            }
+            grouping->slots[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+/************************************************************************
+ * Sorts the size words of one group, which all have the same length,	*
+ * and writes the group at p in the format of the pool of a				*
+ * CompactStore. Returns the byte after it.								*
+ ************************************************************************/
+unsigned char *encodeCompactGroup(unsigned char *p, Node *words, int size)
+{
+    int length = words[0].length;
+    int shared, i;
+    
+    qsort(words, size, sizeof(Node), compareNodeText);
+    p = putVarint(p, size);
+    p = putVarint(p, length);
+    for (i = 0; i < size; i++) {
+        shared = 0;
+        if (i % COMPACT_RESTART != 0) {
+            while (shared < length && words[i].text[shared] == words[i-1].text[shared]) {
+                shared++;
+            }
+            p = putVarint(p, shared);
+        }
+        memcpy(p, words[i].text + shared, length - shared);
+        p += length - shared;
+    }
+    return p;
+}
+
+/************************************************************************
+ * Same as printAnagramArray, but prints the groups of a CompactStore,	*
+ * decoding the words on the fly (so the words of a group come out in	*
+ * sorted order).														*
+ ************************************************************************/
+void printCompactStore(char *outfile, CompactStore *store)
+{
+    OutputBuffer out;
+    const unsigned char *p;
+    int g;
+    
+    initOutputBuffer(&out, openOutputFile(outfile), OUTPUT_BUFFER_SIZE);
+    for (g = 0; g < store->nbrGroups; g++) {
+        p = store->pool + store->groupStart[g];
+        if (getVarint(&p) > 1) {
+            writeCompactGroup(&out, store, g);
+        }
+    }
+    flushOutput(&out);
+    free(out.data);
+    if (out.fd != STDOUT_FILENO) {
+        close(out.fd);
+    }
+}
+
+/************************************************************************
+ * Writes one group of a CompactStore to an output buffer as one line	*
+ * in the format of printAnagramArray. The words are decoded straight	*
+ * into the buffer: the characters a word shares with the one before	*
+ * it are copied from that word, which was just written there.			*
+ ************************************************************************/
+void writeCompactGroup(OutputBuffer *out, CompactStore *store, int group)
+{
+    const unsigned char *p = store->pool + store->groupStart[group];
+    size_t size = getVarint(&p);
+    size_t length = getVarint(&p);
+    size_t shared, i;
+    char *word;
+    
+    reserveOutput(out, size * (length + 1) + 1);
+    word = out->data + out->used;
+    for (i = 0; i < size; i++) {
+        shared = 0;
+        if (i % COMPACT_RESTART != 0) {
+            shared = getVarint(&p);
+            memcpy(word, word - (length + 1), shared);
+        }
+        memcpy(word + shared, p, length - shared);
+        p += length - shared;
+        word[length] = ' ';
+        word += length + 1;
+    }
+    *word++ = '\n';
+    out->used = word - out->data;
+}
+
+/************************************************************************
+ * Makes the lookup table of a CompactStore, so that lookupCompactStore	*
+ * can find groups by signature. The table has a power of two slots, at	*
+ * least twice as many as there are groups, and is keyed on the hash of	*
+ * the anagram key of the first word of each group.						*
+ ************************************************************************/
+void indexCompactStore(CompactStore *store)
+{
+    const unsigned char *p;
+    Signature sig;
+    AnagramKey key;
+    uint64_t mask, s;
+    int length, g;
+    
+    store->tableSlots = 1;
+    while (store->tableSlots < 2 * (uint64_t)store->nbrGroups) {
+        store->tableSlots *= 2;
+    }
+    store->slots = calloc(store->tableSlots, sizeof(uint32_t));
+    if (store->slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    store->nbrAllocations++;
+    mask = store->tableSlots - 1;
+    
+    for (g = 0; g < store->nbrGroups; g++) {
+        p = store->pool + store->groupStart[g];
+        getVarint(&p);
+        length = getVarint(&p);
+        computeSignature((char *)p, length, &sig);
+        computeAnagramKey(&sig, &key);
+        s = hashAnagramKey(&key) & mask;
+        while (store->slots[s] != 0) {
+            s = (s + 1) & mask;
+        }
+        store->slots[s] = g + 1;
+    }
+}
+
+/************************************************************************
+ * Returns the group of a CompactStore holding the anagrams of the		*
+ * first length characters of word, whose signature is sig, or -1 if	*
+ * there is none; indexCompactStore must have been						*
+ * called first. Candidates are confirmed against the first word of		*
+ * the group, which is a restart point and so can be read in place		*
+ * without decoding.													*
+ ************************************************************************/
+int lookupCompactStore(CompactStore *store, Signature *sig, char *word, int length)
+{
+    uint64_t mask = store->tableSlots - 1;
+    const unsigned char *p;
+    Signature groupSig;
+    AnagramKey key;
+    uint64_t s;
+    uint32_t g;
+    int groupLength;
+    
+    computeAnagramKey(sig, &key);
+    s = hashAnagramKey(&key) & mask;
+    while ((g = store->slots[s]) != 0) {
+        p = store->pool + store->groupStart[g-1];
+        getVarint(&p);
+        groupLength = getVarint(&p);
+        computeSignature((char *)p, groupLength, &groupSig);
+        if (signaturesMatch(&groupSig, (char *)p, groupLength, sig, word, length)) {
+            return g - 1;
+        }
+        s = (s + 1) & mask;
+    }
+    return -1;
+}
+
+/************************************************************************
+ * Releases the arrays of a CompactStore.								*
+ ************************************************************************/
+void freeCompactStore(CompactStore *store)
+{
+    free(store->groupStart);
+    free(store->pool);
+    free(store->slots);
+}
+
+/************************************************************************
+ * qsort comparison function for nodes: orders them by their text, and	*
+ * a word before the longer words it is a prefix of.					*
+ ************************************************************************/
+int compareNodeText(const void *a, const void *b)
+{
+    const Node *node1 = a, *node2 = b;
+    int shorter = (node1->length < node2->length) ? node1->length : node2->length;
+    int diff = memcmp(node1->text, node2->text, shorter);
+    
+    return (diff != 0) ? diff : node1->length - node2->length;
+}
+
+/************************************************************************
+ * Writes value at p as a varint (7 bits per byte, lowest bits first,	*
+ * the top bit set in every byte but the last) and returns the byte		*
+ * after it.															*
+ ************************************************************************/
+unsigned char *putVarint(unsigned char *p, uint64_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+/************************************************************************
+ * Reads a varint written by putVarint at *p and moves *p past it.		*
+ ************************************************************************/
+uint64_t getVarint(const unsigned char **p)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    
+    while (**p & 0x80) {
+        value |= (uint64_t)(*(*p)++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (uint64_t)(*(*p)++) << shift;
+    return value;
+}
+
+/************************************************************************
+ * Returns the next non-empty line in [*p, end) and stores its length	*
+ * (without the trailing "\r", if any) in length, or returns NULL when	*
+ * there are no more lines. *p is moved past the line.					*
+ ************************************************************************/
+char *nextMappedLine(char **p, char *end, int *length)
+{
+    char *line, *nl;
+    
+    while (*p < end) {
+        line = *p;
+        nl = memchr(line, '\n', end - line);
+        if (nl == NULL) {
+            nl = end;
+        }
+        *p = nl + 1;
+        *length = nl - line;
+        if (*length > 0 && line[*length - 1] == '\r') {
+            (*length)--;
+        }
+        if (*length > 0) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+/************************************************************************
+ * Allocates memory for a Node object and initializes the "text" field	*
+ * with the input string/word and the "next" field to NULL. Returns a	*
+ * pointer to the Node object created.									*
+ * The builders use createNodeInArena instead; nodes made here have to	*
+ * be released by the caller.											*
+ ************************************************************************/
+Node *createNode(char *word)
+{
+    Node *node = malloc(sizeof(struct node));
+    char *temp = malloc(strlen(word)+1);
+    strcpy(temp, word);
+    
+    node->text = temp;
+    node->length = strlen(word);
+    node->next = NULL;
+    
+    return node;
+}
+
+/************************************************************************
+ * Same as createNode, but takes both the Node and a '\0'-terminated	*
+ * copy of the word from the arena, with the text placed right behind	*
+ * its node.															*
+ ************************************************************************/
+Node *createNodeInArena(Arena *arena, char *word, int length)
+{
+    Node *node = arenaAlloc(arena, sizeof(Node) + length + 1);
+    char *temp = (char *)(node + 1);
+    memcpy(temp, word, length);
+    temp[length] = '\0';
+    
+    node->text = temp;
+    node->length = length;
+    node->next = NULL;
+    
+    return node;
+}
+
+/************************************************************************
+ * Returns true if the input strings are anagrams, false otherwise.		*
+ * Compares the exact anagram keys of the words, so unlike the old		*
+ * sum-of-squares check it never confuses words that are not anagrams.	*
+ ************************************************************************/
+bool areAnagrams(char *word1, char *word2)
+{
+    Signature sig1, sig2;
+    AnagramKey key1, key2;
+    int len1 = strlen(word1), len2 = strlen(word2);
+    
+    if (len1 != len2) { //if the two words are not the same length, then they cannot be anagrams
+        return false;
+    }
+    computeSignature(word1, len1, &sig1);
+    computeSignature(word2, len2, &sig2);
+    computeAnagramKey(&sig1, &key1);
+    computeAnagramKey(&sig2, &key2);
+    if (key1.lo != key2.lo || key1.hi != key2.hi) {
+        return false;
+    }
+    return (key1.hi & KEY_OVERFLOW) == 0 || signaturesMatch(&sig1, word1, len1, &sig2, word2, len2);
+}
+
+/************************************************************************
+ * The original anagram check: equal lengths and equal sums of squared	*
+ * character codes. It can call words anagrams that are not (e.g. words	*
+ * whose letter codes happen to have equal sums of squares) and is only	*
+ * kept as the baseline of anagramsbench --bench-keys.					*
+ ************************************************************************/
+bool areAnagramsSumOfSquares(char *word1, char *word2)
+{
+    int len1 = 0, len2 = 0, i, x1 = 0, x2 = 0, z;
+    len1 = strlen(word1);
+    len2 = strlen(word2);
+    
+    if(len1 == len2){ //if the two words are not the same length, then they cannot be anagrams
+        for(i=0; i<len1; i++){
+            z = word1[i] * word1[i];
+            x1 = z + x1; //get ascii of the letters and add them together
+        }
+        for(i=0; i<len2; i++){
+            z = word2[i] * word2[i];
+            x2 = z + x2; //get ascii of the letters and add them together
+        }
+        if(x1 == x2){ //if the ascii values are the same, and the word length is the same, the words are anagrams
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/************************************************************************
+ * Computes the signature of a word: the number of times each lower		*
+ * case letter occurs in it, plus the number of other characters (see	*
+ * Signature for words of LONG_WORD characters or more, and for words	*
+ * with other characters). The word does not need to be					*
+ * '\0'-terminated.														*
+ * This is the portable kernel; see selectSignatureKernel.				*
+ ************************************************************************/
+void computeSignature(char *word, int length, Signature *sig)
+{
+    int counts[ALPHABET_SIZE + 1];
+    int i;
+    unsigned char c;
+    
+    memset(sig, 0, sizeof(Signature));
+    for (i = 0; i < length; i++) {
+        c = (unsigned char)(word[i] - 'a');
+        sig->count[c < ALPHABET_SIZE ? c : ALPHABET_SIZE]++;
+    }
+    if (length >= LONG_WORD) {
+        countLetters(word, length, counts);
+        markLongSignature(sig, counts);
+    }
+    if (sig->count[ALPHABET_SIZE] != 0) {
+        markOtherCharacters(sig, word, length);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/************************************************************************
+ * SSE2 version of computeSignature. The histogram lives in two 16-byte	*
+ * registers; every character adds its one-hot row to them, so there	*
+ * are no loads and stores of individual counters.						*
+ ************************************************************************/
+__attribute__((target("sse2")))
+void computeSignatureSSE2(char *word, int length, Signature *sig)
+{
+    const unsigned char (*oneHot)[SIGNATURE_BYTES] = signatureOneHot();
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    int counts[ALPHABET_SIZE + 1];
+    int i;
+    unsigned char c;
+    
+    for (i = 0; i < length; i++) {
+        c = (unsigned char)(word[i] - 'a');
+        c = (c < ALPHABET_SIZE) ? c : ALPHABET_SIZE;
+        lo = _mm_add_epi8(lo, _mm_loadu_si128((const __m128i *)oneHot[c]));
+        hi = _mm_add_epi8(hi, _mm_loadu_si128((const __m128i *)(oneHot[c] + 16)));
+    }
+    _mm_storeu_si128((__m128i *)sig->count, lo);
+    _mm_storeu_si128((__m128i *)(sig->count + 16), hi);
+    if (length >= LONG_WORD) {
+        countLetters(word, length, counts);
+        markLongSignature(sig, counts);
+    }
+    if (sig->count[ALPHABET_SIZE] != 0) {
+        markOtherCharacters(sig, word, length);
+    }
+}
+
+/************************************************************************
+ * AVX2 version of computeSignature: the whole histogram lives in one	*
+ * 32-byte register and every character costs a single byte-wise add	*
+ * of its one-hot row.													*
+ ************************************************************************/
+__attribute__((target("avx2")))
+void computeSignatureAVX2(char *word, int length, Signature *sig)
+{
+    const unsigned char (*oneHot)[SIGNATURE_BYTES] = signatureOneHot();
+    __m256i histogram = _mm256_setzero_si256();
+    int counts[ALPHABET_SIZE + 1];
+    int i;
+    unsigned char c;
+    
+    for (i = 0; i < length; i++) {
+        c = (unsigned char)(word[i] - 'a');
+        c = (c < ALPHABET_SIZE) ? c : ALPHABET_SIZE;
+        histogram = _mm256_add_epi8(histogram, _mm256_loadu_si256((const __m256i *)oneHot[c]));
+    }
+    _mm256_storeu_si256((__m256i *)sig->count, histogram);
+    if (length >= LONG_WORD) {
+        countLetters(word, length, counts);
+        markLongSignature(sig, counts);
+    }
+    if (sig->count[ALPHABET_SIZE] != 0) {
+        markOtherCharacters(sig, word, length);
+    }
+}
+#endif
+
+/************************************************************************
+ * Returns a table with one row per signature byte that a character can	*
+ * increment: row r is all zeros except for a 1 in byte r.				*
+ ************************************************************************/
+const unsigned char (*signatureOneHot(void))[SIGNATURE_BYTES]
+{
+    static const unsigned char oneHot[ALPHABET_SIZE + 1][SIGNATURE_BYTES] = {
+        {[0] = 1}, {[1] = 1}, {[2] = 1}, {[3] = 1}, {[4] = 1}, {[5] = 1},
+        {[6] = 1}, {[7] = 1}, {[8] = 1}, {[9] = 1}, {[10] = 1}, {[11] = 1},
+        {[12] = 1}, {[13] = 1}, {[14] = 1}, {[15] = 1}, {[16] = 1}, {[17] = 1},
+        {[18] = 1}, {[19] = 1}, {[20] = 1}, {[21] = 1}, {[22] = 1}, {[23] = 1},
+        {[24] = 1}, {[25] = 1}, {[26] = 1}
+    };
+    return oneHot;
+}
+
+/************************************************************************
+ * Returns the fastest signature kernel the running CPU supports. All	*
+ * kernels produce identical signatures.								*
+ ************************************************************************/
+SignatureKernel selectSignatureKernel(void)
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        return computeSignatureAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return computeSignatureSSE2;
+    }
+#endif
+    return computeSignature;
+}
+
+/************************************************************************
+ * Scalar letter kernel: returns a mask with bit i set if byte i of the	*
+ * CORPUS_BLOCK bytes of text is a letter 'a'..'z' or 'A'..'Z', and		*
+ * stores the bytes with bit 0x20 set in folded, which turns every		*
+ * letter into lower case (the other bytes of folded are never used).	*
+ ************************************************************************/
+uint64_t classifyLetters(const char *text, char *folded)
+{
+    uint64_t mask = 0;
+    unsigned char c;
+    int i;
+    
+    for (i = 0; i < CORPUS_BLOCK; i++) {
+        c = (unsigned char)text[i] | 0x20;
+        folded[i] = c;
+        if ((unsigned char)(c - 'a') < ALPHABET_SIZE) {
+            mask |= (uint64_t)1 << i;
+        }
+    }
+    return mask;
+}
+
+#ifdef HAVE_X86_SIMD
+/************************************************************************
+ * SSE2 version of classifyLetters, 16 bytes at a time. After folding,	*
+ * adding 128 - 'a' moves the letters to the 26 smallest signed byte	*
+ * values, so one signed compare finds them.							*
+ ************************************************************************/
+__attribute__((target("sse2")))
+uint64_t classifyLettersSSE2(const char *text, char *folded)
+{
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    const __m128i shift = _mm_set1_epi8((char)(128 - 'a'));
+    const __m128i limit = _mm_set1_epi8((char)(-128 + ALPHABET_SIZE));
+    uint64_t mask = 0;
+    __m128i bytes;
+    int i;
+    
+    for (i = 0; i < CORPUS_BLOCK; i += 16) {
+        bytes = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i)), caseBit);
+        _mm_storeu_si128((__m128i *)(folded + i), bytes);
+        bytes = _mm_cmplt_epi8(_mm_add_epi8(bytes, shift), limit);
+        mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(bytes) << i;
+    }
+    return mask;
+}
+
+/************************************************************************
+ * AVX2 version of classifyLetters, 32 bytes at a time.					*
+ ************************************************************************/
+__attribute__((target("avx2")))
+uint64_t classifyLettersAVX2(const char *text, char *folded)
+{
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    const __m256i shift = _mm256_set1_epi8((char)(128 - 'a'));
+    const __m256i limit = _mm256_set1_epi8((char)(-128 + ALPHABET_SIZE));
+    uint64_t mask = 0;
+    __m256i bytes;
+    int i;
+    
+    for (i = 0; i < CORPUS_BLOCK; i += 32) {
+        bytes = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(text + i)), caseBit);
+        _mm256_storeu_si256((__m256i *)(folded + i), bytes);
+        bytes = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(bytes, shift));
+        mask |= (uint64_t)(unsigned int)_mm256_movemask_epi8(bytes) << i;
+    }
+    return mask;
+}
+#endif
+
+/************************************************************************
+ * Returns the fastest letter kernel the running CPU supports. All		*
+ * kernels produce identical results.									*
+ ************************************************************************/
+LetterKernel selectLetterKernel(void)
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        return classifyLettersAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return classifyLettersSSE2;
+    }
+#endif
+    return classifyLetters;
+}
+
+/************************************************************************
+ * Marks the signature of a word of LONG_WORD characters or more, whose	*
+ * exact counts (see countLetters) are in counts: sets byte				*
+ * SIGNATURE_LONG and stores a hash of the counts in the bytes from		*
+ * SIGNATURE_HASH on, so that long words whose wrapped counts agree		*
+ * still get different signatures (and keys) unless the hashes collide.	*
+ ************************************************************************/
+void markLongSignature(Signature *sig, int *counts)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+    
+    for (i = 0; i <= ALPHABET_SIZE; i++) {
+        hash = (hash ^ (uint32_t)counts[i]) * 16777619u;
+    }
+    sig->count[SIGNATURE_LONG] = 1;
+    memcpy(sig->count + SIGNATURE_HASH, &hash, sizeof(hash));
+}
+
+/************************************************************************
+ * Returns true if the two signatures are equal. For words of LONG_WORD	*
+ * characters or more this does not prove they are anagrams; use		*
+ * signaturesMatch when the words are at hand.							*
+ ************************************************************************/
+bool signaturesEqual(Signature *sig1, Signature *sig2)
+{
+    return ((sig1->word[0] ^ sig2->word[0]) | (sig1->word[1] ^ sig2->word[1])
+            | (sig1->word[2] ^ sig2->word[2]) | (sig1->word[3] ^ sig2->word[3])) == 0;
+}
+
+/************************************************************************
+ * Returns true if word1 and word2, whose signatures are sig1 and sig2,	*
+ * are anagrams: the signatures are equal and, if the words are long	*
+ * enough for their counts to have wrapped around or have characters	*
+ * other than 'a'..'z' (which the signature only counts), the exact		*
+ * counts of the words are equal too.									*
+ ************************************************************************/
+bool signaturesMatch(Signature *sig1, char *word1, int length1, Signature *sig2, char *word2, int length2)
+{
+    return signaturesEqual(sig1, sig2)
+        && ((sig1->count[SIGNATURE_LONG] == 0 && sig1->count[ALPHABET_SIZE] == 0)
+            || sameLetters(word1, length1, word2, length2));
+}
+
+/************************************************************************
+ * Returns true if the two words have the same length and the same		*
+ * number of each letter and of each other character, counted without	*
+ * any limit. This is the slow, exact check behind signaturesMatch.		*
+ ************************************************************************/
+bool sameLetters(char *word1, int length1, char *word2, int length2)
+{
+    int counts1[ALPHABET_SIZE + 1], counts2[ALPHABET_SIZE + 1];
+    
+    if (length1 != length2) {
+        return false;
+    }
+    countLetters(word1, length1, counts1);
+    countLetters(word2, length2, counts2);
+    if (memcmp(counts1, counts2, sizeof(counts1)) != 0) {
+        return false;
+    }
+    return counts1[ALPHABET_SIZE] == 0 || sameOtherCharacters(word1, length1, word2, length2);
+}
+
+/************************************************************************
+ * Returns true if the two words have the same characters other than	*
+ * 'a'..'z', as many times each, in any order.							*
+ ************************************************************************/
+bool sameOtherCharacters(char *word1, int length1, char *word2, int length2)
+{
+    int others1[256], others2[256];
+    
+    countOtherCharacters(word1, length1, others1);
+    countOtherCharacters(word2, length2, others2);
+    return memcmp(others1, others2, sizeof(others1)) == 0;
+}
+
+/************************************************************************
+ * Stores in counts (ALPHABET_SIZE + 1 entries) how many times each		*
+ * letter 'a'..'z' occurs in the word and how many other characters it	*
+ * has, like computeSignature but in ints that do not wrap around.		*
+ ************************************************************************/
+void countLetters(char *word, int length, int *counts)
+{
+    int i;
+    unsigned char c;
+    
+    memset(counts, 0, (ALPHABET_SIZE + 1) * sizeof(int));
+    for (i = 0; i < length; i++) {
+        c = (unsigned char)(word[i] - 'a');
+        counts[c < ALPHABET_SIZE ? c : ALPHABET_SIZE]++;
+    }
+}
+
+/************************************************************************
+ * Stores in counts (256 entries, one per byte value) how many times	*
+ * each character other than 'a'..'z' occurs in the word; the entries	*
+ * of the letters are 0.												*
+ ************************************************************************/
+void countOtherCharacters(char *word, int length, int *counts)
+{
+    int i;
+    unsigned char c;
+    
+    memset(counts, 0, 256 * sizeof(int));
+    for (i = 0; i < length; i++) {
+        c = (unsigned char)word[i];
+        if (c < 'a' || c > 'z') {
+            counts[c]++;
+        }
+    }
+}
+
+/************************************************************************
+ * Marks the signature of a word with characters other than 'a'..'z',	*
+ * which the signature only counts: adds a hash of those characters to	*
+ * the bytes from SIGNATURE_HASH on, so that words whose letters agree	*
+ * but whose other characters differ ("Bob" and "Rob") get different	*
+ * signatures (and keys) unless the hashes collide. The hash is a sum	*
+ * over the characters, so it does not depend on their order.			*
+ ************************************************************************/
+void markOtherCharacters(Signature *sig, char *word, int length)
+{
+    uint32_t hash, sum = 0, x;
+    int i;
+    unsigned char c;
+    
+    for (i = 0; i < length; i++) {
+        c = (unsigned char)word[i];
+        if (c < 'a' || c > 'z') {
+            x = (c + 1u) * 0x9E3779B1u;
+            x ^= x >> 15;
+            x *= 0x85EBCA6Bu;
+            sum += x ^ (x >> 13);
+        }
+    }
+    memcpy(&hash, sig->count + SIGNATURE_HASH, sizeof(hash));
+    hash += sum;
+    memcpy(sig->count + SIGNATURE_HASH, &hash, sizeof(hash));
+}
+
+/************************************************************************
+ * Packs a signature into its exact 128-bit anagram key (see			*
+ * AnagramKey). On x86 the packing takes a handful of SSE2 operations:	*
+ * saturating subtracts find counts above 15, and a shift, an or and a	*
+ * pack fold each pair of count bytes into one byte.					*
+ ************************************************************************/
+void computeAnagramKey(Signature *sig, AnagramKey *key)
+{
+    bool overflow;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    __m128i lo = _mm_loadu_si128((const __m128i *)sig->count);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(sig->count + 16));
+    __m128i over;
+    
+    over = _mm_or_si128(_mm_subs_epu8(lo, _mm_set1_epi8(15)), _mm_subs_epu8(hi, _mm_set1_epi8(15)));
+    overflow = _mm_movemask_epi8(_mm_cmpeq_epi8(over, zero)) != 0xFFFF;
+    
+    lo = _mm_and_si128(_mm_or_si128(lo, _mm_srli_epi16(lo, 4)), lowBytes);
+    hi = _mm_and_si128(_mm_or_si128(hi, _mm_srli_epi16(hi, 4)), lowBytes);
+    _mm_storeu_si128((__m128i *)key, _mm_packus_epi16(lo, hi));
+#else
+    int i;
+    
+    key->lo = 0;
+    key->hi = 0;
+    overflow = false;
+    for (i = 0; i < ALPHABET_SIZE; i++) {
+        if (sig->count[i] > 15) {
+            overflow = true;
+        } else if (i < 16) {
+            key->lo |= (uint64_t)sig->count[i] << (4 * i);
+        } else {
+            key->hi |= (uint64_t)sig->count[i] << (4 * (i - 16));
+        }
+    }
+#endif
+    
+    // the counts of long words may have wrapped around, and other
+    // characters are only counted
+    if (overflow || sig->count[SIGNATURE_LONG] != 0 || sig->count[ALPHABET_SIZE] != 0) {
+        key->lo = sig->word[0] * 0x9E3779B97F4A7C15ull ^ sig->word[1] * 0xC2B2AE3D27D4EB4Full
+                ^ sig->word[2] * 0x165667B19E3779F9ull ^ sig->word[3] * 0xD6E8FEB86659FD93ull;
+        key->hi = KEY_OVERFLOW | (key->lo * 0x9E3779B97F4A7C15ull >> 1);
+    }
+}
+
+/************************************************************************
+ * Returns a hash of an anagram key for the signature tables.			*
+ ************************************************************************/
+unsigned int hashAnagramKey(AnagramKey *key)
+{
+    uint64_t hash = key->lo * 0x9E3779B97F4A7C15ull ^ key->hi * 0xC2B2AE3D27D4EB4Full;
+    
+    hash ^= hash >> 32;
+    hash *= 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(hash >> 32);
+}
+
+/************************************************************************
+ * Returns a 64-bit hash of an anagram key; each seed gives a different	*
+ * hash function.														*
+ ************************************************************************/
+uint64_t seededKeyHash(AnagramKey *key, uint64_t seed)
+{
+    uint64_t hash = (key->lo ^ seed) * 0x9E3779B97F4A7C15ull;
+    
+    hash ^= hash >> 32;
+    hash = (hash ^ key->hi) * 0xC2B2AE3D27D4EB4Full;
+    hash ^= hash >> 29;
+    hash *= 0x165667B19E3779F9ull;
+    return hash ^ (hash >> 32);
+}
+
+/************************************************************************
+ * Builds a minimal perfect hash over nbrKeys different anagram keys	*
+ * and stores the position it gives each key in position. The			*
+ * construction is hash-and-displace (as in CHD): the keys are hashed	*
+ * into about nbrKeys/PERFECT_BUCKET_KEYS buckets, and the buckets,		*
+ * largest first, are placed into a table 1/PERFECT_SPARE larger than	*
+ * nbrKeys. A bucket is placed by trying pilots 0, 1, 2, ... until one	*
+ * sends all of its keys to free places (see pilotPosition); only that	*
+ * 16-bit pilot is kept. The few keys that end up beyond nbrKeys are	*
+ * then moved to the places left free below nbrKeys, which is what the	*
+ * remap array records. This costs 16/PERFECT_BUCKET_KEYS bits per key	*
+ * for the pilots and about one more for remap, and the time is linear	*
+ * in nbrKeys. If some bucket has no pilot that fits, everything		*
+ * starts over with the next seed.										*
+ ************************************************************************/
+void buildPerfectHash(PerfectHash *hash, AnagramKey *keys, uint32_t nbrKeys, uint32_t *position)
+{
+    uint64_t *hashes = malloc(((size_t)nbrKeys + 1) * sizeof(uint64_t));
+    uint32_t k;
+    
+    hash->nbrKeys = nbrKeys;
+    hash->nbrBuckets = nbrKeys / PERFECT_BUCKET_KEYS + 1;
+    hash->tableSize = nbrKeys + nbrKeys / PERFECT_SPARE + 1;
+    hash->pilot = malloc(hash->nbrBuckets * sizeof(uint16_t));
+    hash->remap = malloc((hash->tableSize - nbrKeys) * sizeof(uint32_t));
+    if (hashes == NULL || hash->pilot == NULL || hash->remap == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (hash->seed = 1; ; hash->seed++) {
+        if (hash->seed > PERFECT_MAX_SEEDS) {
+            fprintf(stderr,"Cannot build a perfect hash: the keys are not all different\n");
+            exit(EXIT_FAILURE);
+        }
+        for (k = 0; k < nbrKeys; k++) {
+            hashes[k] = seededKeyHash(&keys[k], hash->seed);
+        }
+        if (placePerfectHash(hash, hashes, position)) {
+            break;
+        }
+    }
+    free(hashes);
+}
+
+/************************************************************************
+ * Places the buckets of a perfect hash for the key hashes of the		*
+ * current seed (see buildPerfectHash) and fills in pilot, remap and	*
+ * position. Returns false if some bucket cannot be placed.				*
+ * The keys are sorted by bucket and the buckets by size with counting	*
+ * sorts, and the taken places are kept in a bitmap, so that trying a	*
+ * pilot touches one bit per key of the bucket.							*
+ ************************************************************************/
+bool placePerfectHash(PerfectHash *hash, uint64_t *hashes, uint32_t *position)
+{
+    uint32_t nbrKeys = hash->nbrKeys;
+    uint32_t nbrBuckets = hash->nbrBuckets;
+    uint32_t *bucketStart = calloc(nbrBuckets + 1, sizeof(uint32_t));
+    uint32_t *members = malloc(((size_t)nbrKeys + 1) * sizeof(uint32_t));
+    uint32_t *order = malloc(nbrBuckets * sizeof(uint32_t));
+    uint32_t *bySize = NULL;
+    uint64_t *taken = calloc(hash->tableSize / 64 + 1, sizeof(uint64_t));
+    uint32_t *bucket = malloc(((size_t)nbrKeys + 1) * sizeof(uint32_t));
+    uint32_t k, b, i, p, size, maxSize = 0, pilot = 0, nextFree = 0;
+    
+    if (bucketStart == NULL || members == NULL || order == NULL || taken == NULL || bucket == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0; k < nbrKeys; k++) {
+        bucket[k] = (uint32_t)(((hashes[k] >> 32) * nbrBuckets) >> 32);
+        bucketStart[bucket[k] + 1]++;
+    }
+    for (b = 0; b < nbrBuckets; b++) {
+        size = bucketStart[b+1];
+        maxSize = (size > maxSize) ? size : maxSize;
+        bucketStart[b+1] += bucketStart[b];
+    }
+    for (k = 0; k < nbrKeys; k++) {
+        members[bucketStart[bucket[k]]++] = k;
+    }
+    for (b = nbrBuckets; b > 0; b--) {
+        bucketStart[b] = bucketStart[b-1];
+    }
+    bucketStart[0] = 0;
+    
+    bySize = calloc(maxSize + 2, sizeof(uint32_t));
+    if (bySize == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (b = 0; b < nbrBuckets; b++) {
+        bySize[maxSize - (bucketStart[b+1] - bucketStart[b]) + 1]++;
+    }
+    for (size = 0; size <= maxSize; size++) {
+        bySize[size+1] += bySize[size];
+    }
+    for (b = 0; b < nbrBuckets; b++) {
+        order[bySize[maxSize - (bucketStart[b+1] - bucketStart[b])]++] = b;
+    }
+    
+    for (i = 0; i < nbrBuckets; i++) {
+        b = order[i];
+        hash->pilot[b] = 0;
+        for (pilot = 0; pilot <= UINT16_MAX; pilot++) {
+            for (k = bucketStart[b]; k < bucketStart[b+1]; k++) {
+                p = pilotPosition(hash, hashes[members[k]], pilot);
+                if (taken[p / 64] & (1ull << (p % 64))) {
+                    break;
+                }
+                taken[p / 64] |= 1ull << (p % 64);
+                position[members[k]] = p;
+            }
+            if (k == bucketStart[b+1]) {
+                break;
+            }
+            while (k-- > bucketStart[b]) {
+                p = position[members[k]];
+                taken[p / 64] &= ~(1ull << (p % 64));
+            }
+        }
+        if (pilot > UINT16_MAX) {
+            break;
+        }
+        hash->pilot[b] = pilot;
+    }
+    
+    if (pilot <= UINT16_MAX) {
+        for (p = nbrKeys; p < hash->tableSize; p++) {
+            hash->remap[p - nbrKeys] = 0;
+            if (taken[p / 64] & (1ull << (p % 64))) {
+                while (taken[nextFree / 64] & (1ull << (nextFree % 64))) {
+                    nextFree++;
+                }
+                hash->remap[p - nbrKeys] = nextFree++;
+            }
+        }
+        for (k = 0; k < nbrKeys; k++) {
+            if (position[k] >= nbrKeys) {
+                position[k] = hash->remap[position[k] - nbrKeys];
+            }
+        }
+    }
+    free(bucketStart);
+    free(members);
+    free(order);
+    free(bySize);
+    free(taken);
+    free(bucket);
+    return pilot <= UINT16_MAX;
+}
+
+/************************************************************************
+ * Returns the position a perfect hash gives a key. For a key that was	*
+ * not among the keys it was built for, this is just some position.		*
+ ************************************************************************/
+uint32_t perfectHashPosition(PerfectHash *hash, AnagramKey *key)
+{
+    uint64_t keyHash = seededKeyHash(key, hash->seed);
+    uint32_t bucket = (uint32_t)(((keyHash >> 32) * hash->nbrBuckets) >> 32);
+    uint32_t p = pilotPosition(hash, keyHash, hash->pilot[bucket]);
+    
+    return (p < hash->nbrKeys) ? p : hash->remap[p - hash->nbrKeys];
+}
+
+/************************************************************************
+ * Returns the place in the table of a perfect hash that the given		*
+ * pilot sends a key with hash keyHash to. The key hash is mixed with a	*
+ * hash of the pilot, the mix is scrambled with a multiply (so every	*
+ * bit of it reaches the top bits) and scaled to the table size with a	*
+ * multiply instead of a division.										*
+ ************************************************************************/
+uint32_t pilotPosition(PerfectHash *hash, uint64_t keyHash, uint32_t pilot)
+{
+    uint64_t mixed = (keyHash ^ ((pilot + 1) * 0x9E3779B97F4A7C15ull)) * 0xFF51AFD7ED558CCDull;
+    
+    mixed ^= mixed >> 32;
+    return (uint32_t)(((mixed & 0xFFFFFFFFull) * hash->tableSize) >> 32);
+}
+
+/************************************************************************
+ * Releases the arrays of a perfect hash.								*
+ ************************************************************************/
+void freePerfectHash(PerfectHash *hash)
+{
+    free(hash->pilot);
+    free(hash->remap);
+}
+
+/************************************************************************
+ * Returns true if the words of node1 and node2, whose keys are key1	*
+ * and key2, are anagrams. This is a single key compare unless the keys	*
+ * overflowed, in which case the lengths and then the signatures are	*
+ * compared, and for words of LONG_WORD characters or more the exact	*
+ * letter counts as well (see signaturesMatch).							*
+ ************************************************************************/
+bool keysMatch(AnagramKey *key1, Node *node1, AnagramKey *key2, Node *node2)
+{
+    Signature sig1, sig2;
+    
+    if (key1->lo != key2->lo || key1->hi != key2->hi) {
+        return false;
+    }
+    if ((key1->hi & KEY_OVERFLOW) == 0) {
+        return true;
+    }
+    if (node1->length != node2->length) {
+        return false;
+    }
+    computeSignature(node1->text, node1->length, &sig1);
+    computeSignature(node2->text, node2->length, &sig2);
+    return signaturesMatch(&sig1, node1->text, node1->length, &sig2, node2->text, node2->length);
+}
+
+/************************************************************************
+ * Allocates the slots of an empty signature table. The capacity must	*
+ * be a power of two.													*
+ ************************************************************************/
+void initSignatureTable(SignatureTable *table, int capacity)
+{
+    int i;
+    
+    table->slots = malloc(capacity * sizeof(TableSlot));
+    if (table->slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < capacity; i++) {
+        table->slots[i].index = -1;
+    }
+    table->capacity = capacity;
+    table->used = 0;
+    table->nbrCompares = 0;
+}
+
+/************************************************************************
+ * Probes the table for the key of the word in node and returns the		*
+ * slot of that word's group, or the empty slot where the group should	*
+ * be inserted. A group whose words have all been removed has no word	*
+ * to compare with, so its key alone decides.							*
+ ************************************************************************/
+TableSlot *findSlot(SignatureTable *table, AnagramKey *key, unsigned int hash, Node *node)
+{
+    unsigned int mask = table->capacity - 1;
+    unsigned int i = hash & mask;
+    TableSlot *slot;
+    
+    while (true) {
+        slot = &table->slots[i];
+        if (slot->index < 0) {
+            return slot;
+        }
+        table->nbrCompares++;
+        if (slot->hash == hash && (slot->tail == NULL || node == NULL
+                || keysMatch(&slot->key, slot->tail, key, node))) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/************************************************************************
+ * Doubles the number of slots in the table and re-inserts every		*
+ * occupied slot.														*
+ ************************************************************************/
+void growSignatureTable(SignatureTable *table)
+{
+    TableSlot *old = table->slots;
+    int oldCapacity = table->capacity;
+    int used = table->used;
+    uint64_t nbrCompares = table->nbrCompares;
+    int i;
+    
+    initSignatureTable(table, 2 * oldCapacity);
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i].index >= 0) {
+            *findSlot(table, &old[i].key, old[i].hash, old[i].tail) = old[i];
+        }
+    }
+    table->used = used;
+    table->nbrCompares = nbrCompares;
+    free(old);
+}
+
+
+/************************************************************************
+ * Prepares an empty array and signature table for building.			*
+ ************************************************************************/
+void initArrayBuilder(ArrayBuilder *builder)
+{
+    builder->ary = resizeAnagramArray(NULL, INITIAL_ARRAY_SIZE);
+    builder->curAryLen = INITIAL_ARRAY_SIZE;
+    builder->nbrUsedInAry = 0;
+    initSignatureTable(&builder->table, INITIAL_TABLE_SIZE);
+    initArena(&builder->arena);
+    builder->arena.nbrAllocations = 2;
+    builder->kernel = selectSignatureKernel();
+    builder->stats = NULL;
+}
+
+/************************************************************************
+ * Adds a node to the group of its anagrams, or starts a new group at	*
+ * the end of the array if the word has no anagram in it yet. Groups	*
+ * keep the order in which they first appear and each group keeps its	*
+ * words in the order they were added.									*
+ ************************************************************************/
+void addNodeToArray(ArrayBuilder *builder, Node *node)
+{
+    Signature sig;
+    AnagramKey key;
+    
+    builder->kernel(node->text, node->length, &sig);
+    computeAnagramKey(&sig, &key);
+    addKeyedNodeToArray(builder, node, &key, hashAnagramKey(&key));
+}
+
+/************************************************************************
+ * Same as addNodeToArray for nbrNodes (at most WORD_BATCH) nodes, in	*
+ * order. The keys of the whole batch are computed first, in a tight	*
+ * loop, and the table slots of the words a few places ahead are		*
+ * prefetched while the words are added to their groups.				*
+ ************************************************************************/
+void addNodesToArray(ArrayBuilder *builder, Node **nodes, int nbrNodes)
+{
+    AnagramKey keys[WORD_BATCH];
+    unsigned int hashes[WORD_BATCH];
+    Signature sig;
+    int i;
+    
+    lapRunStats(builder->stats, PHASE_READ);
+    for (i = 0; i < nbrNodes; i++) {
+        builder->kernel(nodes[i]->text, nodes[i]->length, &sig);
+        computeAnagramKey(&sig, &keys[i]);
+        hashes[i] = hashAnagramKey(&keys[i]);
+    }
+    lapRunStats(builder->stats, PHASE_SIGNATURE);
+    for (i = 0; i < nbrNodes; i++) {
+        if (i + 4 < nbrNodes) {
+            __builtin_prefetch(&builder->table.slots[hashes[i+4] & (builder->table.capacity - 1)]);
+        }
+        addKeyedNodeToArray(builder, nodes[i], &keys[i], hashes[i]);
+    }
+    lapRunStats(builder->stats, PHASE_GROUP);
+}
+
+/************************************************************************
+ * Same as addNodeToArray, for a node whose key and hash are known.		*
+ ************************************************************************/
+void addKeyedNodeToArray(ArrayBuilder *builder, Node *node, AnagramKey *key, unsigned int hash)
+{
+    TableSlot *slot = findSlot(&builder->table, key, hash, node);
+    
+    if (slot->index >= 0) {
+        // existing group: append in O(1) through the cached tail
+        if (slot->tail == NULL) {
+            builder->ary[slot->index].head = node;
+        } else {
+            slot->tail->next = node;
+        }
+        slot->tail = node;
+        builder->ary[slot->index].size++;
+        return;
+    }
+    
+    addGroupToArray(builder, slot, key, hash, node);
+}
+
+/************************************************************************
+ * Starts a new group at the end of the array in the empty slot found	*
+ * for its key. The group holds the node head, or no word if head is	*
+ * NULL.																*
+ ************************************************************************/
+void addGroupToArray(ArrayBuilder *builder, TableSlot *slot, AnagramKey *key, unsigned int hash, Node *head)
+{
+    int n = builder->nbrUsedInAry;
+    
+    if (builder->curAryLen == n) {
+        builder->curAryLen = 2 * builder->curAryLen;
+        builder->ary = resizeAnagramArray(builder->ary, builder->curAryLen);
+        builder->arena.nbrAllocations++;
+    }
+    builder->ary[n].size = (head != NULL) ? 1 : 0;
+    builder->ary[n].head = head;
+    
+    slot->index = n;
+    slot->hash = hash;
+    slot->key = *key;
+    slot->tail = head;
+    builder->nbrUsedInAry++;
+    
+    builder->table.used++;
+    if (4 * builder->table.used > 3 * builder->table.capacity) {
+        growSignatureTable(&builder->table);
+        builder->arena.nbrAllocations++;
+    }
+}
+
+/************************************************************************
+ * Removes the first occurrence of a word from its group. The group		*
+ * stays in the array (and in the table) even when it becomes empty, so	*
+ * group positions do not change while the builder is in use. Returns	*
+ * false if the word is not in the array.								*
+ ************************************************************************/
+bool removeWordFromArray(ArrayBuilder *builder, char *text, int length)
+{
+    Node probe = {text, length, NULL};
+    Node *node, *prev = NULL;
+    AryElement *element;
+    Signature sig;
+    AnagramKey key;
+    TableSlot *slot;
+    
+    builder->kernel(text, length, &sig);
+    computeAnagramKey(&sig, &key);
+    slot = findSlot(&builder->table, &key, hashAnagramKey(&key), &probe);
+    if (slot->index < 0) {
+        return false;
+    }
+    element = &builder->ary[slot->index];
+    for (node = element->head; node != NULL; prev = node, node = node->next) {
+        if (node->length == length && memcmp(node->text, text, length) == 0) {
+            if (prev == NULL) {
+                element->head = node->next;
+            } else {
+                prev->next = node->next;
+            }
+            if (slot->tail == node) {
+                slot->tail = prev;
+            }
+            element->size--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/************************************************************************
+ * Releases the signature table, drops groups whose words were all		*
+ * removed, trims the array to the number of groups, hands the arena	*
+ * over to the array, stores the number of groups in aryLen and returns	*
+ * the array.															*
+ ************************************************************************/
+AryElement *finishArrayBuilder(ArrayBuilder *builder, int *aryLen)
+{
+    AryElement *ary;
+    int g, n = 0;
+    
+    if (builder->stats != NULL) {
+        builder->stats->nbrCompares = builder->table.nbrCompares;
+    }
+    free(builder->table.slots);
+    for (g = 0; g < builder->nbrUsedInAry; g++) {
+        if (builder->ary[g].size > 0) {
+            builder->ary[n++] = builder->ary[g];
+        }
+    }
+    builder->nbrUsedInAry = n;
+    *aryLen = builder->nbrUsedInAry;
+    ary = resizeAnagramArray(builder->ary, builder->nbrUsedInAry);
+    builder->arena.nbrAllocations++;
+    getAryHeader(ary)->arena = builder->arena;
+    return ary;
+}
+
+/************************************************************************
+ * Resizes an anagram array (together with the hidden header in			*
+ * front of it) to hold len elements. Passing NULL allocates a new		*
+ * array whose header and elements are all zero.						*
+ ************************************************************************/
+AryElement *resizeAnagramArray(AryElement *ary, int len)
+{
+    size_t bytes = sizeof(AryHeader) + (size_t)len * sizeof(AryElement);
+    AryHeader *header;
+    
+    if (ary == NULL) {
+        header = calloc(1, bytes);
+    } else {
+        header = realloc(getAryHeader(ary), bytes);
+    }
+    if (header == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return (AryElement *)(header + 1);
+}
+
+/************************************************************************
+ * Returns the header stored in front of an anagram array.				*
+ ************************************************************************/
+AryHeader *getAryHeader(AryElement *ary)
+{
+    return (AryHeader *)ary - 1;
+}
+
+/************************************************************************
+ * Adds every non-empty line in [start, end) to the builder as a Node	*
+ * that views the line in place. The lines are counted first so that	*
+ * one arena block can hold all of the nodes.							*
+ ************************************************************************/
+void addMappedLines(ArrayBuilder *builder, char *start, char *end)
+{
+    char *p, *nl;
+    size_t nbrLines = 0, nbrNodes = 0;
+    int len, n = 0;
+    Node *nodes, *node;
+    Node *batch[WORD_BATCH];
+    
+    p = start;
+    while (p < end) {
+        nl = memchr(p, '\n', end - p);
+        nbrLines++;
+        p = (nl == NULL) ? end : nl + 1;
+    }
+    nodes = arenaAlloc(&builder->arena, nbrLines * sizeof(Node));
+    
+    p = start;
+    while (p < end) {
+        nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            nl = end;
+        }
+        len = nl - p;
+        if (len > 0 && p[len-1] == '\r') {
+            len--;
+        }
+        if (len > 0) {
+            node = &nodes[nbrNodes++];
+            node->text = p;
+            node->length = len;
+            node->next = NULL;
+            batch[n++] = node;
+            if (n == WORD_BATCH) {
+                addNodesToArray(builder, batch, n);
+                n = 0;
+            }
+        }
+        p = nl + 1;
+    }
+    addNodesToArray(builder, batch, n);
+}
+
+/************************************************************************
+ * Body of one thread of buildAnagramArrayParallel. The phases are		*
+ * separated by barriers:												*
+ *		1. group the words of chunk id and sort the groups into the		*
+ *		   lists of the shards that own their signatures				*
+ *		2. merge the groups of shard id coming from every chunk (for	*
+ *		   a corpus, dropping the words an earlier chunk had)			*
+ *		3. count the merged groups first seen in chunk id				*
+ *		4. turn those counts into final array positions (thread 0 also	*
+ *		   allocates the array, whose length is now known)				*
+ *		5. store the merged groups of shard id in the array				*
+ ************************************************************************/
+void *parallelBuildWorker(void *arg)
+{
+    ParallelWorker *worker = arg;
+    ParallelBuild *build = worker->build;
+    int id = worker->id;
+    int n = build->nbrThreads;
+    ArrayBuilder *chunk = &build->chunks[id];
+    ShardList *shard = &build->shards[id];
+    ShardList *list;
+    ShardEntry entry, *merged;
+    Signature sig;
+    SignatureTable table;
+    TableSlot *slot;
+    WordSet seen;
+    Node *node;
+    size_t size;
+    int g, t, offset, total;
+    
+    // phase 1
+    initArrayBuilder(chunk);
+    if (build->corpus) {
+        addCorpusText(chunk, build->chunkStart[id], build->chunkStart[id+1]);
+    } else {
+        addMappedLines(chunk, build->chunkStart[id], build->chunkStart[id+1]);
+    }
+    for (g = 0; g < chunk->nbrUsedInAry; g++) {
+        entry.chunk = id;
+        entry.group = g;
+        entry.size = chunk->ary[g].size;
+        entry.head = chunk->ary[g].head;
+        chunk->kernel(entry.head->text, entry.head->length, &sig);
+        computeAnagramKey(&sig, &entry.key);
+        entry.hash = hashAnagramKey(&entry.key);
+        entry.tail = findSlot(&chunk->table, &entry.key, entry.hash, entry.head)->tail;
+        // high bits pick the shard; the low bits index the shard's table
+        appendShardEntry(&build->lists[id * n + (int)(((unsigned long long)entry.hash * n) >> 32)], &entry);
+    }
+    build->rank[id] = calloc(chunk->nbrUsedInAry + 1, sizeof(int));
+    if (build->rank[id] == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    chunk->arena.nbrAllocations++;
+    free(chunk->table.slots);
+    free(getAryHeader(chunk->ary));
+    pthread_barrier_wait(&build->barrier);
+    
+    // phase 2
+    initSignatureTable(&table, INITIAL_TABLE_SIZE);
+    chunk->arena.nbrAllocations++;
+    if (build->corpus) {
+        initWordSet(&seen);
+        chunk->arena.nbrAllocations++;
+    }
+    for (t = 0; t < n; t++) {
+        list = &build->lists[t * n + id];
+        for (g = 0; g < list->count; g++) {
+            slot = findSlot(&table, &list->entries[g].key, list->entries[g].hash, list->entries[g].head);
+            if (slot->index >= 0) {
+                merged = &shard->entries[slot->index];
+                if (build->corpus) {
+                    appendUnseenWords(merged, &list->entries[g], &seen);
+                } else {
+                    merged->tail->next = list->entries[g].head;
+                    merged->tail = list->entries[g].tail;
+                    merged->size += list->entries[g].size;
+                }
+                slot->tail = merged->tail;
+            } else {
+                if (build->corpus) {
+                    // a new signature: none of its words was seen yet
+                    for (node = list->entries[g].head; node != NULL; node = node->next) {
+                        addSeenWord(&seen, node);
+                    }
+                }
+                slot->index = shard->count;
+                slot->hash = list->entries[g].hash;
+                slot->key = list->entries[g].key;
+                slot->tail = list->entries[g].tail;
+                appendShardEntry(shard, &list->entries[g]);
+                build->rank[t][list->entries[g].group] = 1;
+                table.used++;
+                if (4 * table.used > 3 * table.capacity) {
+                    growSignatureTable(&table);
+                    chunk->arena.nbrAllocations++;
+                }
+            }
+        }
+    }
+    free(table.slots);
+    if (build->corpus) {
+        // one allocation per doubling of the set
+        for (size = INITIAL_TABLE_SIZE; size < seen.capacity; size *= 2) {
+            chunk->arena.nbrAllocations++;
+        }
+        free(seen.entries);
+    }
+    pthread_barrier_wait(&build->barrier);
+    
+    // phase 3
+    for (g = 0; g < chunk->nbrUsedInAry; g++) {
+        build->nbrRanked[id] += build->rank[id][g];
+    }
+    pthread_barrier_wait(&build->barrier);
+    
+    // phase 4
+    offset = 0;
+    total = 0;
+    for (t = 0; t < n; t++) {
+        if (t < id) {
+            offset += build->nbrRanked[t];
+        }
+        total += build->nbrRanked[t];
+    }
+    for (g = 0; g < chunk->nbrUsedInAry; g++) {
+        build->rank[id][g] = build->rank[id][g] ? offset++ : -1;
+    }
+    if (id == 0) {
+        build->ary = resizeAnagramArray(NULL, total);
+        build->aryLen = total;
+    }
+    pthread_barrier_wait(&build->barrier);
+    
+    // phase 5
+    for (g = 0; g < shard->count; g++) {
+        merged = &shard->entries[g];
+        build->ary[build->rank[merged->chunk][merged->group]].size = merged->size;
+        build->ary[build->rank[merged->chunk][merged->group]].head = merged->head;
+    }
+    return NULL;
+}
+
+/************************************************************************
+ * Appends a copy of entry to the list, growing the list as needed.		*
+ ************************************************************************/
+void appendShardEntry(ShardList *list, ShardEntry *entry)
+{
+    if (list->count == list->capacity) {
+        list->capacity = (list->capacity == 0) ? 64 : 2 * list->capacity;
+        list->entries = realloc(list->entries, list->capacity * sizeof(ShardEntry));
+        if (list->entries == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        list->nbrAllocations++;
+    }
+    list->entries[list->count++] = *entry;
+}
+
+/************************************************************************
+ * Appends to a merged group of a parallel corpus build the words of	*
+ * entry (a group of a later chunk) that seen does not have yet, in		*
+ * their order, and adds them to seen.									*
+ ************************************************************************/
+void appendUnseenWords(ShardEntry *merged, ShardEntry *entry, WordSet *seen)
+{
+    Node *node, *next;
+    
+    for (node = entry->head; node != NULL; node = next) {
+        next = node->next;
+        if (addSeenWord(seen, node)) {
+            node->next = NULL;
+            merged->tail->next = node;
+            merged->tail = node;
+            merged->size++;
+        }
+    }
+}
+
+/************************************************************************
+ * Moves every block of the arena from into the arena into, leaving		*
+ * from empty. Memory is still handed out from the current block of		*
+ * into.																*
+ ************************************************************************/
+void spliceArena(Arena *into, Arena *from)
+{
+    ArenaBlock *last = from->head;
+    
+    into->nbrAllocations += from->nbrAllocations;
+    from->nbrAllocations = 0;
+    if (last == NULL) {
+        return;
+    }
+    if (into->head == NULL) {
+        into->head = from->head;
+    } else {
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        last->next = into->head->next;
+        into->head->next = from->head;
+    }
+    from->head = NULL;
+}
+
+/************************************************************************
+ * Maps the whole input file read-only into memory, stores its size in	*
+ * mapLen and returns the start of the mapping (NULL for an empty		*
+ * file).																*
+ ************************************************************************/
+char *mapInputFile(char *infile, size_t *mapLen)
+{
+    struct stat st;
+    char *map;
+    int fd = open(infile, O_RDONLY);
+    
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr,"Error opening file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    *mapLen = st.st_size;
+    if (*mapLen == 0) {
+        close(fd);
+        return NULL;
+    }
+    
+    map = mmap(NULL, *mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr,"Error mapping file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    posix_madvise(map, *mapLen, POSIX_MADV_WILLNEED);
+    return map;
+}
+
+/************************************************************************
+ * Prepares an arena that owns no memory yet.							*
+ ************************************************************************/
+void initArena(Arena *arena)
+{
+    arena->head = NULL;
+    arena->nbrAllocations = 0;
+}
+
+/************************************************************************
+ * Returns bytes of memory (aligned for any Node or pointer) taken from	*
+ * the arena. Requests that do not fit the current block start a new	*
+ * block; requests larger than a quarter of a block get a block of		*
+ * their own so that the current block is not abandoned half empty.		*
+ ************************************************************************/
+void *arenaAlloc(Arena *arena, size_t bytes)
+{
+    ArenaBlock *block = arena->head;
+    size_t align = sizeof(void *);
+    size_t size;
+    void *result;
+    
+    bytes = (bytes + align - 1) & ~(align - 1);
+    if (block == NULL || block->size - block->used < bytes) {
+        size = (bytes > ARENA_BLOCK_SIZE / 4) ? bytes : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + size);
+        if (block == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        arena->nbrAllocations++;
+        block->size = size;
+        block->used = 0;
+        if (size == bytes && arena->head != NULL) {
+            // private block: keep allocating from the current one
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+    
+    result = (char *)(block + 1) + block->used;
+    block->used += bytes;
+    return result;
+}
+
+/************************************************************************
+ * Releases every block owned by the arena.								*
+ ************************************************************************/
+void releaseArena(Arena *arena)
+{
+    ArenaBlock *block = arena->head, *next;
+    
+    while (block != NULL) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+/************************************************************************
+ * Sets up an empty output buffer of the given size in front of fd.		*
+ ************************************************************************/
+void initOutputBuffer(OutputBuffer *out, int fd, size_t size)
+{
+    out->fd = fd;
+    out->used = 0;
+    out->size = size;
+    out->data = malloc(size);
+    if (out->data == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/************************************************************************
+ * Appends bytes to an output buffer.									*
+ ************************************************************************/
+void writeOutput(OutputBuffer *out, const char *data, size_t bytes)
+{
+    reserveOutput(out, bytes);
+    memcpy(out->data + out->used, data, bytes);
+    out->used += bytes;
+}
+
+/************************************************************************
+ * Makes room for bytes more bytes in an output buffer, by writing it	*
+ * out if it is full (or growing it, if it only collects bytes in		*
+ * memory or the bytes would not fit even in the empty buffer).			*
+ ************************************************************************/
+void reserveOutput(OutputBuffer *out, size_t bytes)
+{
+    if (out->used + bytes <= out->size) {
+        return;
+    }
+    if (out->fd >= 0) {
+        flushOutput(out);
+    }
+    if (out->used + bytes > out->size) {
+        out->size = (2 * out->size > out->used + bytes) ? 2 * out->size : out->used + bytes;
+        out->data = realloc(out->data, out->size);
+        if (out->data == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/************************************************************************
+ * Writes everything waiting in an output buffer to its file.			*
+ ************************************************************************/
+void flushOutput(OutputBuffer *out)
+{
+    writeAll(out->fd, out->data, out->used);
+    out->used = 0;
+}
+
+/************************************************************************
+ * Writes bytes to a file descriptor, retrying after short writes.		*
+ ************************************************************************/
+void writeAll(int fd, const char *data, size_t bytes)
+{
+    size_t done = 0;
+    ssize_t n;
+    
+    while (done < bytes) {
+        n = write(fd, data + done, bytes - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr,"Error writing output\n");
+            exit(EXIT_FAILURE);
+        }
+        done += n;
+    }
+}
+
+/************************************************************************
+ * Opens (creating or truncating) an output file for write() and		*
+ * returns its descriptor; - stands for stdout.							*
+ ************************************************************************/
+int openOutputFile(char *outfile)
+{
+    int fd = (strcmp(outfile, "-") == 0) ? STDOUT_FILENO : open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    
+    if (fd < 0) {
+        fprintf(stderr,"Error opening file %s\n", outfile);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/************************************************************************
+ * Returns a new, empty AnagramSet that words can be added to.			*
+ ************************************************************************/
+AnagramSet *createAnagramSet(void)
+{
+    AnagramSet *set = calloc(1, sizeof(AnagramSet));
+    if (set == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initArrayBuilder(&set->builder);
+    set->kernel = set->builder.kernel;
+    return set;
+}
+
+/************************************************************************
+ * Adds a copy of the first length characters of word to the group of	*
+ * its anagrams. Returns false (and adds nothing) if the set is frozen.	*
+ ************************************************************************/
+bool addAnagramWord(AnagramSet *set, char *word, int length)
+{
+    if (set->frozen) {
+        return false;
+    }
+    addNodeToArray(&set->builder, createNodeInArena(&set->builder.arena, word, length));
+    return true;
+}
+
+/************************************************************************
+ * Ends the adding of words: builds a minimal perfect hash over the		*
+ * keys of the groups, copies each group into the GroupStore at the		*
+ * position the hash gives its key, and releases the builder. Group		*
+ * numbers thus follow the hash rather than the order of the words.		*
+ * Nothing is written to the set afterwards, which is what makes		*
+ * concurrent lookups safe. Freezing a frozen set does nothing.			*
+ ************************************************************************/
+void freezeAnagramSet(AnagramSet *set)
+{
+    GroupStore *store = &set->store;
+    AryElement *ary;
+    AnagramKey *keys;
+    uint32_t *position, *byPosition;
+    Signature sig;
+    Node *node;
+    uint64_t bytes = 0;
+    int aryLen, g, p, w = 0;
+    
+    if (set->frozen) {
+        return;
+    }
+    ary = finishArrayBuilder(&set->builder, &aryLen);
+    store->nbrGroups = aryLen;
+    store->nbrWords = 0;
+    for (g = 0; g < aryLen; g++) {
+        store->nbrWords += ary[g].size;
+        for (node = ary[g].head; node != NULL; node = node->next) {
+            bytes += node->length + 1;
+        }
+    }
+    
+    store->groupStart = malloc((aryLen + 1) * sizeof(int));
+    store->wordOffset = malloc((store->nbrWords + 1) * sizeof(uint64_t));
+    store->pool = malloc(bytes + 1);
+    store->nbrAllocations = 3;
+    set->keys = malloc((aryLen + 1) * sizeof(AnagramKey));
+    keys = malloc((aryLen + 1) * sizeof(AnagramKey));
+    position = malloc((aryLen + 1) * sizeof(uint32_t));
+    byPosition = malloc((aryLen + 1) * sizeof(uint32_t));
+    if (store->groupStart == NULL || store->wordOffset == NULL || store->pool == NULL ||
+        set->keys == NULL || keys == NULL || position == NULL || byPosition == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (g = 0; g < aryLen; g++) {
+        set->kernel(ary[g].head->text, ary[g].head->length, &sig);
+        computeAnagramKey(&sig, &keys[g]);
+    }
+    buildPerfectHash(&set->hash, keys, aryLen, position);
+    for (g = 0; g < aryLen; g++) {
+        byPosition[position[g]] = g;
+        set->keys[position[g]] = keys[g];
+    }
+    
+    bytes = 0;
+    for (p = 0; p < aryLen; p++) {
+        store->groupStart[p] = w;
+        for (node = ary[byPosition[p]].head; node != NULL; node = node->next) {
+            store->wordOffset[w++] = bytes;
+            memcpy(store->pool + bytes, node->text, node->length);
+            bytes += node->length;
+            store->pool[bytes++] = ' ';
+        }
+    }
+    store->groupStart[aryLen] = w;
+    store->wordOffset[w] = bytes;
+    
+    free(keys);
+    free(position);
+    free(byPosition);
+    freeAnagramArray(ary, aryLen);
+    set->frozen = true;
+}
+
+/************************************************************************
+ * Returns the group holding the anagrams of the first length			*
+ * characters of word, or -1 if there is none or the set is not frozen.	*
+ * The perfect hash names the only group that can match, so this is		*
+ * one probe and one key compare (plus a signature compare for the rare	*
+ * overflowed keys). Only reads the set, so any number of threads may	*
+ * call it at once.														*
+ ************************************************************************/
+int lookupAnagramGroup(AnagramSet *set, char *word, int length)
+{
+    Signature sig;
+    AnagramKey key;
+    Node query, first;
+    uint32_t g;
+    
+    if (!set->frozen || set->store.nbrGroups == 0) {
+        return -1;
+    }
+    set->kernel(word, length, &sig);
+    computeAnagramKey(&sig, &key);
+    g = perfectHashPosition(&set->hash, &key);
+    query.text = word;
+    query.length = length;
+    first.text = anagramGroupWord(set, g, 0, &first.length);
+    return keysMatch(&set->keys[g], &first, &key, &query) ? (int)g : -1;
+}
+
+/************************************************************************
+ * Returns the number of groups of a frozen set (0 before the freeze).	*
+ ************************************************************************/
+int countAnagramGroups(AnagramSet *set)
+{
+    return set->frozen ? set->store.nbrGroups : 0;
+}
+
+/************************************************************************
+ * Returns the number of words in a group of a frozen set.				*
+ ************************************************************************/
+int anagramGroupSize(AnagramSet *set, int group)
+{
+    return set->store.groupStart[group+1] - set->store.groupStart[group];
+}
+
+/************************************************************************
+ * Returns word i (counting from 0) of a group of a frozen set and		*
+ * stores its length in length. The word is NOT '\0'-terminated and		*
+ * stays valid until the set is destroyed.								*
+ ************************************************************************/
+char *anagramGroupWord(AnagramSet *set, int group, int i, int *length)
+{
+    GroupStore *store = &set->store;
+    int w = store->groupStart[group] + i;
+    
+    *length = store->wordOffset[w+1] - store->wordOffset[w] - 1;
+    return store->pool + store->wordOffset[w];
+}
+
+/************************************************************************
+ * Calls visit for every group of a frozen set, in the order of the		*
+ * group numbers (which follows no particular rule), until it returns	*
+ * false.																*
+ ************************************************************************/
+void iterateAnagramGroups(AnagramSet *set, AnagramGroupVisitor visit, void *context)
+{
+    int g;
+    
+    for (g = 0; g < countAnagramGroups(set); g++) {
+        if (!visit(set, g, context)) {
+            return;
+        }
+    }
+}
+
+/************************************************************************
+ * Releases everything a set owns, whether it was frozen or not.		*
+ ************************************************************************/
+void destroyAnagramSet(AnagramSet *set)
+{
+    AryElement *ary;
+    int aryLen;
+    
+    if (set->frozen) {
+        freeGroupStore(&set->store);
+        free(set->keys);
+        freePerfectHash(&set->hash);
+    } else {
+        ary = finishArrayBuilder(&set->builder, &aryLen);
+        freeAnagramArray(ary, aryLen);
+    }
+    free(set);
+}
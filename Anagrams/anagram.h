@@ -0,0 +1,47 @@
+/************************************************************************
+ * filename: anagram.h													*
+ *																		*
+ * Public interface of the anagram library (anagram.c). An AnagramSet	*
+ * collects words, groups them into anagram classes when it is frozen	*
+ * and then answers "which group holds the anagrams of this word".		*
+ *																		*
+ * A set is built by one thread: createAnagramSet, any number of		*
+ * addAnagramWord calls, then freezeAnagramSet. After the freeze the	*
+ * set is never written again, so any number of threads may call the	*
+ * lookup and iterate functions on it at the same time without locks.	*
+ * destroyAnagramSet must not overlap with any other call.				*
+ *																		*
+ * Author(s): Caitlin Crowe and Emily Peterson							*
+ ************************************************************************/
+
+#ifndef ANAGRAM_H
+#define ANAGRAM_H
+
+#include <stdbool.h>
+
+// set of words grouped into anagram classes (see anagram.c)
+typedef struct anagramSet AnagramSet;
+
+// function called by iterateAnagramGroups for every group; returning
+// false stops the iteration
+typedef bool (*AnagramGroupVisitor)(AnagramSet *set, int group, void *context);
+
+AnagramSet *createAnagramSet(void);
+
+bool addAnagramWord(AnagramSet *set, char *word, int length);
+
+void freezeAnagramSet(AnagramSet *set);
+
+int lookupAnagramGroup(AnagramSet *set, char *word, int length);
+
+int countAnagramGroups(AnagramSet *set);
+
+int anagramGroupSize(AnagramSet *set, int group);
+
+char *anagramGroupWord(AnagramSet *set, int group, int i, int *length);
+
+void iterateAnagramGroups(AnagramSet *set, AnagramGroupVisitor visit, void *context);
+
+void destroyAnagramSet(AnagramSet *set);
+
+#endif
@@ -0,0 +1,480 @@
+/************************************************************************
+ * filename: anagramcore.h												*
+ *																		*
+ * Building blocks of the anagram library that the anagrams program		*
+ * uses directly: the linked-list and flat group layouts, signatures	*
+ * and keys, the signature table, arenas, the output buffer and the		*
+ * latency histogram shared by the query daemon and its load generator.	*
+ * Code that only needs an AnagramSet should include anagram.h instead.	*
+ *																		*
+ * Define _POSIX_C_SOURCE as 200809L before including this file.		*
+ *																		*
+ * Author(s): Caitlin Crowe and Emily Peterson							*
+ ************************************************************************/
+
+#ifndef ANAGRAMCORE_H
+#define ANAGRAMCORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "anagram.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#endif
+
+#define ALPHABET_SIZE 26
+#define SIGNATURE_BYTES 32	// letter counts, other-character count, zero padding
+#define SIGNATURE_LONG 27	// Signature byte set to 1 for words of LONG_WORD or more
+#define SIGNATURE_HASH 28	// Signature bytes 28-31: hash of exact counts and other characters
+#define LONG_WORD 256	// shortest word whose signature counts may wrap around
+#define KEY_OVERFLOW (1ull << 63)	// AnagramKey flag: counts did not fit
+#define WORD_BATCH 64	// words whose keys are computed together while building
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define CORPUS_BLOCK 64	// bytes classified at once by a LetterKernel
+#define INITIAL_TABLE_SIZE 4096	// must be a power of two
+#define COMPACT_RESTART 16	// a CompactStore stores every 16th word whole
+#define LATENCY_BUCKETS 512
+
+// node in a linked list
+//		- text field points to the first character of the word; words read
+//		  through a memory mapping are views into the file and are NOT
+//		  '\0'-terminated, so always use the length field
+//		- length field stores number of characters in the word
+struct node {
+    char *text;
+    int length;
+    struct node *next;
+};
+
+typedef struct node Node;
+
+// structure used for an array element
+//		- head field points to the first element of a linked list
+//		- size field stores number of nodes in the linked list
+typedef struct {
+    int size;
+    Node *head;
+} AryElement;
+
+// canonical form of a word shared by all of its anagrams, packed into
+// 32 bytes so it can be built, hashed and compared with wide operations
+//		- count field stores how many times each letter 'a'..'z' occurs
+//		  (bytes 0-25) and how many other characters occur (byte 26);
+//		  the other bytes are zero (except as said below) and counts
+//		  wrap around at 256
+//		- word field views the same bytes as four 64-bit integers
+// Words shorter than LONG_WORD cannot wrap a count, so two of them that
+// only have letters 'a'..'z' are anagrams exactly when their signatures
+// are equal. Longer words get byte SIGNATURE_LONG set to 1 and a 32-bit
+// hash of their exact counts in bytes SIGNATURE_HASH on (see
+// markLongSignature), and words with other characters get a hash of
+// those characters added there (see markOtherCharacters); equal
+// signatures of such words only say "maybe anagrams" and the words
+// themselves have to be compared (see signaturesMatch).
+typedef union {
+    unsigned char count[SIGNATURE_BYTES];
+    uint64_t word[SIGNATURE_BYTES / 8];
+} Signature;
+
+// function that computes the signature of a word of the given length
+typedef void (*SignatureKernel)(char *word, int length, Signature *sig);
+
+// function that finds the letters among CORPUS_BLOCK bytes of text (see
+// classifyLetters)
+typedef uint64_t (*LetterKernel)(const char *text, char *folded);
+
+// exact 128-bit anagram key: a signature with every letter count packed
+// into 4 bits, so that two words are anagrams exactly when their keys
+// are equal (one 128-bit compare)
+//		- lo field holds the counts of 'a'..'p', 4 bits each
+//		- hi field holds the counts of 'q'..'z' in bits 0-39
+// If some letter occurs more than 15 times, the word has characters
+// other than 'a'..'z' or the word has LONG_WORD characters or more, the
+// KEY_OVERFLOW bit of hi is set and the rest of the key is a hash of
+// the signature; such keys only say "maybe equal" and keysMatch
+// compares the lengths and exact counts of the words instead.
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} AnagramKey;
+
+// slot in the open-addressing table that maps anagram keys to groups
+//		- index field is the group's position in the array (-1 if empty)
+//		- hash field caches the hash of the key stored in the slot
+//		- tail field points to the last node of the group's linked list
+//		  (NULL once every word of the group has been removed)
+typedef struct {
+    int index;
+    unsigned int hash;
+    AnagramKey key;
+    Node *tail;
+} TableSlot;
+
+// open-addressing (linear probing) hash table keyed on AnagramKey
+//		- capacity field is the number of slots (always a power of two)
+//		- used field is the number of occupied slots
+//		- nbrCompares field counts the occupied slots findSlot has
+//		  compared a key with
+typedef struct {
+    TableSlot *slots;
+    int capacity;
+    int used;
+    uint64_t nbrCompares;
+} SignatureTable;
+
+// block of memory owned by an arena; the usable bytes follow the struct
+//		- size field stores number of usable bytes in the block
+//		- used field stores number of bytes already handed out
+struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;
+    size_t used;
+};
+
+typedef struct arenaBlock ArenaBlock;
+
+// bump allocator: memory is handed out from the current block in
+// order and is only ever released all at once
+//		- head field points to the block allocations come from (the
+//		  blocks form a linked list through their next fields)
+//		- nbrAllocations field counts the malloc, calloc and realloc
+//		  calls made for the owner of the arena: its blocks and, in an
+//		  array builder, every other allocation of the build (array,
+//		  signature table, line buffer, corpus word set and batches,
+//		  the queues and lists of the threaded builders), but not those
+//		  made inside the C library, such as stdio buffers
+typedef struct {
+    ArenaBlock *head;
+    uint64_t nbrAllocations;
+} Arena;
+
+// bookkeeping stored in memory right in front of every array returned
+// by a build function, so that freeAnagramArray knows what to release
+//		- map field points to the mapped input file (NULL if none)
+//		- mapLen field stores the size of the mapping in bytes
+//		- arena field owns every Node (and copied word) of the array
+typedef struct {
+    char *map;
+    size_t mapLen;
+    Arena arena;
+} AryHeader;
+
+// phases timed by --stats (see RunStats)
+enum {
+    PHASE_READ,
+    PHASE_SIGNATURE,
+    PHASE_GROUP,
+    PHASE_BUILD,
+    PHASE_OUTPUT,
+    PHASE_TEARDOWN,
+    NBR_PHASES
+};
+
+// phase times (in seconds) and counters of one run, collected when the
+// --stats option is given; a negative value means "not measured"
+//		- start field is when the run began
+//		- phaseStart field is when the current phase of main began
+//		- lap field is when the current part of a build began: the
+//		  single-threaded list builders split the build into reading,
+//		  signature and grouping time one batch of WORD_BATCH words at
+//		  a time, so timing costs a few clock reads per batch
+typedef struct {
+    struct timespec start;
+    struct timespec phaseStart;
+    struct timespec lap;
+    double phaseTime[NBR_PHASES];
+    int64_t bytesRead;
+    int64_t bytesWritten;
+    int64_t nbrWords;
+    int64_t nbrGroups;
+    int64_t largestGroup;
+    int64_t nbrCompares;
+    int64_t nbrAllocations;
+} RunStats;
+
+// state of an anagram array while it is being built
+//		- curAryLen field stores the allocated length of the array
+//		- nbrUsedInAry field stores number of groups in the array
+//		- table field maps each signature to its group in the array
+//		- arena field owns the nodes added so far
+//		- kernel field computes signatures (chosen for the running CPU)
+//		- stats field receives times and counters (NULL unless --stats)
+typedef struct {
+    AryElement *ary;
+    int curAryLen;
+    int nbrUsedInAry;
+    SignatureTable table;
+    Arena arena;
+    SignatureKernel kernel;
+    RunStats *stats;
+} ArrayBuilder;
+
+// buffer in front of an output file descriptor, emptied with write()
+//		- fd field is -1 for a buffer that only collects bytes in memory
+//		  (it grows instead of being written out)
+//		- used field stores number of bytes waiting in data
+typedef struct {
+    int fd;
+    char *data;
+    size_t used;
+    size_t size;
+} OutputBuffer;
+
+// latency histogram: values in nanoseconds fall into 8 buckets per
+// power of two (see latencyBucket), so percentiles read from it are
+// within 12.5% of the exact ones
+//		- total field is the number of values recorded
+typedef struct {
+    uint64_t count[LATENCY_BUCKETS];
+    uint64_t total;
+} LatencyHistogram;
+
+// anagram groups kept in three flat arrays instead of linked lists;
+// words are numbered group by group, in the order of the groups
+//		- groupStart field gives the first word of each group: the words
+//		  of group g are groupStart[g] up to groupStart[g+1]-1, so the
+//		  array has nbrGroups+1 entries and the difference of two
+//		  neighbours is the length of a group
+//		- wordOffset field gives where each word starts in pool; word w
+//		  ends one byte before wordOffset[w+1] (nbrWords+1 entries)
+//		- pool field holds the words of each group back to back, each
+//		  one followed by a space, so a group is one run of bytes in
+//		  exactly the format printAnagramArray prints it
+//		- nbrAllocations field counts the malloc calls made to build it
+typedef struct {
+    int nbrGroups;
+    int nbrWords;
+    int *groupStart;
+    uint64_t *wordOffset;
+    char *pool;
+    uint64_t nbrAllocations;
+} GroupStore;
+
+// anagram groups with their words sorted and front-coded in one byte
+// pool, for dictionaries too large to keep every word whole
+//		- groupStart field gives where each group starts in pool, so group
+//		  g takes bytes groupStart[g] up to groupStart[g+1]-1 (nbrGroups+1
+//		  entries)
+//		- pool field holds each group as its number of words and their
+//		  length (all anagrams have the same length), both as varints,
+//		  then the words in sorted order; every COMPACT_RESTART-th word,
+//		  starting with the first, is a restart point stored whole, and
+//		  every other word is stored as the number of leading characters
+//		  it shares with the word before it (a varint) followed by the
+//		  rest of its characters
+//		- slots field is the lookup table made by indexCompactStore (NULL
+//		  until then): tableSlots entries holding a group plus one, or 0
+//		  for an empty slot
+//		- nbrAllocations field counts the malloc calls made to build it
+typedef struct {
+    int nbrGroups;
+    int nbrWords;
+    uint64_t *groupStart;
+    unsigned char *pool;
+    uint32_t *slots;
+    uint64_t tableSlots;
+    uint64_t nbrAllocations;
+} CompactStore;
+
+// minimal perfect hash over a fixed set of anagram keys: it gives each
+// of the nbrKeys keys its own position 0..nbrKeys-1 (see
+// buildPerfectHash and perfectHashPosition)
+//		- seed field selects the hash function of the keys
+//		- pilot field holds the 16-bit displacement of each of the
+//		  nbrBuckets buckets the keys are hashed into
+//		- tableSize field is the size of the table the buckets were
+//		  placed in (a little over nbrKeys); remap field gives, for each
+//		  place from nbrKeys on, the free position below nbrKeys that
+//		  takes its place
+typedef struct {
+    uint32_t nbrKeys;
+    uint32_t nbrBuckets;
+    uint32_t tableSize;
+    uint64_t seed;
+    uint16_t *pilot;
+    uint32_t *remap;
+} PerfectHash;
+
+/************************************************************************
+ * Function declarations/prototypes										*
+ ************************************************************************/
+
+AryElement *buildAnagramArray(char *infile, int *aryLen);
+
+AryElement *buildAnagramArrayMapped(char *infile, int *aryLen);
+
+AryElement *buildAnagramArrayWithStats(char *infile, int *aryLen, bool mapped, RunStats *stats);
+
+AryElement *buildAnagramArrayParallel(char *infile, int *aryLen, int nbrThreads);
+
+AryElement *buildAnagramArrayPipelined(char *infile, int *aryLen, int nbrWorkers);
+
+AryElement *buildAnagramArrayFromCorpus(char *infile, int *aryLen);
+
+AryElement *buildAnagramArrayFromCorpusParallel(char *infile, int *aryLen, int nbrThreads);
+
+void addCorpusText(ArrayBuilder *builder, char *start, char *end);
+
+void printAnagramArray(char *outfile, AryElement *ary, int aryLen);
+
+void printAnagramArrayParallel(char *outfile, AryElement *ary, int aryLen, int nbrThreads);
+
+void writeGroups(OutputBuffer *out, AryElement *ary, int start, int end);
+
+void writeGroup(OutputBuffer *out, AryElement *element);
+
+void writeAll(int fd, const char *data, size_t bytes);
+
+int openOutputFile(char *outfile);
+
+void freeAnagramArray(AryElement *ary, int aryLen);
+
+void buildGroupStore(char *infile, GroupStore *store);
+
+void printGroupStore(char *outfile, GroupStore *store);
+
+void freeGroupStore(GroupStore *store);
+
+void buildCompactStore(char *infile, CompactStore *store);
+
+void printCompactStore(char *outfile, CompactStore *store);
+
+void writeCompactGroup(OutputBuffer *out, CompactStore *store, int group);
+
+void indexCompactStore(CompactStore *store);
+
+int lookupCompactStore(CompactStore *store, Signature *sig, char *word, int length);
+
+void freeCompactStore(CompactStore *store);
+
+int compareNodeText(const void *a, const void *b);
+
+unsigned char *putVarint(unsigned char *p, uint64_t value);
+
+uint64_t getVarint(const unsigned char **p);
+
+char *nextMappedLine(char **p, char *end, int *length);
+
+bool areAnagrams(char *word1, char *word2);
+
+bool areAnagramsSumOfSquares(char *word1, char *word2);
+
+Node *createNode(char *word);
+
+Node *createNodeInArena(Arena *arena, char *word, int length);
+
+void initArena(Arena *arena);
+
+void *arenaAlloc(Arena *arena, size_t bytes);
+
+void releaseArena(Arena *arena);
+
+void computeSignature(char *word, int length, Signature *sig);
+
+#ifdef HAVE_X86_SIMD
+void computeSignatureSSE2(char *word, int length, Signature *sig);
+void computeSignatureAVX2(char *word, int length, Signature *sig);
+#endif
+
+const unsigned char (*signatureOneHot(void))[SIGNATURE_BYTES];
+
+SignatureKernel selectSignatureKernel(void);
+
+uint64_t classifyLetters(const char *text, char *folded);
+
+#ifdef HAVE_X86_SIMD
+uint64_t classifyLettersSSE2(const char *text, char *folded);
+uint64_t classifyLettersAVX2(const char *text, char *folded);
+#endif
+
+LetterKernel selectLetterKernel(void);
+
+bool signaturesEqual(Signature *sig1, Signature *sig2);
+
+bool signaturesMatch(Signature *sig1, char *word1, int length1, Signature *sig2, char *word2, int length2);
+
+bool sameLetters(char *word1, int length1, char *word2, int length2);
+
+bool sameOtherCharacters(char *word1, int length1, char *word2, int length2);
+
+void countLetters(char *word, int length, int *counts);
+
+void markLongSignature(Signature *sig, int *counts);
+
+void countOtherCharacters(char *word, int length, int *counts);
+
+void markOtherCharacters(Signature *sig, char *word, int length);
+
+void computeAnagramKey(Signature *sig, AnagramKey *key);
+
+unsigned int hashAnagramKey(AnagramKey *key);
+
+uint64_t seededKeyHash(AnagramKey *key, uint64_t seed);
+
+void buildPerfectHash(PerfectHash *hash, AnagramKey *keys, uint32_t nbrKeys, uint32_t *position);
+
+bool placePerfectHash(PerfectHash *hash, uint64_t *hashes, uint32_t *position);
+
+uint32_t perfectHashPosition(PerfectHash *hash, AnagramKey *key);
+
+uint32_t pilotPosition(PerfectHash *hash, uint64_t keyHash, uint32_t pilot);
+
+void freePerfectHash(PerfectHash *hash);
+
+bool keysMatch(AnagramKey *key1, Node *node1, AnagramKey *key2, Node *node2);
+
+void initSignatureTable(SignatureTable *table, int capacity);
+
+TableSlot *findSlot(SignatureTable *table, AnagramKey *key, unsigned int hash, Node *node);
+
+void growSignatureTable(SignatureTable *table);
+
+void initArrayBuilder(ArrayBuilder *builder);
+
+void addNodeToArray(ArrayBuilder *builder, Node *node);
+
+void addNodesToArray(ArrayBuilder *builder, Node **nodes, int nbrNodes);
+
+void addKeyedNodeToArray(ArrayBuilder *builder, Node *node, AnagramKey *key, unsigned int hash);
+
+void addGroupToArray(ArrayBuilder *builder, TableSlot *slot, AnagramKey *key, unsigned int hash, Node *head);
+
+bool removeWordFromArray(ArrayBuilder *builder, char *text, int length);
+
+void addFileLines(ArrayBuilder *builder, char *infile);
+
+AryElement *finishArrayBuilder(ArrayBuilder *builder, int *aryLen);
+
+AryElement *resizeAnagramArray(AryElement *ary, int len);
+
+AryHeader *getAryHeader(AryElement *ary);
+
+char *mapInputFile(char *infile, size_t *mapLen);
+
+void addMappedLines(ArrayBuilder *builder, char *start, char *end);
+
+void spliceArena(Arena *into, Arena *from);
+
+void initOutputBuffer(OutputBuffer *out, int fd, size_t size);
+
+void writeOutput(OutputBuffer *out, const char *data, size_t bytes);
+
+void reserveOutput(OutputBuffer *out, size_t bytes);
+
+void flushOutput(OutputBuffer *out);
+
+void lapRunStats(RunStats *stats, int phase);
+
+double elapsedSeconds(struct timespec *start);
+
+void recordLatency(LatencyHistogram *histogram, uint64_t ns, uint64_t count);
+
+int latencyBucket(uint64_t ns);
+
+double latencyPercentile(LatencyHistogram *histogram, double fraction);
+
+#endif
@@ -11,29 +11,489 @@
  * Author(s): Caitlin Crowe and Emily Peterson			              	*
  ***********************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include "anagramcore.h"
+
+#define RUN_BUFFER_SIZE (1 << 12)	// smallest buffer of a run being merged
+#define EXTERNAL_RESERVED_FILES 16	// descriptors an external sort leaves to the rest
+#define INDEX_MAGIC "ANAGIDX1"
+#define INDEX_VERSION 5
+#define INDEX_HEADER_BYTES (2 * sizeof(IndexHeader))	// two header copies start an index
+#define CHECKSUM_SEED 0xCBF29CE484222325ull
+#define QUERY_BATCH 32
+#define TRIE_LEVELS (ALPHABET_SIZE + 1)
+#define TRIE_LEAF_SIZE 8
+#define SERVE_BACKLOG 128
+#define SERVE_READ_SIZE (1 << 16)	// bytes read from a daemon client at a time
+#define SERVE_MAX_LINE (1 << 20)	// longest query line before the client is dropped
+#define SERVE_REPORT_SECONDS 10
+#define PHRASE_MAX_WORDS 3	// default most words in an answer of --phrases
+#define PHRASE_MAX_LETTERS 64
+#define PHRASE_MEMO_LIMIT (1 << 20)	// most slots in a memo of phrase dead ends
+#define NEAR_ANAGRAMS_MAX ((ALPHABET_SIZE + 1) * (ALPHABET_SIZE + 1))
+
+// location of one set of groups in an index file (see IndexHeader);
+// every section starts at a multiple of 8 bytes from the file start
+//		- keysOffset field locates the key of each group
+//		- slotsOffset field locates the hash table (tableSlots entries of
+//		  group+1, or 0 for an empty slot)
+//		- groupsOffset field locates nbrGroups+1 word positions: group g
+//		  has words groupStart[g] up to groupStart[g+1]-1
+//		- wordsOffset field locates nbrWords+1 pool offsets: word w is
+//		  the bytes wordOffset[w] up to wordOffset[w+1]-1 of the pool
+//		- poolOffset field locates the text of all words, back to back
+typedef struct {
+    uint64_t nbrGroups;
+    uint64_t nbrWords;
+    uint64_t tableSlots;
+    uint64_t keysOffset;
+    uint64_t slotsOffset;
+    uint64_t groupsOffset;
+    uint64_t wordsOffset;
+    uint64_t poolOffset;
+} IndexSections;
+
+// header at the start of an index file. The file holds the base groups
+// written by saveAnagramIndex and, once deltas have been applied (see
+// updateAnagramIndex), an overlay of changed and added groups at its
+// end. Bytes between baseEnd and overlayOffset are old overlays. The
+// file starts with two copies of the header, and the whole copy with
+// the highest generation is the current one: an update writes its
+// overlay first and then its header over the older copy, so a crash
+// or a reader in between still finds the previous header intact.
+//		- generation field counts the updates; the header is stored in
+//		  copy generation % 2
+//		- sourceSize and sourceMtime fields describe the dictionary the
+//		  index was built from, to tell whether the index is stale (all
+//		  zero once the index has been updated by a delta)
+//		- checksum field is the checksum of the bytes after the header
+//		  up to baseEnd
+//		- overlayChecksum field is the checksum of the bytes from
+//		  overlayOffset to the end of the file
+//		- overlayOffset field locates, for each overlay group, the base
+//		  group it replaces (int32_t, -1 for a new group); the overlay
+//		  sections follow (overlay.tableSlots is 0 if there is none)
+//		- headerChecksum field is the checksum of the header bytes
+//		  before it, section tables included; only this one is tested
+//		  when the index is opened (see verifyAnagramIndex)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t generation;
+    uint64_t fileSize;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    int64_t sourceMtimeNsec;
+    uint64_t baseEnd;
+    uint64_t checksum;
+    uint64_t overlayOffset;
+    uint64_t overlayChecksum;
+    IndexSections base;
+    IndexSections overlay;
+    uint64_t headerChecksum;
+} IndexHeader;
+
+// one set of groups of a mapped index; the pointers point into the
+// mapping (see IndexSections)
+typedef struct {
+    uint64_t nbrGroups;
+    uint64_t tableSlots;
+    AnagramKey *keys;
+    uint32_t *slots;
+    uint64_t *groupStart;
+    uint64_t *wordOffset;
+    char *pool;
+} IndexPart;
+
+// index file mapped into memory
+//		- overlay field holds the groups changed or added by deltas; a
+//		  group there hides the base group with the same key
+//		- replaces field tells for each overlay group which base group
+//		  it replaces (-1 for a new group)
+typedef struct {
+    char *map;
+    size_t mapLen;
+    IndexHeader *header;
+    IndexPart base;
+    IndexPart overlay;
+    int32_t *replaces;
+} AnagramIndex;
+
+// group changed by a delta (see recordChange)
+//		- group field is the position of the group in the array
+//		- order field stores the position of the change in the delta, so
+//		  that the first change of each group can be found after sorting
+//		- oldSize field stores number of words of the group before the change
+//		- oldLine field holds the group as printAnagramArray printed it
+//		  before the change (oldLength bytes, no newline)
+typedef struct {
+    int group;
+    int order;
+    int oldSize;
+    char *oldLine;
+    size_t oldLength;
+} ChangedGroup;
 
-#define INITIAL_ARRAY_SIZE 1000000
-#define MAX_WORD_SIZE 50
+// growable array of ChangedGroup
+typedef struct {
+    ChangedGroup *changes;
+    int count;
+    int capacity;
+} ChangeList;
 
-// node in a linked list
-struct node {
+// query word of a batch (see answerQueries)
+//		- text field holds the line buffer of the query, grown by getline
+//		- group field stores the group found for the query, or -1, and
+//		  part field the part of the index the group belongs to
+typedef struct {
     char *text;
-    struct node *next;
+    size_t capacity;
+    int length;
+    AnagramKey key;
+    unsigned int hash;
+    int64_t group;
+    IndexPart *part;
+} Query;
+
+// client connection of the query daemon (see serveAnagramIndex)
+//		- in field holds the bytes received but not yet answered (at
+//		  most the start of one line once the complete lines are done);
+//		  it grows to at most SERVE_MAX_LINE bytes
+//		- out field collects the answers in memory; sent field is how
+//		  many of its bytes have been written to the client so far
+//		- closing field is set once the client has closed its side
+//		- prev and next fields link the open connections of the daemon
+struct connection {
+    int fd;
+    char *in;
+    size_t inUsed;
+    size_t inSize;
+    OutputBuffer out;
+    size_t sent;
+    bool closing;
+    struct connection *prev;
+    struct connection *next;
 };
 
-typedef struct node Node;
+typedef struct connection Connection;
 
-// structure used for an array element
-//		- head field points to the first element of a linked list
-//		- size field stores number of nodes in the linked list
+// worker thread of the query daemon
+//		- lock field protects histogram, which holds the latencies of
+//		  the queries answered since the last report
 typedef struct {
-    int size;
-    Node *head;
-} AryElement;
+    struct queryServer *server;
+    pthread_mutex_t lock;
+    LatencyHistogram histogram;
+} ServerWorker;
+
+// state shared by the worker threads of the query daemon
+//		- epollFd field watches every other descriptor; all of them but
+//		  stopPipe[0] are watched EPOLLONESHOT, so each event goes to
+//		  one worker and a connection is served by one worker at a time
+//		- the addresses of the listenFd, signalFd, timerFd and stopPipe
+//		  fields are the epoll data of those descriptors, which tells
+//		  them apart from connections
+//		- lock field protects connections, the list of open connections
+//		- total field holds the latencies of all reported queries and
+//		  is only used by the thread writing a report
+struct queryServer {
+    AnagramIndex *index;
+    SignatureKernel kernel;
+    int epollFd;
+    int listenFd;
+    int signalFd;
+    int timerFd;
+    int stopPipe[2];
+    ServerWorker *workers;
+    int nbrWorkers;
+    pthread_mutex_t lock;
+    Connection *connections;
+    struct timespec start;
+    struct timespec lastReport;
+    LatencyHistogram total;
+};
+
+typedef struct queryServer QueryServer;
+
+// node of the histogram trie of a SubAnagramIndex. The children of a
+// node at level L split its groups by how often the letter of level L
+// occurs in them, in increasing order of that count.
+//		- count field stores the count shared by the groups of the node
+//		  (for the letter of the parent's level)
+//		- firstChild field is the position of the first child in the
+//		  node array; children are stored next to each other
+//		- start and end fields delimit the node's groups in the sorted
+//		  group array; a node without children is a leaf
+typedef struct {
+    unsigned char count;
+    int nbrChildren;
+    int firstChild;
+    int start;
+    int end;
+} TrieNode;
+
+// index answering "which words can be spelled from these letters"
+//		- order field lists the signature byte tested at each trie level
+//		- groups field lists the groups of ary sorted by their counts
+//		  taken in trie order, so every trie node covers a range of it
+//		- keys field stores the anagram key of every entry of groups
+typedef struct {
+    unsigned char order[TRIE_LEVELS];
+    TrieNode *nodes;
+    int nbrNodes;
+    int capacity;
+    int *groups;
+    AnagramKey *keys;
+    int nbrGroups;
+    AryElement *ary;
+} SubAnagramIndex;
+
+// letters of a rack query in the forms the trie search needs
+//		- count field is the rack's count for each trie level
+//		- key field packs the rack's counts like an AnagramKey, with
+//		  counts above 15 lowered to 15 (see rackFits)
+//		- sig field holds the rack's counts, lowered to 255 for racks
+//		  of LONG_WORD letters or more instead of wrapping around; the
+//		  letters themselves are kept for words that long
+typedef struct {
+    char *letters;
+    int length;
+    Signature sig;
+    unsigned char count[TRIE_LEVELS];
+    AnagramKey key;
+} Rack;
+
+// groups of a SubAnagramIndex, in the order used by trie construction
+//		- counts field holds the group's signature bytes in trie order
+typedef struct {
+    unsigned char counts[TRIE_LEVELS + 1];
+    int group;
+} TrieEntry;
+
+// growable array of group numbers
+typedef struct {
+    int *groups;
+    int count;
+    int capacity;
+} GroupList;
+
+// dictionary word class that can be part of an answer to a phrase
+//		- sig field holds the letter counts of the class
+//		- length field stores number of letters of each word
+//		- group field is the class's position in the array
+typedef struct {
+    Signature sig;
+    int length;
+    int group;
+} PhraseCandidate;
+
+// dead end of a phrase search: no answer uses only candidates from
+// start on, at most wordsLeft words and exactly the letters in sig
+typedef struct {
+    Signature sig;
+    int start;
+    int wordsLeft;
+} PhraseMemoEntry;
+
+// open-addressing set of dead ends (wordsLeft of 0 marks an empty slot)
+typedef struct {
+    PhraseMemoEntry *entries;
+    int capacity;
+    int used;
+} PhraseMemo;
+
+// growable text of the answers found from one first word
+//		- done field is set once the search from that word has ended
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool done;
+} PhraseOutput;
+
+// shared state of the search for the answers to one phrase (see
+// answerPhrases); task t finds every answer whose first word comes from
+// candidate t, and its text goes to outputs[t]
+//		- candidates field is sorted by length, longest first; an answer
+//		  takes its words in candidate order, so each set of words is
+//		  found once
+//		- nextTask field is the next task to hand out
+typedef struct {
+    AryElement *ary;
+    PhraseCandidate *candidates;
+    int nbrCandidates;
+    Signature letters;
+    int nbrLetters;
+    int maxWords;
+    int nextTask;
+    PhraseOutput *outputs;
+    pthread_mutex_t lock;
+    pthread_cond_t taskDone;
+} PhraseSearch;
+
+// one thread of a phrase search
+//		- lists field holds maxWords candidate lists of nbrCandidates
+//		  entries: list d has the candidates that fit after d words
+//		- chosen field holds the candidates of the answer being built
+//		- words field holds the words of the answer being written
+typedef struct {
+    PhraseSearch *search;
+    PhraseMemo memo;
+    int *lists;
+    int *chosen;
+    Node **words;
+} PhraseWorker;
+
+// hash table from the anagram key of every group of an array to the
+// group, for near-anagram lookups (see findNearAnagrams)
+//		- slots field holds capacity entries of group+1, or 0 for an
+//		  empty slot
+//		- keys field holds the anagram key of every group
+typedef struct {
+    AryElement *ary;
+    AnagramKey *keys;
+    int *slots;
+    unsigned int capacity;
+} NearIndex;
+
+// group that is one letter away from being an anagram of a word
+//		- added field is the letter the group has in addition (-1 if
+//		  none) and removed field the letter of the word it lacks (-1 if
+//		  none); a substitution has both
+//		- key and slot fields hold the group's key and the first table
+//		  slot to probe for it while the group is being looked up
+typedef struct {
+    int group;
+    int added;
+    int removed;
+    AnagramKey key;
+    unsigned int slot;
+} NearAnagram;
+
+// output file of saveAnagramIndex together with the running checksum,
+// which is computed over 8-byte units
+//		- pending field holds bytes that do not yet fill a unit
+//		- bytes field stores number of bytes written so far
+typedef struct {
+    FILE *fp;
+    uint64_t checksum;
+    unsigned char pending[8];
+    int nbrPending;
+    uint64_t bytes;
+} IndexWriter;
+
+// word (or, once grouped, printed group) in an external sort
+//		- key field is the anagram key of the word (zero for a group)
+//		- index field is the position of the word among the words of
+//		  the input (for a group, that of its first word)
+//		- text field points to length bytes, not '\0'-terminated
+typedef struct {
+    AnagramKey key;
+    uint64_t index;
+    char *text;
+    uint64_t length;
+} ExternalRecord;
+
+// sort of more records than fit in memory: records are collected until
+// the memory budget is used up, then sorted and written to a temporary
+// file as a run, and the runs are merged at the end (see ExternalMerge)
+//		- records field holds the records collected so far and pool
+//		  field their text
+//		- runs field holds the runs written so far, and levels field
+//		  how many merges each of them came out of (see
+//		  mergeExternalRuns)
+//		- fanIn field is the most runs the sort holds, and so merges
+//		  at once (see externalFanIn)
+//		- budget field is the number of bytes the sort may use
+typedef struct {
+    ExternalRecord *records;
+    int count;
+    int capacity;
+    char *pool;
+    size_t poolUsed;
+    size_t poolSize;
+    FILE **runs;
+    int *levels;
+    int nbrRuns;
+    int runCapacity;
+    int fanIn;
+    size_t budget;
+} ExternalSorter;
+
+// run being read back during a merge
+//		- record field is the smallest record not yet taken from the
+//		  run; its text lives in text (capacity bytes)
+typedef struct {
+    FILE *fp;
+    ExternalRecord record;
+    char *text;
+    size_t capacity;
+} RunReader;
+
+// merge of runs of an ExternalSorter (see nextExternalRecord)
+//		- readers field holds one reader per run (nbrReaders of them);
+//		  the stdio buffers of their files are cut from buffers, which
+//		  is NULL when the merge borrows them (see mergeExternalRuns)
+//		- heap field orders the runs that still have records by their
+//		  current record, smallest first; nbrLive counts them
+//		- taken field is the run whose record was returned last; it
+//		  moves on to its next record at the next call
+//		- next field is the next record of a sort that never had to
+//		  write a run, whose records are merged straight from memory
+typedef struct {
+    ExternalSorter *sorter;
+    RunReader *readers;
+    int nbrReaders;
+    char *buffers;
+    RunReader **heap;
+    int nbrLive;
+    RunReader *taken;
+    int next;
+} ExternalMerge;
+
+// anagram class counted by --counts and --top
+//		- count field stores number of words in the class
+//		- representative field points to the first word of the class,
+//		  copied into an arena
+typedef struct {
+    int count;
+    Node *representative;
+} ClassCount;
+
+// state of countAnagramClasses
+//		- table field maps the key of each class to its position in
+//		  classes, which holds the classes in order of first appearance
+//		- arena field owns the copies of the first words
+typedef struct {
+    SignatureTable table;
+    Arena arena;
+    SignatureKernel kernel;
+    ClassCount *classes;
+    int nbrClasses;
+    int capacity;
+} ClassCounter;
 
 /************************************************************************
  * YOU MUST NOT DEFINE ANY GLOBAL VARIABLES (i.e., OUTSIDE FUNCTIONS).  *
@@ -44,195 +504,4298 @@ typedef struct {
  * Function declarations/prototypes										*
  ************************************************************************/
 
-AryElement *buildAnagramArray(char *infile, int *aryLen);
+void printUsage(void);
+
+void saveAnagramIndex(char *indexFile, char *infile, AryElement *ary, int aryLen);
+
+void writeIndexSections(IndexWriter *writer, IndexSections *sections, AryElement *ary, int aryLen, AnagramKey *keys);
+
+bool openAnagramIndex(char *indexFile, AnagramIndex *index);
+
+IndexHeader *newestIndexHeader(IndexHeader *headers);
+
+void publishIndexHeader(FILE *fp, IndexHeader *header, char *indexFile);
+
+void refuseToDropDeltas(char *indexFile, AnagramIndex *index, char *infile);
+
+bool verifyAnagramIndex(char *indexFile, AnagramIndex *index);
+
+uint64_t checksumIndexHeader(IndexHeader *header);
+
+bool checkIndexSections(IndexSections *sections, uint64_t start, uint64_t end);
+
+bool mapIndexSections(AnagramIndex *index, IndexSections *sections, uint64_t end, IndexPart *part);
+
+bool indexMatchesSource(AnagramIndex *index, char *infile);
+
+void printAnagramIndex(char *outfile, AnagramIndex *index);
+
+void printIndexGroup(OutputBuffer *out, IndexPart *part, uint64_t g);
+
+void closeAnagramIndex(AnagramIndex *index);
+
+void answerQueries(char *queryFile, char *outfile, AnagramIndex *index);
+
+int64_t lookupAnagramIndex(AnagramIndex *index, Query *query);
+
+void writeQueryAnswer(OutputBuffer *out, Query *query);
+
+void answerCompactQueries(char *queryFile, char *outfile, CompactStore *store);
+
+void serveAnagramIndex(char *socketPath, AnagramIndex *index, int nbrWorkers);
+
+int openServerSocket(char *socketPath);
+
+void watchDescriptor(QueryServer *server, int op, int fd, void *data, uint32_t events);
+
+void *serverWorker(void *arg);
+
+void acceptConnections(QueryServer *server);
+
+void serveConnection(ServerWorker *worker, Connection *conn, uint32_t events);
+
+void answerServedLines(ServerWorker *worker, Connection *conn, struct timespec *start);
+
+void closeConnection(QueryServer *server, Connection *conn);
+
+void reportServer(QueryServer *server, bool final);
+
+int64_t lookupIndexPart(IndexPart *part, Query *query);
+
+void answerRacks(char *rackFile, char *outfile, AryElement *ary, int aryLen);
+
+void buildSubAnagramIndex(SubAnagramIndex *index, AryElement *ary, int aryLen);
+
+int addTrieNodes(SubAnagramIndex *index, int nbrNodes);
+
+void buildTrieNode(SubAnagramIndex *index, TrieEntry *entries, int nodeNo, int level);
+
+void freeSubAnagramIndex(SubAnagramIndex *index);
+
+void initRack(SubAnagramIndex *index, Rack *rack, char *letters, int length);
+
+void searchSubAnagrams(SubAnagramIndex *index, Rack *rack, int nodeNo, int level, GroupList *found);
+
+bool rackFits(SubAnagramIndex *index, Rack *rack, int entry);
+
+bool nibblesFit(uint64_t word, uint64_t rack);
+
+int compareTrieEntries(const void *a, const void *b);
+
+int compareInts(const void *a, const void *b);
+
+void appendGroup(GroupList *list, int group);
+
+void answerPhrases(char *phraseFile, char *outfile, AryElement *ary, int aryLen, int nbrThreads, int maxWords);
+
+void *phraseWorker(void *arg);
+
+bool extendPhrase(PhraseWorker *worker, Signature *letters, int nbrLetters, int *list, int listLen,
+                  int nbrChoices, int depth, PhraseOutput *out);
+
+bool signatureFits(Signature *word, Signature *letters);
+
+void writePhraseAnswers(PhraseWorker *worker, int nbrWords, int level, PhraseOutput *out);
+
+void appendPhraseText(PhraseOutput *out, char *text, size_t length);
+
+void clearPhraseMemo(PhraseMemo *memo);
+
+PhraseMemoEntry *findPhraseMemoEntry(PhraseMemo *memo, Signature *letters, int start);
+
+bool isPhraseDeadEnd(PhraseMemo *memo, Signature *letters, int start, int wordsLeft);
+
+void addPhraseDeadEnd(PhraseMemo *memo, Signature *letters, int start, int wordsLeft);
+
+int comparePhraseCandidates(const void *a, const void *b);
+
+void answerNearAnagrams(char *queryFile, char *outfile, AryElement *ary, int aryLen);
+
+void writeNearAnagramPairs(char *outfile, AryElement *ary, int aryLen);
+
+void prefetchNearAnagrams(NearAnagram *found, int nbrFound, AryElement *ary);
+
+void writeNearAnagram(OutputBuffer *out, NearAnagram *near, AryElement *ary);
+
+void buildNearIndex(NearIndex *index, AryElement *ary, int aryLen);
+
+void freeNearIndex(NearIndex *index);
+
+int findNearAnagrams(NearIndex *index, char *word, int length, Signature *sig, NearAnagram *found);
+
+int findLongNearAnagrams(NearIndex *index, char *word, int length, NearAnagram *found);
+
+void stepNearKey(AnagramKey *key, Signature *sig, int letter, int step);
+
+int lookupNearKey(NearIndex *index, NearAnagram *near, Signature *sig);
+
+void updateAnagramArray(char *deltaFile, char *infile, char *outfile);
+
+void updateAnagramIndex(char *indexFile, char *deltaFile, char *outfile);
 
-void printAnagramArray(char *outfile, AryElement *ary, int aryLen);
+void applyDeltaFile(ArrayBuilder *builder, char *deltaFile, ChangeList *changes, AnagramIndex *index, GroupList *replaces);
 
-void freeAnagramArray(AryElement *ary, int aryLen);
+void applyDeltaLine(ArrayBuilder *builder, char *line, int length, ChangeList *changes);
 
-bool areAnagrams(char *word1, char *word2);
+void recordChange(ArrayBuilder *builder, ChangeList *changes, int group);
 
-Node *createNode(char *word);
+char *formatGroup(ArrayBuilder *builder, int group, size_t *length);
 
+void writeChanges(ArrayBuilder *builder, ChangeList *changes, char *outfile);
+
+int compareChanges(const void *a, const void *b);
+
+void loadIndexGroup(ArrayBuilder *builder, AnagramIndex *index, char *text, int length, GroupList *replaces);
+
+void addIndexGroup(ArrayBuilder *builder, IndexPart *part, uint64_t g);
+
+void addBuilderGroup(ArrayBuilder *into, ArrayBuilder *from, int group);
+
+void appendIndexOverlay(char *indexFile, AnagramIndex *index, ArrayBuilder *builder, GroupList *replaces);
+
+void rewriteAnagramIndex(char *indexFile, AnagramIndex *index, ArrayBuilder *builder, GroupList *replaces);
+
+void writeIndexBytes(IndexWriter *writer, const void *data, size_t bytes);
+
+void padIndexWriter(IndexWriter *writer);
+
+uint64_t checksumUnits(uint64_t checksum, const unsigned char *data, size_t nbrUnits);
+
+void initRunStats(RunStats *stats, char *infile);
+
+void endRunPhase(RunStats *stats, int phase);
+
+void countArrayStats(RunStats *stats, AryElement *ary, int aryLen);
+
+void countStoreStats(RunStats *stats, GroupStore *store);
+
+void countCompactStats(RunStats *stats, CompactStore *store);
+
+void writeRunStats(RunStats *stats, char *layout, int nbrThreads);
+
+void buildExternalGroups(char *infile, char *outfile, size_t budget);
+
+void initExternalSorter(ExternalSorter *sorter, size_t budget);
+
+int externalFanIn(size_t budget);
+
+void addExternalRecord(ExternalSorter *sorter, AnagramKey *key, uint64_t index, char *text, uint64_t length);
+
+void writeExternalRun(ExternalSorter *sorter);
+
+void writeRunRecord(OutputBuffer *out, ExternalRecord *record);
+
+FILE *createRunFile(void);
+
+void mergeExternalRuns(ExternalSorter *sorter);
+
+void startExternalMerge(ExternalSorter *sorter, ExternalMerge *merge);
+
+void openRunReaders(ExternalMerge *merge, FILE **runs, int nbrRuns, char *buffers, size_t share);
+
+void closeRunReaders(ExternalMerge *merge);
+
+ExternalRecord *nextExternalRecord(ExternalMerge *merge);
+
+bool readRunRecord(RunReader *reader);
+
+void siftRunHeap(ExternalMerge *merge, int i);
+
+void finishExternalMerge(ExternalMerge *merge);
+
+int compareExternalRecords(const void *a, const void *b);
+
+void countAnagramClasses(char *infile, char *outfile, int topK);
+
+void countBlockLines(ClassCounter *counter, char *start, char *end);
+
+void countWordBatch(ClassCounter *counter, Node *words, int nbrWords);
+
+void writeTopClasses(OutputBuffer *out, ClassCount *classes, int nbrClasses, int topK);
+
+void writeClassCount(OutputBuffer *out, ClassCount *class);
+
+void siftTopHeap(int *heap, int nbrInHeap, int i, ClassCount *classes);
+
+bool betterClass(ClassCount *classes, int class1, int class2);
 
 /************************************************************************
  * Main driver of the program.											*
  * The input file is assumed to contain one word (of lower case			*
  * letters only) per line.												*
  * Use the following commands to compile and run the program:			*
- *		$ gcc -Wall -std=c99 -o anagrams anagrams.c						*
+ *		$ gcc -Wall -std=c99 -pthread -o anagrams anagrams.c anagram.c	*
  * 		$ ./anagrams  dictionary1.txt  output1.txt						*
+ * Options (placed before the file names):								*
+ *		--mmap			map the input file and use its words in place	*
+ *		--threads N		build and print with N threads (implies --mmap)	*
+ *		--pipeline		read, compute keys and group at the same time,	*
+ *						with N signature threads (see --threads)		*
+ *		--corpus		read infile as raw text: group every distinct	*
+ *						run of letters once, in lower case (--threads N	*
+ *						splits the text among N threads)				*
+ *		--index FILE	print from the binary index FILE if it was		*
+ *						built from infile, otherwise build and save it	*
+ *						(unless deltas were applied to FILE, which a	*
+ *						rebuild would lose)								*
+ *		--store			keep the groups in flat arrays (a GroupStore)	*
+ *						instead of linked lists							*
+ *		--compact		keep the words of each group sorted and			*
+ *						front-coded (a CompactStore); the words of a	*
+ *						group are printed in sorted order. Takes about	*
+ *						60% of the memory of --store, but builds about	*
+ *						1.4 times and prints about 3 times as slowly	*
+ *		--stats			write phase times and counters of the run to	*
+ *						stderr as JSON									*
+ *		--external MB	group in about MB megabytes of memory, through	*
+ *						sorted runs in temporary files					*
+ *		--counts		write the size and first word of each group		*
+ *						instead of its words							*
+ *		--top K			same as --counts, but only for the K largest	*
+ *						groups, largest first							*
+ * Other modes:															*
+ *		$ ./anagrams --index dict1.idx --query queries.txt answers.txt	*
+ *			writes the group of each query word (one per line) as one	*
+ *			line, or an empty line if it has none; - stands for stdin	*
+ *			or stdout													*
+ *		$ ./anagrams --compact --query queries.txt dict1.txt out.txt	*
+ *			same, from a CompactStore built from dict1.txt				*
+ *		$ ./anagrams --index dict1.idx --verify							*
+ *			checks every byte of the index against its checksums		*
+ *			(opening an index only checks its header)					*
+ *		$ ./anagrams --index d.idx --threads 4 --serve dict1.txt sock	*
+ *			daemon: builds d.idx from dict1.txt unless it is up to		*
+ *			date (infile may be left out), then answers the query		*
+ *			words clients send on the Unix domain socket sock as		*
+ *			--query does, until SIGINT or SIGTERM; writes queries/sec	*
+ *			and p50/p99 latency to stderr as JSON every 10 seconds		*
+ *			(anagramsbench --load puts a daemon under load)				*
+ *		$ ./anagrams --index dict1.idx --delta delta.txt changes.txt	*
+ *			applies a delta (lines +word or -word) to the index and		*
+ *			writes each changed group as -old line and +new line;		*
+ *			adding a word that is already there changes nothing;		*
+ *			without --index the delta is applied to the groups of an	*
+ *			infile given before changes.txt								*
+ *		$ ./anagrams --racks racks.txt dictionary1.txt answers.txt		*
+ *			writes every word of dictionary1.txt that can be spelled	*
+ *			with the letters of each line of racks.txt, as one line		*
+ *		$ ./anagrams --threads 4 --phrases p.txt dict1.txt out.txt		*
+ *			writes every way to spell the letters of each line of		*
+ *			p.txt with up to 3 words (--max-words W changes that),		*
+ *			one per line, and an empty line after each phrase			*
+ *		$ ./anagrams --near queries.txt dictionary1.txt answers.txt		*
+ *			writes the groups one letter away from being anagrams of	*
+ *			each query word (one per line) as one line					*
+ *		$ ./anagrams --near-pairs dictionary1.txt pairs.txt				*
+ *			writes every pair of groups one letter away from being		*
+ *			anagrams of each other, one pair per line					*
+ * The synthetic dictionaries, benchmarks and load generator are in		*
+ * anagramsbench.c.														*
  ************************************************************************/
 int main(int argc, char *argv[])
 {
     AryElement *ary;
     int aryLen;
+    bool useMmap = false;
+    bool useStore = false;
+    bool useCompact = false;
+    bool useStats = false;
+    bool usePipeline = false;
+    bool useCorpus = false;
+    size_t externalBudget = 0;
+    bool countOnly = false;
+    int topK = 0;
+    RunStats stats, *runStats = NULL;
+    GroupStore store;
+    CompactStore compact;
+    int nbrThreads = 1;
+    bool query = false;
+    bool verify = false;
+    bool serve = false;
+    bool fresh, intact;
+    char *rackFile = NULL;
+    char *phraseFile = NULL;
+    char *nearFile = NULL;
+    bool nearPairs = false;
+    int maxWords = PHRASE_MAX_WORDS;
+    char *deltaFile = NULL;
+    char *indexFile = NULL;
+    AnagramIndex index;
+    int arg = 1;
+    
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], "--mmap") == 0) {
+            useMmap = true;
+        } else if (strcmp(argv[arg], "--store") == 0) {
+            useStore = true;
+        } else if (strcmp(argv[arg], "--compact") == 0) {
+            useCompact = true;
+        } else if (strcmp(argv[arg], "--stats") == 0) {
+            useStats = true;
+        } else if (strcmp(argv[arg], "--pipeline") == 0) {
+            usePipeline = true;
+        } else if (strcmp(argv[arg], "--corpus") == 0) {
+            useCorpus = true;
+        } else if (strcmp(argv[arg], "--counts") == 0) {
+            countOnly = true;
+        } else if (strcmp(argv[arg], "--top") == 0 && arg + 1 < argc) {
+            countOnly = true;
+            topK = atoi(argv[++arg]);
+            if (topK < 1) {
+                printf("K must be at least 1.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--external") == 0 && arg + 1 < argc) {
+            if (atol(argv[++arg]) < 1) {
+                printf("Memory budget must be at least 1 MB.\n");
+                exit(EXIT_FAILURE);
+            }
+            externalBudget = (size_t)atol(argv[arg]) << 20;
+        } else if (strcmp(argv[arg], "--racks") == 0 && arg + 1 < argc) {
+            rackFile = argv[++arg];
+        } else if (strcmp(argv[arg], "--phrases") == 0 && arg + 1 < argc) {
+            phraseFile = argv[++arg];
+        } else if (strcmp(argv[arg], "--near") == 0 && arg + 1 < argc) {
+            nearFile = argv[++arg];
+        } else if (strcmp(argv[arg], "--near-pairs") == 0) {
+            nearPairs = true;
+        } else if (strcmp(argv[arg], "--max-words") == 0 && arg + 1 < argc) {
+            maxWords = atoi(argv[++arg]);
+            if (maxWords < 1) {
+                printf("Number of words must be at least 1.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--delta") == 0 && arg + 1 < argc) {
+            deltaFile = argv[++arg];
+        } else if (strcmp(argv[arg], "--query") == 0) {
+            query = true;
+        } else if (strcmp(argv[arg], "--verify") == 0) {
+            verify = true;
+        } else if (strcmp(argv[arg], "--serve") == 0) {
+            serve = true;
+        } else if (strcmp(argv[arg], "--index") == 0 && arg + 1 < argc) {
+            indexFile = argv[++arg];
+        } else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            nbrThreads = atoi(argv[++arg]);
+            if (nbrThreads < 1) {
+                printf("Number of threads must be at least 1.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            printf("Unknown option %s\n", argv[arg]);
+            printUsage();
+            exit(EXIT_FAILURE);
+        }
+        arg++;
+    }
     
-    if (argc != 3) {
+    if (argc - arg != (verify ? 0 : (query && useCompact) ? 3 : ((deltaFile != NULL && indexFile != NULL)
+            || (serve && argc - arg == 1)) ? 1 : 2)) {
         printf("Wrong number of arguments to program.\n");
-        printf("Usage: ./anagrams infile outfile\n");
+        printUsage();
         exit(EXIT_FAILURE);
     }
     
-    char *inFile = argv[1];
-    char *outFile = argv[2];
-    
-    ary = buildAnagramArray(inFile,&aryLen);
-    
-    printAnagramArray(outFile,ary,aryLen);
+    if ((useStore || useStats || externalBudget > 0 || countOnly) && (query || serve || rackFile != NULL || phraseFile != NULL || nearFile != NULL
+            || nearPairs || deltaFile != NULL || indexFile != NULL)) {
+        printf("--store, --stats, --external, --counts and --top only work on an infile and an outfile.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if ((externalBudget > 0 || countOnly) && (useStore || useStats || useMmap || nbrThreads > 1
+            || usePipeline || (externalBudget > 0 && countOnly))) {
+        printf("--external, --counts and --top cannot be combined with other options.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if (usePipeline && (useMmap || useStore || query || serve || deltaFile != NULL)) {
+        printf("--pipeline cannot be combined with --mmap or --store and only builds from an infile.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if (useCorpus && (useMmap || useStore || usePipeline || externalBudget > 0 || countOnly || indexFile != NULL
+            || query || serve || deltaFile != NULL)) {
+        printf("--corpus cannot be combined with --mmap, --store, --pipeline, --external, --counts, --top\n"
+               "or --index and only builds from an infile.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if (useCompact && (useStore || useMmap || nbrThreads > 1 || usePipeline || useCorpus || externalBudget > 0
+            || countOnly || indexFile != NULL || serve || rackFile != NULL || phraseFile != NULL || nearFile != NULL || nearPairs || deltaFile != NULL)) {
+        printf("--compact can only be combined with --stats or --query.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if (verify && (indexFile == NULL || query || serve || deltaFile != NULL || useCompact)) {
+        printf("--verify only works with --index and no other files.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
     
-    freeAnagramArray(ary,aryLen);
+    if (verify) {
+        if (!openAnagramIndex(indexFile, &index)) {
+            printf("--verify needs a valid index given with --index.\n");
+            exit(EXIT_FAILURE);
+        }
+        intact = verifyAnagramIndex(indexFile, &index);
+        closeAnagramIndex(&index);
+        if (!intact) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Index %s passed its checksum.\n", indexFile);
+        return EXIT_SUCCESS;
+    }
     
-    return EXIT_SUCCESS;
-}
-
-/************************************************************************
- * Takes a filename that contains one word (of lower case letters) per	*
- * line, reads the file contents, and builds an array of linked lists	*
- * and returns a pointer to this array. It also sets the aryLen 		*
- * parameter to size/length of the array returned from the function.	*
- ************************************************************************/
-AryElement *buildAnagramArray(char *infile, int *aryLen)
-{
-    AryElement *ary = calloc(INITIAL_ARRAY_SIZE, sizeof(AryElement)); // stores pointer to dynamically allocated array of structures
-    char word[MAX_WORD_SIZE]; // stores a word read from the input file
-    int curAryLen = 1; // stores current length/size of the array
-    int nbrUsedInAry = 0; // stores number of actual entries in the array//# of total nodes
-    int i;
-    bool added;
+    if (deltaFile != NULL) {
+        if (indexFile != NULL) {
+            updateAnagramIndex(indexFile, deltaFile, argv[arg]);
+        } else {
+            updateAnagramArray(deltaFile, argv[arg], argv[arg+1]);
+        }
+        return EXIT_SUCCESS;
+    }
     
+    if (query && useCompact) {
+        buildCompactStore(argv[arg+1],&compact);
+        indexCompactStore(&compact);
+        answerCompactQueries(argv[arg], argv[arg+2], &compact);
+        freeCompactStore(&compact);
+        return EXIT_SUCCESS;
+    }
     
-    // prepare the input file for reading
-    FILE *fp = fopen(infile,"r");
-    if (fp == NULL) {
-        fprintf(stderr,"Error opening file %s\n", infile);
-        exit(EXIT_FAILURE);
+    if (query) {
+        if (indexFile == NULL || !openAnagramIndex(indexFile, &index)) {
+            printf("--query needs a valid index given with --index.\n");
+            exit(EXIT_FAILURE);
+        }
+        answerQueries(argv[arg], argv[arg+1], &index);
+        closeAnagramIndex(&index);
+        return EXIT_SUCCESS;
     }
     
-    while(fgets(word, MAX_WORD_SIZE, fp) != NULL){
-        word[strlen(word)-1] = '\0';
-        added = false;
-        for(i=0; i<nbrUsedInAry; i++) {
-            if(areAnagrams(word, ary[i].head->text) == 1){
-                Node *tempNode = ary[i].head;
-                while(tempNode->next != NULL){
-                    tempNode = tempNode->next;
+    if (serve) {
+        if (indexFile == NULL) {
+            printf("--serve needs an index given with --index.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (argc - arg == 2) {
+            fresh = openAnagramIndex(indexFile, &index);
+            if (fresh) {
+                fresh = indexMatchesSource(&index, argv[arg]);
+                if (!fresh) {
+                    refuseToDropDeltas(indexFile, &index, argv[arg]);
                 }
-                tempNode->next = createNode(word);
-                ary[i].size++;
-                added = true;
+                closeAnagramIndex(&index);
             }
-        }
-        if(added==false){
-            if(curAryLen == nbrUsedInAry){
-                curAryLen = 2 * curAryLen;
-                ary = realloc(ary, curAryLen);
+            if (!fresh) {
+                ary = buildAnagramArrayMapped(argv[arg], &aryLen);
+                saveAnagramIndex(indexFile, argv[arg], ary, aryLen);
+                freeAnagramArray(ary, aryLen);
             }
-            ary[nbrUsedInAry].size = 0;
-            ary[nbrUsedInAry].head = createNode(word);
-            nbrUsedInAry++;
         }
+        if (!openAnagramIndex(indexFile, &index)) {
+            printf("--serve needs a valid index given with --index.\n");
+            exit(EXIT_FAILURE);
+        }
+        serveAnagramIndex(argv[argc-1], &index, nbrThreads);
+        closeAnagramIndex(&index);
+        return EXIT_SUCCESS;
     }
-    ary = realloc(ary, nbrUsedInAry);
     
-    fclose(fp);
-    *aryLen = nbrUsedInAry;
-    return ary;
+    char *inFile = argv[arg];
+    char *outFile = argv[arg+1];
+    
+    if (indexFile != NULL && rackFile == NULL && phraseFile == NULL && nearFile == NULL && !nearPairs
+            && openAnagramIndex(indexFile, &index)) {
+        if (indexMatchesSource(&index, inFile)) {
+            printAnagramIndex(outFile, &index);
+            closeAnagramIndex(&index);
+            return EXIT_SUCCESS;
+        }
+        refuseToDropDeltas(indexFile, &index, inFile);
+        closeAnagramIndex(&index);
+    }
+    
+    if (externalBudget > 0) {
+        buildExternalGroups(inFile, outFile, externalBudget);
+        return EXIT_SUCCESS;
+    }
+    
+    if (countOnly) {
+        countAnagramClasses(inFile, outFile, topK);
+        return EXIT_SUCCESS;
+    }
+    
+    if (useStats) {
+        runStats = &stats;
+        initRunStats(runStats, inFile);
+    }
+    
+    if (useStore) {
+        buildGroupStore(inFile,&store);
+        endRunPhase(runStats, PHASE_BUILD);
+        countStoreStats(runStats, &store);
+        printGroupStore(outFile,&store);
+        endRunPhase(runStats, PHASE_OUTPUT);
+        freeGroupStore(&store);
+        endRunPhase(runStats, PHASE_TEARDOWN);
+        writeRunStats(runStats, "store", 1);
+        return EXIT_SUCCESS;
+    }
+    
+    if (useCompact) {
+        buildCompactStore(inFile,&compact);
+        endRunPhase(runStats, PHASE_BUILD);
+        countCompactStats(runStats, &compact);
+        printCompactStore(outFile,&compact);
+        endRunPhase(runStats, PHASE_OUTPUT);
+        freeCompactStore(&compact);
+        endRunPhase(runStats, PHASE_TEARDOWN);
+        writeRunStats(runStats, "compact", 1);
+        return EXIT_SUCCESS;
+    }
+    
+    if (useCorpus && nbrThreads > 1) {
+        ary = buildAnagramArrayFromCorpusParallel(inFile,&aryLen,nbrThreads);
+    } else if (useCorpus) {
+        ary = buildAnagramArrayFromCorpus(inFile,&aryLen);
+    } else if (usePipeline) {
+        ary = buildAnagramArrayPipelined(inFile,&aryLen,nbrThreads);
+    } else if (nbrThreads > 1) {
+        ary = buildAnagramArrayParallel(inFile,&aryLen,nbrThreads);
+    } else {
+        ary = buildAnagramArrayWithStats(inFile,&aryLen,useMmap,runStats);
+    }
+    endRunPhase(runStats, PHASE_BUILD);
+    countArrayStats(runStats, ary, aryLen);
+    
+    if (rackFile != NULL) {
+        answerRacks(rackFile, outFile, ary, aryLen);
+        freeAnagramArray(ary,aryLen);
+        return EXIT_SUCCESS;
+    }
+    
+    if (phraseFile != NULL) {
+        answerPhrases(phraseFile, outFile, ary, aryLen, nbrThreads, maxWords);
+        freeAnagramArray(ary,aryLen);
+        return EXIT_SUCCESS;
+    }
+    
+    if (nearFile != NULL || nearPairs) {
+        if (nearPairs) {
+            writeNearAnagramPairs(outFile, ary, aryLen);
+        } else {
+            answerNearAnagrams(nearFile, outFile, ary, aryLen);
+        }
+        freeAnagramArray(ary,aryLen);
+        return EXIT_SUCCESS;
+    }
+    
+    if (nbrThreads > 1) {
+        printAnagramArrayParallel(outFile,ary,aryLen,nbrThreads);
+    } else {
+        printAnagramArray(outFile,ary,aryLen);
+    }
+    endRunPhase(runStats, PHASE_OUTPUT);
+    
+    if (indexFile != NULL) {
+        saveAnagramIndex(indexFile, inFile, ary, aryLen);
+    }
+    
+    freeAnagramArray(ary,aryLen);
+    endRunPhase(runStats, PHASE_TEARDOWN);
+    writeRunStats(runStats, useCorpus ? "corpus" : (usePipeline ? "pipeline"
+                  : ((nbrThreads > 1) ? "parallel" : (useMmap ? "mmap" : "list"))), nbrThreads);
+    
+    return EXIT_SUCCESS;
 }
 
 /************************************************************************
- * Takes a filename used for output, a pointer to the array, and size	*
- * of the array, and prints	the list of anagrams (see sample output) 	*
- * to the file specified.												*
+ * Prints how to run the program.										*
  ************************************************************************/
-void printAnagramArray(char *outfile, AryElement *ary, int aryLen)
+void printUsage(void)
 {
-    FILE *fp = fopen(outfile, "w");
-    if (fp == NULL) {
-        fprintf(stderr,"Error opening file %s\n", outfile);
-        exit(EXIT_FAILURE);
-    }
-    int i;
-    for(i=0; i<aryLen; i++){
-        Node *tempNode = ary[i].head;
-        if(tempNode->next != NULL){
-            fprintf(fp, "%s ", tempNode->text);
-            while(tempNode->next != NULL){
-                tempNode = tempNode->next;
-                fprintf(fp, "%s ", tempNode->text);
-                
-            }
-            fprintf(fp, "\n");
-        }
-    }
-    fclose(fp);
+    printf("Usage: ./anagrams [--mmap] [--threads N] [--index FILE] infile outfile\n");
+    printf("       ./anagrams --pipeline [--threads N] [--stats] infile outfile\n");
+    printf("       ./anagrams --corpus [--threads N] [--stats] infile outfile\n");
+    printf("       ./anagrams [--mmap] [--threads N] [--store] [--stats] infile outfile\n");
+    printf("       ./anagrams --external MB infile outfile\n");
+    printf("       ./anagrams [--counts | --top K] infile outfile\n");
+    printf("       ./anagrams [--compact] [--stats] infile outfile\n");
+    printf("       ./anagrams --index FILE --query queryfile outfile\n");
+    printf("       ./anagrams --index FILE --verify\n");
+    printf("       ./anagrams --compact --query queryfile infile outfile\n");
+    printf("       ./anagrams --index FILE [--threads N] --serve [infile] socket\n");
+    printf("       ./anagrams [--mmap] [--threads N] --racks rackfile infile outfile\n");
+    printf("       ./anagrams [--threads N] [--max-words W] --phrases phrasefile infile outfile\n");
+    printf("       ./anagrams [--mmap] [--threads N] (--near queryfile | --near-pairs) infile outfile\n");
+    printf("       ./anagrams --index FILE --delta deltafile outfile\n");
+    printf("       ./anagrams --delta deltafile infile outfile\n");
 }
 
 /************************************************************************
- * Releases memory allocated for the array and all the linked lists.	*
- * This involves releasing the memory allocated for each Node of each	*
- * linked list and the array itself. Before freeing up memory of a Node *
- * object, make sure to release the memory allocated for the 			*
- * "text" field of that node first.										*
+ * Starts collecting the statistics of a run that reads infile: every	*
+ * time and counter is "not measured" until it is set, except the size	*
+ * of the input.														*
  ************************************************************************/
-void freeAnagramArray(AryElement *ary, int aryLen)
+void initRunStats(RunStats *stats, char *infile)
 {
-    Node *ptr, *tmp;
-    int i;
-    for (i = 0; i < aryLen; i++) {
-        if (ary[i].size > 0) {
-            ptr = ary[i].head;
-            while (ptr != NULL) {
-                free(ptr->text);
-                tmp = ptr->next;
-                free(ptr);
-                ptr = tmp;
-            }
-        }
+    struct stat st;
+    int p;
+    
+    clock_gettime(CLOCK_MONOTONIC, &stats->start);
+    stats->phaseStart = stats->start;
+    stats->lap = stats->start;
+    for (p = 0; p < NBR_PHASES; p++) {
+        stats->phaseTime[p] = -1;
     }
-    free(ary);
+    stats->bytesRead = (stat(infile, &st) == 0) ? (int64_t)st.st_size : -1;
+    stats->bytesWritten = -1;
+    stats->nbrWords = -1;
+    stats->nbrGroups = -1;
+    stats->largestGroup = -1;
+    stats->nbrCompares = -1;
+    stats->nbrAllocations = -1;
 }
 
 /************************************************************************
- * Allocates memory for a Node object and initializes the "text" field	*
- * with the input string/word and the "next" field to NULL. Returns a	*
- * pointer to the Node object created.									*
+ * Ends a phase of main (PHASE_BUILD, PHASE_OUTPUT or PHASE_TEARDOWN):	*
+ * stores the time since the previous phase ended and starts the next	*
+ * one. Does nothing if stats is NULL.									*
  ************************************************************************/
-Node *createNode(char *word)
+void endRunPhase(RunStats *stats, int phase)
 {
-    Node *node = malloc(sizeof(struct node));
-    char *temp = malloc(sizeof(strlen(word)+1));
-    strcpy(temp, word);
-    
-    node->text = temp;
-    node->next = NULL;
-    
-    return node;
+    if (stats == NULL) {
+        return;
+    }
+    stats->phaseTime[phase] = elapsedSeconds(&stats->phaseStart);
+    clock_gettime(CLOCK_MONOTONIC, &stats->phaseStart);
+    stats->lap = stats->phaseStart;
 }
 
 /************************************************************************
- * Returns true if the input strings are anagrams, false otherwise.		*
- * Assumes the words contain only lower case letters.					*
+ * Counts the words, groups and output bytes of a built array. This		*
+ * walks every list, so the time it takes is left out of the phases.	*
+ * Does nothing if stats is NULL.										*
  ************************************************************************/
-bool areAnagrams(char *word1, char *word2)
+void countArrayStats(RunStats *stats, AryElement *ary, int aryLen)
 {
-    int len1 = 0, len2 = 0, i, x1 = 0, x2 = 0, z;
-    len1 = strlen(word1);
-    len2 = strlen(word2);
+    Node *node;
+    int g;
     
-    if(len1 == len2){ //if the two words are not the same length, then they cannot be anagrams
-        for(i=0; i<len1; i++){
-            z = word1[i] * word1[i];
-            x1 = z + x1; //get ascii of the letters and add them together
+    if (stats == NULL) {
+        return;
+    }
+    stats->nbrWords = 0;
+    stats->nbrGroups = aryLen;
+    stats->largestGroup = 0;
+    stats->bytesWritten = 0;
+    for (g = 0; g < aryLen; g++) {
+        stats->nbrWords += ary[g].size;
+        if (ary[g].size > stats->largestGroup) {
+            stats->largestGroup = ary[g].size;
         }
-        for(i=0; i<len2; i++){
-            z = word2[i] * word2[i];
-            x2 = z + x2; //get ascii of the letters and add them together
+        if (ary[g].size > 1) {
+            stats->bytesWritten += ary[g].size + 1;
+            for (node = ary[g].head; node != NULL; node = node->next) {
+                stats->bytesWritten += node->length;
+            }
+        }
+    }
+    stats->nbrAllocations = getAryHeader(ary)->arena.nbrAllocations;
+    clock_gettime(CLOCK_MONOTONIC, &stats->phaseStart);
+}
+
+/************************************************************************
+ * Same as countArrayStats, for the groups of a GroupStore.				*
+ ************************************************************************/
+void countStoreStats(RunStats *stats, GroupStore *store)
+{
+    int g, size;
+    
+    if (stats == NULL) {
+        return;
+    }
+    stats->nbrWords = store->nbrWords;
+    stats->nbrGroups = store->nbrGroups;
+    stats->largestGroup = 0;
+    stats->bytesWritten = 0;
+    for (g = 0; g < store->nbrGroups; g++) {
+        size = store->groupStart[g+1] - store->groupStart[g];
+        if (size > stats->largestGroup) {
+            stats->largestGroup = size;
+        }
+        if (size > 1) {
+            stats->bytesWritten += store->wordOffset[store->groupStart[g+1]]
+                    - store->wordOffset[store->groupStart[g]] + 1;
+        }
+    }
+    stats->nbrAllocations = store->nbrAllocations;
+    clock_gettime(CLOCK_MONOTONIC, &stats->phaseStart);
+}
+
+/************************************************************************
+ * Same as countArrayStats, for the groups of a CompactStore. Only the	*
+ * two varints at the start of each group are read.						*
+ ************************************************************************/
+void countCompactStats(RunStats *stats, CompactStore *store)
+{
+    const unsigned char *p;
+    int64_t size, length;
+    int g;
+    
+    if (stats == NULL) {
+        return;
+    }
+    stats->nbrWords = store->nbrWords;
+    stats->nbrGroups = store->nbrGroups;
+    stats->largestGroup = 0;
+    stats->bytesWritten = 0;
+    for (g = 0; g < store->nbrGroups; g++) {
+        p = store->pool + store->groupStart[g];
+        size = getVarint(&p);
+        length = getVarint(&p);
+        if (size > stats->largestGroup) {
+            stats->largestGroup = size;
+        }
+        if (size > 1) {
+            stats->bytesWritten += size * (length + 1) + 1;
+        }
+    }
+    stats->nbrAllocations = store->nbrAllocations;
+    clock_gettime(CLOCK_MONOTONIC, &stats->phaseStart);
+}
+
+/************************************************************************
+ * Writes the statistics of a run to stderr as one JSON object; values	*
+ * that were not measured are written as null. Does nothing if stats	*
+ * is NULL.																*
+ ************************************************************************/
+void writeRunStats(RunStats *stats, char *layout, int nbrThreads)
+{
+    static const char *phaseNames[NBR_PHASES] = {
+        "read", "signature", "group", "build", "output", "teardown"
+    };
+    static const char *counterNames[] = {
+        "bytes_read", "bytes_written", "words", "groups", "largest_group", "comparisons", "allocations"
+    };
+    int64_t counters[7];
+    int p, c;
+    
+    if (stats == NULL) {
+        return;
+    }
+    counters[0] = stats->bytesRead;
+    counters[1] = stats->bytesWritten;
+    counters[2] = stats->nbrWords;
+    counters[3] = stats->nbrGroups;
+    counters[4] = stats->largestGroup;
+    counters[5] = stats->nbrCompares;
+    counters[6] = stats->nbrAllocations;
+    fprintf(stderr, "{\"layout\": \"%s\", \"threads\": %d, \"phases_s\": {", layout, nbrThreads);
+    for (p = 0; p < NBR_PHASES; p++) {
+        if (stats->phaseTime[p] < 0) {
+            fprintf(stderr, "\"%s\": null, ", phaseNames[p]);
+        } else {
+            fprintf(stderr, "\"%s\": %.6f, ", phaseNames[p], stats->phaseTime[p]);
+        }
+    }
+    fprintf(stderr, "\"total\": %.6f}", elapsedSeconds(&stats->start));
+    for (c = 0; c < 7; c++) {
+        if (counters[c] < 0) {
+            fprintf(stderr, ", \"%s\": null", counterNames[c]);
+        } else {
+            fprintf(stderr, ", \"%s\": %lld", counterNames[c], (long long)counters[c]);
+        }
+    }
+    fprintf(stderr, "}\n");
+}
+
+/************************************************************************
+ * Same as buildAnagramArray followed by printAnagramArray, but uses	*
+ * about budget bytes of memory whatever the size of infile. It makes	*
+ * two external sorts:													*
+ *		1. the words, tagged with their keys and input positions, are	*
+ *		   sorted by key and position, which brings each group together	*
+ *		   with its words in input order; every group of at least two	*
+ *		   words is formatted as its output line						*
+ *		2. the lines, tagged with the position of their first words,	*
+ *		   are sorted by that position, which is the order in which		*
+ *		   printAnagramArray prints the groups							*
+ * The lines of the second sort are made while the first is merged, so	*
+ * each sort gets half of the budget, and half of the file descriptors	*
+ * for its runs (see externalFanIn).									*
+ ************************************************************************/
+void buildExternalGroups(char *infile, char *outfile, size_t budget)
+{
+    SignatureKernel kernel = selectSignatureKernel();
+    ExternalSorter words, lines;
+    ExternalMerge merge;
+    ExternalRecord *record;
+    OutputBuffer line, out;
+    AnagramKey key, groupKey = {0, 0};
+    Signature sig, groupSig;
+    uint64_t index = 0, firstIndex = 0;
+    int size = 0, groupLength = 0;
+    char *word = NULL;
+    size_t wordCap = 0;
+    ssize_t len;
+    bool sameGroup;
+    FILE *fp = fopen(infile,"r");
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    
+    initExternalSorter(&words, budget);
+    while((len = getline(&word, &wordCap, fp)) != -1){
+        while (len > 0 && (word[len-1] == '\n' || word[len-1] == '\r')) {
+            word[--len] = '\0';
+        }
+        if (len > 0) {
+            kernel(word, len, &sig);
+            computeAnagramKey(&sig, &key);
+            addExternalRecord(&words, &key, index++, word, len);
+        }
+    }
+    free(word);
+    fclose(fp);
+    
+    startExternalMerge(&words, &merge);
+    initExternalSorter(&lines, budget / 2);
+    initOutputBuffer(&line, -1, RUN_BUFFER_SIZE);
+    key.lo = 0;
+    key.hi = 0;
+    while (true) {
+        record = nextExternalRecord(&merge);
+        if (record != NULL && size > 0) {
+            sameGroup = record->key.lo == groupKey.lo && record->key.hi == groupKey.hi;
+            if (sameGroup && (groupKey.hi & KEY_OVERFLOW) != 0) {
+                computeSignature(record->text, record->length, &sig);
+                sameGroup = signaturesMatch(&sig, record->text, record->length, &groupSig, line.data, groupLength);
+            }
+        }
+        if (size > 0 && (record == NULL || !sameGroup)) {
+            if (size > 1) {
+                writeOutput(&line, "\n", 1);
+                addExternalRecord(&lines, &key, firstIndex, line.data, line.used);
+            }
+            line.used = 0;
+            size = 0;
+        }
+        if (record == NULL) {
+            break;
+        }
+        if (size == 0) {
+            groupKey = record->key;
+            firstIndex = record->index;
+            groupLength = record->length;
+            if ((groupKey.hi & KEY_OVERFLOW) != 0) {
+                computeSignature(record->text, record->length, &groupSig);
+            }
+        }
+        writeOutput(&line, record->text, record->length);
+        writeOutput(&line, " ", 1);
+        size++;
+    }
+    finishExternalMerge(&merge);
+    free(line.data);
+    
+    initOutputBuffer(&out, openOutputFile(outfile), OUTPUT_BUFFER_SIZE);
+    startExternalMerge(&lines, &merge);
+    while ((record = nextExternalRecord(&merge)) != NULL) {
+        writeOutput(&out, record->text, record->length);
+    }
+    finishExternalMerge(&merge);
+    flushOutput(&out);
+    free(out.data);
+    if (out.fd != STDOUT_FILENO) {
+        close(out.fd);
+    }
+}
+
+/************************************************************************
+ * Prepares an empty external sort that may use budget bytes: three		*
+ * quarters for the records and one quarter for their text.				*
+ ************************************************************************/
+void initExternalSorter(ExternalSorter *sorter, size_t budget)
+{
+    sorter->budget = budget;
+    sorter->capacity = budget / 4 * 3 / sizeof(ExternalRecord);
+    sorter->poolSize = budget / 4;
+    sorter->records = malloc(sorter->capacity * sizeof(ExternalRecord));
+    sorter->pool = malloc(sorter->poolSize);
+    if (sorter->records == NULL || sorter->pool == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    sorter->count = 0;
+    sorter->poolUsed = 0;
+    sorter->runs = NULL;
+    sorter->levels = NULL;
+    sorter->nbrRuns = 0;
+    sorter->runCapacity = 0;
+    sorter->fanIn = externalFanIn(budget);
+}
+
+/************************************************************************
+ * Returns the most runs an external sort of budget bytes may hold and	*
+ * merge at once (at least two). Each run being merged needs a buffer	*
+ * of RUN_BUFFER_SIZE bytes out of half of the budget, and an open		*
+ * file: the runs of both sorts of buildExternalGroups can be open		*
+ * together, so each sort gets half of the files the process may open,	*
+ * less EXTERNAL_RESERVED_FILES for the input, output and merge files.	*
+ ************************************************************************/
+int externalFanIn(size_t budget)
+{
+    struct rlimit limit;
+    size_t fanIn = budget / 2 / RUN_BUFFER_SIZE;
+    size_t files;
+    
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        files = (limit.rlim_cur > EXTERNAL_RESERVED_FILES) ? (limit.rlim_cur - EXTERNAL_RESERVED_FILES) / 2 : 0;
+        fanIn = (files < fanIn) ? files : fanIn;
+    }
+    if (fanIn < 2) {
+        return 2;
+    }
+    return (fanIn > INT_MAX) ? INT_MAX : (int)fanIn;
+}
+
+/************************************************************************
+ * Adds a copy of a record to an external sort, first writing the		*
+ * records collected so far as a run if the copy does not fit. A text	*
+ * longer than the whole pool gets a pool of its own size.				*
+ ************************************************************************/
+void addExternalRecord(ExternalSorter *sorter, AnagramKey *key, uint64_t index, char *text, uint64_t length)
+{
+    ExternalRecord *record;
+    
+    if (sorter->count == sorter->capacity || sorter->poolSize - sorter->poolUsed < length) {
+        writeExternalRun(sorter);
+        if (sorter->poolSize < length) {
+            sorter->poolSize = length;
+            free(sorter->pool);
+            sorter->pool = malloc(length);
+            if (sorter->pool == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    record = &sorter->records[sorter->count++];
+    record->key = *key;
+    record->index = index;
+    record->text = sorter->pool + sorter->poolUsed;
+    record->length = length;
+    memcpy(record->text, text, length);
+    sorter->poolUsed += length;
+}
+
+/************************************************************************
+ * Sorts the records collected so far and writes them to a temporary	*
+ * file as a run. Once the sort holds fanIn runs, some of them are		*
+ * merged into one (see mergeExternalRuns).								*
+ ************************************************************************/
+void writeExternalRun(ExternalSorter *sorter)
+{
+    OutputBuffer out;
+    FILE *fp;
+    int r;
+    
+    if (sorter->count == 0) {
+        return;
+    }
+    fp = createRunFile();
+    if (sorter->nbrRuns == sorter->runCapacity) {
+        sorter->runCapacity = (sorter->runCapacity == 0) ? 64 : 2 * sorter->runCapacity;
+        sorter->runs = realloc(sorter->runs, sorter->runCapacity * sizeof(FILE *));
+        sorter->levels = realloc(sorter->levels, sorter->runCapacity * sizeof(int));
+        if (sorter->runs == NULL || sorter->levels == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sorter->runs[sorter->nbrRuns] = fp;
+    sorter->levels[sorter->nbrRuns++] = 0;
+    
+    qsort(sorter->records, sorter->count, sizeof(ExternalRecord), compareExternalRecords);
+    initOutputBuffer(&out, fileno(fp), 16 * RUN_BUFFER_SIZE);
+    for (r = 0; r < sorter->count; r++) {
+        writeRunRecord(&out, &sorter->records[r]);
+    }
+    flushOutput(&out);
+    free(out.data);
+    sorter->count = 0;
+    sorter->poolUsed = 0;
+    if (sorter->nbrRuns == sorter->fanIn) {
+        mergeExternalRuns(sorter);
+    }
+}
+
+/************************************************************************
+ * Writes a record to a run as its key, index and length (four 64-bit	*
+ * numbers) followed by its text.										*
+ ************************************************************************/
+void writeRunRecord(OutputBuffer *out, ExternalRecord *record)
+{
+    uint64_t header[4];
+    
+    header[0] = record->key.lo;
+    header[1] = record->key.hi;
+    header[2] = record->index;
+    header[3] = record->length;
+    writeOutput(out, (char *)header, sizeof(header));
+    writeOutput(out, record->text, record->length);
+}
+
+/************************************************************************
+ * Opens a new temporary file for a run; it is deleted when closed.		*
+ ************************************************************************/
+FILE *createRunFile(void)
+{
+    FILE *fp = tmpfile();
+    
+    if (fp == NULL) {
+        fprintf(stderr,"Error creating temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+    return fp;
+}
+
+/************************************************************************
+ * Merges the newest runs of an external sort into one run, so that it	*
+ * holds fewer than fanIn runs. The runs are kept in tiers of equal		*
+ * level, older tiers first: the newest tier is merged, together with	*
+ * the tier before it when the newest run is alone in its tier, and the	*
+ * new run goes one level up. Each record is thus rewritten once per	*
+ * level (about log fanIn of the number of runs written) instead of at	*
+ * every merge. The merged runs are closed, which deletes them. The		*
+ * records of the sort are empty here, so their memory holds the read	*
+ * buffers.																*
+ ************************************************************************/
+void mergeExternalRuns(ExternalSorter *sorter)
+{
+    ExternalMerge merge;
+    ExternalRecord *record;
+    OutputBuffer out;
+    int first = sorter->nbrRuns - 1;
+    int level;
+    FILE *fp;
+    
+    while (first > 0 && sorter->levels[first-1] == sorter->levels[sorter->nbrRuns-1]) {
+        first--;
+    }
+    if (first == sorter->nbrRuns - 1 && first > 0) {
+        first--;
+        while (first > 0 && sorter->levels[first-1] == sorter->levels[first]) {
+            first--;
+        }
+    }
+    level = sorter->levels[first] + 1;
+    
+    merge.sorter = sorter;
+    merge.buffers = NULL;
+    openRunReaders(&merge, sorter->runs + first, sorter->nbrRuns - first, (char *)sorter->records,
+                   sorter->capacity * sizeof(ExternalRecord) / (sorter->nbrRuns - first));
+    fp = createRunFile();
+    initOutputBuffer(&out, fileno(fp), 16 * RUN_BUFFER_SIZE);
+    while ((record = nextExternalRecord(&merge)) != NULL) {
+        writeRunRecord(&out, record);
+    }
+    flushOutput(&out);
+    free(out.data);
+    closeRunReaders(&merge);
+    sorter->runs[first] = fp;
+    sorter->levels[first] = level;
+    sorter->nbrRuns = first + 1;
+}
+
+/************************************************************************
+ * Starts merging the records of an external sort. If no run had to be	*
+ * written, the records are sorted and merged straight from memory.		*
+ * Otherwise the last records are written as a run too, the memory of	*
+ * the records is released, and each run (fewer than fanIn of them) is	*
+ * read back through a buffer of an equal share of half of the budget.	*
+ ************************************************************************/
+void startExternalMerge(ExternalSorter *sorter, ExternalMerge *merge)
+{
+    size_t share;
+    
+    merge->sorter = sorter;
+    merge->readers = NULL;
+    merge->nbrReaders = 0;
+    merge->buffers = NULL;
+    merge->heap = NULL;
+    merge->nbrLive = 0;
+    merge->taken = NULL;
+    merge->next = 0;
+    if (sorter->nbrRuns == 0) {
+        qsort(sorter->records, sorter->count, sizeof(ExternalRecord), compareExternalRecords);
+        return;
+    }
+    
+    writeExternalRun(sorter);
+    free(sorter->records);
+    free(sorter->pool);
+    sorter->records = NULL;
+    sorter->pool = NULL;
+    
+    share = sorter->budget / 2 / sorter->nbrRuns;
+    share = (share < RUN_BUFFER_SIZE) ? RUN_BUFFER_SIZE : share;
+    merge->buffers = malloc(share * sorter->nbrRuns);
+    if (merge->buffers == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    openRunReaders(merge, sorter->runs, sorter->nbrRuns, merge->buffers, share);
+}
+
+/************************************************************************
+ * Sets up the readers of a merge of nbrRuns runs, each reading through	*
+ * share bytes of buffers, and orders them by their first records.		*
+ ************************************************************************/
+void openRunReaders(ExternalMerge *merge, FILE **runs, int nbrRuns, char *buffers, size_t share)
+{
+    RunReader *reader;
+    int r;
+    
+    merge->readers = calloc(nbrRuns, sizeof(RunReader));
+    merge->heap = malloc(nbrRuns * sizeof(RunReader *));
+    if (merge->readers == NULL || merge->heap == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    merge->nbrReaders = nbrRuns;
+    merge->nbrLive = 0;
+    merge->taken = NULL;
+    for (r = 0; r < nbrRuns; r++) {
+        reader = &merge->readers[r];
+        reader->fp = runs[r];
+        setvbuf(reader->fp, buffers + (size_t)r * share, _IOFBF, share);
+        rewind(reader->fp);
+        if (readRunRecord(reader)) {
+            merge->heap[merge->nbrLive++] = reader;
+        }
+    }
+    for (r = merge->nbrLive / 2 - 1; r >= 0; r--) {
+        siftRunHeap(merge, r);
+    }
+}
+
+/************************************************************************
+ * Closes (and so deletes) the runs of a merge and releases its			*
+ * readers.																*
+ ************************************************************************/
+void closeRunReaders(ExternalMerge *merge)
+{
+    int r;
+    
+    for (r = 0; r < merge->nbrReaders; r++) {
+        fclose(merge->readers[r].fp);
+        free(merge->readers[r].text);
+    }
+    free(merge->readers);
+    free(merge->heap);
+    merge->readers = NULL;
+    merge->heap = NULL;
+    merge->nbrReaders = 0;
+}
+
+/************************************************************************
+ * Returns the next record of a merge in sorted order, or NULL when all	*
+ * records have been returned. The record stays valid until the next	*
+ * call.																*
+ ************************************************************************/
+ExternalRecord *nextExternalRecord(ExternalMerge *merge)
+{
+    if (merge->readers == NULL) {
+        if (merge->next == merge->sorter->count) {
+            return NULL;
+        }
+        return &merge->sorter->records[merge->next++];
+    }
+    
+    if (merge->taken != NULL) {
+        if (!readRunRecord(merge->taken)) {
+            merge->heap[0] = merge->heap[--merge->nbrLive];
         }
-        if(x1 == x2){ //if the ascii values are the same, and the word length is the same, the words are anagrams
-            return 1;
+        siftRunHeap(merge, 0);
+    }
+    if (merge->nbrLive == 0) {
+        merge->taken = NULL;
+        return NULL;
+    }
+    merge->taken = merge->heap[0];
+    return &merge->taken->record;
+}
+
+/************************************************************************
+ * Reads the next record of a run into the reader. Returns false at the	*
+ * end of the run.														*
+ ************************************************************************/
+bool readRunRecord(RunReader *reader)
+{
+    uint64_t header[4];
+    
+    if (fread(header, sizeof(header), 1, reader->fp) != 1) {
+        if (ferror(reader->fp)) {
+            fprintf(stderr,"Error reading temporary file\n");
+            exit(EXIT_FAILURE);
+        }
+        return false;
+    }
+    if (header[3] > reader->capacity) {
+        reader->capacity = (header[3] > 2 * reader->capacity) ? header[3] : 2 * reader->capacity;
+        reader->text = realloc(reader->text, reader->capacity);
+        if (reader->text == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (fread(reader->text, 1, header[3], reader->fp) != header[3]) {
+        fprintf(stderr,"Error reading temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+    reader->record.key.lo = header[0];
+    reader->record.key.hi = header[1];
+    reader->record.index = header[2];
+    reader->record.length = header[3];
+    reader->record.text = reader->text;
+    return true;
+}
+
+/************************************************************************
+ * Moves the run at position i of the merge heap down until neither of	*
+ * its children has a smaller record.									*
+ ************************************************************************/
+void siftRunHeap(ExternalMerge *merge, int i)
+{
+    RunReader **heap = merge->heap;
+    RunReader *moving = heap[i];
+    int child;
+    
+    while ((child = 2 * i + 1) < merge->nbrLive) {
+        if (child + 1 < merge->nbrLive
+                && compareExternalRecords(&heap[child+1]->record, &heap[child]->record) < 0) {
+            child++;
         }
+        if (compareExternalRecords(&heap[child]->record, &moving->record) >= 0) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
     }
+    heap[i] = moving;
+}
+
+/************************************************************************
+ * Closes (and so deletes) the runs of a merge and releases the memory	*
+ * of the merge and of its external sort.								*
+ ************************************************************************/
+void finishExternalMerge(ExternalMerge *merge)
+{
+    ExternalSorter *sorter = merge->sorter;
+    
+    closeRunReaders(merge);
+    free(merge->buffers);
+    free(sorter->runs);
+    free(sorter->levels);
+    free(sorter->records);
+    free(sorter->pool);
+}
+
+/************************************************************************
+ * Compares two external records by key, then by input position. Two	*
+ * different signatures can share an overflowed key, so for such keys	*
+ * the signatures are compared in between (and the exact letter counts,	*
+ * for words long enough to wrap a signature count); this keeps the		*
+ * words of each group next to each other.								*
+ ************************************************************************/
+int compareExternalRecords(const void *a, const void *b)
+{
+    const ExternalRecord *r1 = a, *r2 = b;
+    Signature sig1, sig2;
+    int counts1[ALPHABET_SIZE + 1], counts2[ALPHABET_SIZE + 1];
+    int others1[256], others2[256];
+    int c;
     
+    if (r1->key.hi != r2->key.hi) {
+        return (r1->key.hi < r2->key.hi) ? -1 : 1;
+    }
+    if (r1->key.lo != r2->key.lo) {
+        return (r1->key.lo < r2->key.lo) ? -1 : 1;
+    }
+    if ((r1->key.hi & KEY_OVERFLOW) != 0) {
+        computeSignature(r1->text, r1->length, &sig1);
+        computeSignature(r2->text, r2->length, &sig2);
+        c = memcmp(&sig1, &sig2, sizeof(Signature));
+        if (c != 0) {
+            return c;
+        }
+        if (sig1.count[SIGNATURE_LONG] != 0) {
+            countLetters(r1->text, r1->length, counts1);
+            countLetters(r2->text, r2->length, counts2);
+            c = memcmp(counts1, counts2, sizeof(counts1));
+            if (c != 0) {
+                return c;
+            }
+        }
+        if (sig1.count[ALPHABET_SIZE] != 0 || sig1.count[SIGNATURE_LONG] != 0) {
+            countOtherCharacters(r1->text, r1->length, others1);
+            countOtherCharacters(r2->text, r2->length, others2);
+            c = memcmp(others1, others2, sizeof(others1));
+            if (c != 0) {
+                return c;
+            }
+        }
+    }
+    if (r1->index != r2->index) {
+        return (r1->index < r2->index) ? -1 : 1;
+    }
     return 0;
 }
+
+/************************************************************************
+ * Counts the words of every anagram class of infile without keeping	*
+ * the words: the signature table maps each key to its class, and only	*
+ * the first word of a class is copied, so memory grows with the number	*
+ * of classes rather than the number of words. The file is read in		*
+ * blocks of OUTPUT_BUFFER_SIZE bytes (or of the longest line). Writes	*
+ * one line per class of at least two words, with its size and first	*
+ * word separated by a space: all of them in order of first appearance	*
+ * if topK is 0, otherwise the topK largest (see writeTopClasses).		*
+ ************************************************************************/
+void countAnagramClasses(char *infile, char *outfile, int topK)
+{
+    ClassCounter counter;
+    OutputBuffer out;
+    size_t size = OUTPUT_BUFFER_SIZE, kept = 0, end, last;
+    char *block = malloc(size);
+    ssize_t got;
+    int c;
+    int fd = open(infile, O_RDONLY);
+    
+    if (fd < 0) {
+        fprintf(stderr,"Error opening file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    if (block == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initSignatureTable(&counter.table, INITIAL_TABLE_SIZE);
+    initArena(&counter.arena);
+    counter.kernel = selectSignatureKernel();
+    counter.classes = NULL;
+    counter.nbrClasses = 0;
+    counter.capacity = 0;
+    
+    // count the complete lines of each block; the start of a line that
+    // goes on in the next block is kept for the next read
+    do {
+        got = read(fd, block + kept, size - kept);
+        if (got < 0) {
+            fprintf(stderr,"Error reading file %s\n", infile);
+            exit(EXIT_FAILURE);
+        }
+        end = kept + got;
+        last = end;
+        if (got > 0) {
+            while (last > 0 && block[last-1] != '\n') {
+                last--;
+            }
+            if (last == 0) {
+                size = 2 * size;
+                block = realloc(block, size);
+                if (block == NULL) {
+                    fprintf(stderr,"Out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                kept = end;
+                continue;
+            }
+        }
+        countBlockLines(&counter, block, block + last);
+        memmove(block, block + last, end - last);
+        kept = end - last;
+    } while (got > 0);
+    close(fd);
+    free(block);
+    free(counter.table.slots);
+    
+    initOutputBuffer(&out, openOutputFile(outfile), OUTPUT_BUFFER_SIZE);
+    if (topK == 0) {
+        for (c = 0; c < counter.nbrClasses; c++) {
+            if (counter.classes[c].count > 1) {
+                writeClassCount(&out, &counter.classes[c]);
+            }
+        }
+    } else {
+        writeTopClasses(&out, counter.classes, counter.nbrClasses, topK);
+    }
+    flushOutput(&out);
+    free(out.data);
+    if (out.fd != STDOUT_FILENO) {
+        close(out.fd);
+    }
+    free(counter.classes);
+    releaseArena(&counter.arena);
+}
+
+/************************************************************************
+ * Counts the non-empty lines in [start, end), WORD_BATCH at a time.	*
+ ************************************************************************/
+void countBlockLines(ClassCounter *counter, char *start, char *end)
+{
+    Node words[WORD_BATCH];
+    char *p = start, *word;
+    int length, n = 0;
+    
+    while ((word = nextMappedLine(&p, end, &length)) != NULL) {
+        words[n].text = word;
+        words[n].length = length;
+        words[n].next = NULL;
+        if (++n == WORD_BATCH) {
+            countWordBatch(counter, words, n);
+            n = 0;
+        }
+    }
+    countWordBatch(counter, words, n);
+}
+
+/************************************************************************
+ * Adds nbrWords words to the counts of their classes, starting a new	*
+ * class (with a copy of the word) for a word whose class is not known	*
+ * yet. As in addNodesToArray, the keys are computed first and the		*
+ * table slots of the words a few places ahead are prefetched.			*
+ ************************************************************************/
+void countWordBatch(ClassCounter *counter, Node *words, int nbrWords)
+{
+    AnagramKey keys[WORD_BATCH];
+    unsigned int hashes[WORD_BATCH];
+    SignatureTable *table = &counter->table;
+    Signature sig;
+    TableSlot *slot;
+    ClassCount *class;
+    int i;
+    
+    for (i = 0; i < nbrWords; i++) {
+        counter->kernel(words[i].text, words[i].length, &sig);
+        computeAnagramKey(&sig, &keys[i]);
+        hashes[i] = hashAnagramKey(&keys[i]);
+    }
+    for (i = 0; i < nbrWords; i++) {
+        if (i + 4 < nbrWords) {
+            __builtin_prefetch(&table->slots[hashes[i+4] & (table->capacity - 1)]);
+        }
+        slot = findSlot(table, &keys[i], hashes[i], &words[i]);
+        if (slot->index >= 0) {
+            counter->classes[slot->index].count++;
+            continue;
+        }
+        
+        if (counter->nbrClasses == counter->capacity) {
+            counter->capacity = (counter->capacity == 0) ? 64 : 2 * counter->capacity;
+            counter->classes = realloc(counter->classes, counter->capacity * sizeof(ClassCount));
+            if (counter->classes == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        class = &counter->classes[counter->nbrClasses];
+        class->count = 1;
+        class->representative = createNodeInArena(&counter->arena, words[i].text, words[i].length);
+        slot->index = counter->nbrClasses++;
+        slot->hash = hashes[i];
+        slot->key = keys[i];
+        slot->tail = class->representative;
+        table->used++;
+        if (4 * table->used > 3 * table->capacity) {
+            growSignatureTable(table);
+        }
+    }
+}
+
+/************************************************************************
+ * Writes the lines (see writeClassCount) of the topK largest classes	*
+ * of at least two words, largest first and equal sizes in order of		*
+ * first appearance. The classes stream through a min-heap of at most	*
+ * topK classes: a class that is better (see betterClass) than the		*
+ * smallest one in the full heap takes its place.						*
+ ************************************************************************/
+void writeTopClasses(OutputBuffer *out, ClassCount *classes, int nbrClasses, int topK)
+{
+    int *heap = malloc(topK * sizeof(int));
+    int nbrInHeap = 0, smallest, c, h;
+    
+    if (heap == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (c = 0; c < nbrClasses; c++) {
+        if (classes[c].count < 2) {
+            continue;
+        }
+        if (nbrInHeap < topK) {
+            heap[nbrInHeap++] = c;
+            if (nbrInHeap == topK) {
+                for (h = topK / 2 - 1; h >= 0; h--) {
+                    siftTopHeap(heap, nbrInHeap, h, classes);
+                }
+            }
+        } else if (betterClass(classes, c, heap[0])) {
+            heap[0] = c;
+            siftTopHeap(heap, nbrInHeap, 0, classes);
+        }
+    }
+    if (nbrInHeap < topK) {
+        for (h = nbrInHeap / 2 - 1; h >= 0; h--) {
+            siftTopHeap(heap, nbrInHeap, h, classes);
+        }
+    }
+    
+    // taking the smallest class out each time leaves the heap array
+    // sorted from the largest class down
+    for (h = nbrInHeap - 1; h > 0; h--) {
+        smallest = heap[0];
+        heap[0] = heap[h];
+        heap[h] = smallest;
+        siftTopHeap(heap, h, 0, classes);
+    }
+    for (h = 0; h < nbrInHeap; h++) {
+        writeClassCount(out, &classes[heap[h]]);
+    }
+    free(heap);
+}
+
+/************************************************************************
+ * Appends the line of a class (its size, a space, its first word and	*
+ * a newline) to an output buffer.										*
+ ************************************************************************/
+void writeClassCount(OutputBuffer *out, ClassCount *class)
+{
+    char number[16];
+    int digits = snprintf(number, sizeof(number), "%d ", class->count);
+    
+    writeOutput(out, number, digits);
+    writeOutput(out, class->representative->text, class->representative->length);
+    writeOutput(out, "\n", 1);
+}
+
+/************************************************************************
+ * Moves class number i of a heap of nbrInHeap classes down until		*
+ * neither of its children is a smaller class (see betterClass), so		*
+ * that the smallest class stays on top.								*
+ ************************************************************************/
+void siftTopHeap(int *heap, int nbrInHeap, int i, ClassCount *classes)
+{
+    int moving = heap[i];
+    int child;
+    
+    while ((child = 2 * i + 1) < nbrInHeap) {
+        if (child + 1 < nbrInHeap && betterClass(classes, heap[child], heap[child+1])) {
+            child++;
+        }
+        if (!betterClass(classes, moving, heap[child])) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = moving;
+}
+
+/************************************************************************
+ * Returns true if class1 ranks before class2 in a top-K list: it has	*
+ * more words, or as many words and appeared first.						*
+ ************************************************************************/
+bool betterClass(ClassCount *classes, int class1, int class2)
+{
+    if (classes[class1].count != classes[class2].count) {
+        return classes[class1].count > classes[class2].count;
+    }
+    return class1 < class2;
+}
+
+/************************************************************************
+ * Writes the groups of an array to a binary index file that can later	*
+ * be mapped and used without parsing (see IndexHeader). Groups keep	*
+ * their order, singletons included, and each group stores its key so	*
+ * it can be found through the hash table section. The file is written	*
+ * and synced under a temporary name and renamed into place, so			*
+ * processes that have the old index mapped are not disturbed and a		*
+ * crash leaves either the old or the new index. If infile is NULL the	*
+ * index is not tied to a dictionary.									*
+ ************************************************************************/
+void saveAnagramIndex(char *indexFile, char *infile, AryElement *ary, int aryLen)
+{
+    IndexHeader header;
+    IndexWriter writer;
+    SignatureKernel kernel = selectSignatureKernel();
+    Signature sig;
+    AnagramKey *keys = malloc((aryLen + 1) * sizeof(AnagramKey));
+    struct stat st;
+    char *tmpFile = malloc(strlen(indexFile) + 5);
+    int g;
+    
+    if (keys == NULL || tmpFile == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(tmpFile, "%s.tmp", indexFile);
+    writer.fp = fopen(tmpFile, "wb");
+    if (writer.fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", tmpFile);
+        exit(EXIT_FAILURE);
+    }
+    
+    memset(&header, 0, sizeof(IndexHeader));
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    header.version = INDEX_VERSION;
+    if (infile != NULL && stat(infile, &st) == 0) {
+        header.sourceSize = st.st_size;
+        header.sourceMtime = st.st_mtim.tv_sec;
+        header.sourceMtimeNsec = st.st_mtim.tv_nsec;
+    }
+    
+    // the real header is written last, once the checksum is known; the
+    // second copy stays zero, which no reader takes for a header
+    fwrite(&header, sizeof(IndexHeader), 1, writer.fp);
+    fwrite(&header, sizeof(IndexHeader), 1, writer.fp);
+    writer.checksum = CHECKSUM_SEED;
+    writer.nbrPending = 0;
+    writer.bytes = INDEX_HEADER_BYTES;
+    
+    for (g = 0; g < aryLen; g++) {
+        kernel(ary[g].head->text, ary[g].head->length, &sig);
+        computeAnagramKey(&sig, &keys[g]);
+    }
+    writeIndexSections(&writer, &header.base, ary, aryLen, keys);
+    free(keys);
+    
+    header.fileSize = writer.bytes;
+    header.baseEnd = writer.bytes;
+    header.checksum = writer.checksum;
+    header.overlayOffset = writer.bytes;
+    header.overlayChecksum = CHECKSUM_SEED;
+    publishIndexHeader(writer.fp, &header, tmpFile);
+    if (fclose(writer.fp) != 0 || rename(tmpFile, indexFile) != 0) {
+        fprintf(stderr,"Error writing file %s\n", indexFile);
+        exit(EXIT_FAILURE);
+    }
+    free(tmpFile);
+}
+
+/************************************************************************
+ * Writes the key, hash table, group, word and pool sections of the		*
+ * groups of an array at the current end of an index file, and stores	*
+ * where they went in sections. keys holds the key of every group.		*
+ * Groups may be empty.													*
+ ************************************************************************/
+void writeIndexSections(IndexWriter *writer, IndexSections *sections, AryElement *ary, int aryLen, AnagramKey *keys)
+{
+    uint32_t *slots;
+    uint64_t value, mask, s;
+    Node *node;
+    int g;
+    
+    sections->nbrGroups = aryLen;
+    sections->nbrWords = 0;
+    sections->tableSlots = 16;
+    while (sections->tableSlots < 2 * (uint64_t)aryLen) {
+        sections->tableSlots *= 2;
+    }
+    
+    sections->keysOffset = writer->bytes;
+    for (g = 0; g < aryLen; g++) {
+        sections->nbrWords += ary[g].size;
+    }
+    writeIndexBytes(writer, keys, aryLen * sizeof(AnagramKey));
+    
+    sections->slotsOffset = writer->bytes;
+    slots = calloc(sections->tableSlots, sizeof(uint32_t));
+    if (slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    mask = sections->tableSlots - 1;
+    for (g = 0; g < aryLen; g++) {
+        s = hashAnagramKey(&keys[g]) & mask;
+        while (slots[s] != 0) {
+            s = (s + 1) & mask;
+        }
+        slots[s] = g + 1;
+    }
+    writeIndexBytes(writer, slots, sections->tableSlots * sizeof(uint32_t));
+    padIndexWriter(writer);
+    free(slots);
+    
+    sections->groupsOffset = writer->bytes;
+    value = 0;
+    for (g = 0; g < aryLen; g++) {
+        writeIndexBytes(writer, &value, sizeof(uint64_t));
+        value += ary[g].size;
+    }
+    writeIndexBytes(writer, &value, sizeof(uint64_t));
+    
+    sections->wordsOffset = writer->bytes;
+    value = 0;
+    for (g = 0; g < aryLen; g++) {
+        for (node = ary[g].head; node != NULL; node = node->next) {
+            writeIndexBytes(writer, &value, sizeof(uint64_t));
+            value += node->length;
+        }
+    }
+    writeIndexBytes(writer, &value, sizeof(uint64_t));
+    
+    sections->poolOffset = writer->bytes;
+    for (g = 0; g < aryLen; g++) {
+        for (node = ary[g].head; node != NULL; node = node->next) {
+            writeIndexBytes(writer, node->text, node->length);
+        }
+    }
+    padIndexWriter(writer);
+}
+
+/************************************************************************
+ * Maps an index file read-only, picks its current header (see			*
+ * IndexHeader) and checks the bounds of its sections. Returns false	*
+ * (and explains why on stderr, unless the file simply does not exist)	*
+ * if the index cannot be used. The groups themselves are not			*
+ * checksummed here, as that would read the whole file on every open;	*
+ * verifyAnagramIndex does it on request. Their offsets are checked		*
+ * though (see mapIndexSections), so a damaged body makes the index		*
+ * unusable (and rebuilt, where there is an infile) instead of sending	*
+ * reads outside the mapping. The file may be longer than				*
+ * the header says while an update is writing its overlay. The mapping	*
+ * is shared, so every process that opens the same index uses the same	*
+ * page-cached copy.													*
+ ************************************************************************/
+bool openAnagramIndex(char *indexFile, AnagramIndex *index)
+{
+    struct stat st;
+    IndexHeader *header;
+    bool hasOverlay;
+    uint64_t g;
+    int fd = open(indexFile, O_RDONLY);
+    
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            fprintf(stderr,"Error opening file %s\n", indexFile);
+        }
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < INDEX_HEADER_BYTES) {
+        fprintf(stderr,"Index %s is truncated\n", indexFile);
+        close(fd);
+        return false;
+    }
+    index->mapLen = st.st_size;
+    index->map = mmap(NULL, index->mapLen, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        fprintf(stderr,"Error mapping file %s\n", indexFile);
+        return false;
+    }
+    
+    header = newestIndexHeader((IndexHeader *)index->map);
+    index->header = header;
+    hasOverlay = header != NULL && header->overlay.tableSlots != 0;
+    if (header == NULL || header->fileSize > index->mapLen || header->fileSize % 8 != 0
+            || header->baseEnd % 8 != 0 || header->overlayOffset % 8 != 0
+            || header->baseEnd > header->overlayOffset || header->overlayOffset > header->fileSize
+            || !checkIndexSections(&header->base, INDEX_HEADER_BYTES, header->baseEnd)
+            || (hasOverlay && header->overlay.nbrGroups > header->fileSize)
+            || (hasOverlay && !checkIndexSections(&header->overlay,
+                    header->overlayOffset + header->overlay.nbrGroups * sizeof(int32_t), header->fileSize))) {
+        fprintf(stderr,"Index %s has a bad header\n", indexFile);
+        munmap(index->map, index->mapLen);
+        return false;
+    }
+    memset(&index->overlay, 0, sizeof(IndexPart));
+    index->replaces = (int32_t *)(index->map + header->overlayOffset);
+    if (!mapIndexSections(index, &header->base, header->baseEnd, &index->base)
+            || (hasOverlay && !mapIndexSections(index, &header->overlay, header->fileSize, &index->overlay))) {
+        fprintf(stderr,"Index %s has bad sections\n", indexFile);
+        munmap(index->map, index->mapLen);
+        return false;
+    }
+    for (g = 0; g < index->overlay.nbrGroups; g++) {
+        if (index->replaces[g] < -1 || index->replaces[g] >= (int64_t)index->base.nbrGroups) {
+            fprintf(stderr,"Index %s has bad sections\n", indexFile);
+            munmap(index->map, index->mapLen);
+            return false;
+        }
+    }
+    return true;
+}
+
+/************************************************************************
+ * Returns the current one of the two header copies at the start of a	*
+ * mapped index: of the copies that are whole (right magic, version and	*
+ * header checksum), the one with the highest generation. Returns NULL	*
+ * if neither copy is whole.											*
+ ************************************************************************/
+IndexHeader *newestIndexHeader(IndexHeader *headers)
+{
+    IndexHeader *newest = NULL;
+    int i;
+    
+    for (i = 0; i < 2; i++) {
+        if (memcmp(headers[i].magic, INDEX_MAGIC, 8) == 0 && headers[i].version == INDEX_VERSION
+                && headers[i].headerChecksum == checksumIndexHeader(&headers[i])
+                && (newest == NULL || (int32_t)(headers[i].generation - newest->generation) > 0)) {
+            newest = &headers[i];
+        }
+    }
+    return newest;
+}
+
+/************************************************************************
+ * Syncs what has been written to an index file so far, then writes		*
+ * the header (with its checksum) into copy header->generation % 2 and	*
+ * syncs again. Called once all the groups are written, so the new		*
+ * header never points at bytes that have not reached the disk.			*
+ ************************************************************************/
+void publishIndexHeader(FILE *fp, IndexHeader *header, char *indexFile)
+{
+    header->headerChecksum = checksumIndexHeader(header);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0
+            || fseek(fp, (header->generation % 2) * sizeof(IndexHeader), SEEK_SET) != 0
+            || fwrite(header, sizeof(IndexHeader), 1, fp) != 1
+            || fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        fprintf(stderr,"Error writing file %s\n", indexFile);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/************************************************************************
+ * Checks the groups of an index opened by openAnagramIndex against		*
+ * the checksums in its header, which reads the whole file. Returns		*
+ * false (and says so on stderr) if they do not match.					*
+ ************************************************************************/
+bool verifyAnagramIndex(char *indexFile, AnagramIndex *index)
+{
+    IndexHeader *header = index->header;
+    unsigned char *bytes = (unsigned char *)index->map;
+    
+    if (checksumUnits(CHECKSUM_SEED, bytes + INDEX_HEADER_BYTES, (header->baseEnd - INDEX_HEADER_BYTES) / 8)
+                != header->checksum
+            || checksumUnits(CHECKSUM_SEED, bytes + header->overlayOffset, (header->fileSize - header->overlayOffset) / 8)
+                != header->overlayChecksum) {
+        fprintf(stderr,"Index %s failed its checksum\n", indexFile);
+        return false;
+    }
+    return true;
+}
+
+/************************************************************************
+ * Returns the checksum of the bytes of a header before its				*
+ * headerChecksum field.												*
+ ************************************************************************/
+uint64_t checksumIndexHeader(IndexHeader *header)
+{
+    return checksumUnits(CHECKSUM_SEED, (const unsigned char *)header, (sizeof(IndexHeader) - sizeof(uint64_t)) / 8);
+}
+
+/************************************************************************
+ * Returns true if the sections lie in order between the offsets start	*
+ * and end of the file and the hash table has a power of two slots,		*
+ * more than there are groups.											*
+ ************************************************************************/
+bool checkIndexSections(IndexSections *sections, uint64_t start, uint64_t end)
+{
+    return sections->nbrGroups < end && sections->nbrWords < end && sections->tableSlots < end
+        && sections->keysOffset >= start
+        && sections->keysOffset + sections->nbrGroups * sizeof(AnagramKey) <= sections->slotsOffset
+        && sections->slotsOffset + sections->tableSlots * sizeof(uint32_t) <= sections->groupsOffset
+        && sections->groupsOffset + (sections->nbrGroups + 1) * sizeof(uint64_t) <= sections->wordsOffset
+        && sections->wordsOffset + (sections->nbrWords + 1) * sizeof(uint64_t) <= sections->poolOffset
+        && sections->poolOffset <= end
+        && sections->tableSlots > sections->nbrGroups
+        && (sections->tableSlots & (sections->tableSlots - 1)) == 0;
+}
+
+/************************************************************************
+ * Points part at the sections of a mapped index, which end at offset	*
+ * end. Returns false if the arrays of the groups cannot be followed	*
+ * safely: every slot of the hash table must be empty or name a group,	*
+ * the group starts must rise to nbrWords and the word offsets must		*
+ * rise to at most the size of the pool. This reads the three arrays,	*
+ * but not the keys or the pool.										*
+ ************************************************************************/
+bool mapIndexSections(AnagramIndex *index, IndexSections *sections, uint64_t end, IndexPart *part)
+{
+    uint64_t i;
+    
+    part->nbrGroups = sections->nbrGroups;
+    part->tableSlots = sections->tableSlots;
+    part->keys = (AnagramKey *)(index->map + sections->keysOffset);
+    part->slots = (uint32_t *)(index->map + sections->slotsOffset);
+    part->groupStart = (uint64_t *)(index->map + sections->groupsOffset);
+    part->wordOffset = (uint64_t *)(index->map + sections->wordsOffset);
+    part->pool = index->map + sections->poolOffset;
+    if (part->groupStart[part->nbrGroups] != sections->nbrWords
+            || part->wordOffset[sections->nbrWords] > end - sections->poolOffset) {
+        return false;
+    }
+    for (i = 0; i < part->tableSlots; i++) {
+        if (part->slots[i] > part->nbrGroups) {
+            return false;
+        }
+    }
+    for (i = 0; i < part->nbrGroups; i++) {
+        if (part->groupStart[i] > part->groupStart[i+1]) {
+            return false;
+        }
+    }
+    for (i = 0; i < sections->nbrWords; i++) {
+        if (part->wordOffset[i] > part->wordOffset[i+1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/************************************************************************
+ * Returns true if the index was built from the current contents of		*
+ * infile, as far as its size and modification time tell.				*
+ ************************************************************************/
+bool indexMatchesSource(AnagramIndex *index, char *infile)
+{
+    struct stat st;
+    
+    return stat(infile, &st) == 0
+        && index->header->sourceMtime != 0
+        && (uint64_t)st.st_size == index->header->sourceSize
+        && st.st_mtim.tv_sec == index->header->sourceMtime
+        && st.st_mtim.tv_nsec == index->header->sourceMtimeNsec;
+}
+
+/************************************************************************
+ * Exits with an explanation if deltas have been applied to the index	*
+ * since it was built from a dictionary (its source fields are zero):	*
+ * the index no longer matches infile, but rebuilding it from infile	*
+ * would silently throw the deltas away.								*
+ ************************************************************************/
+void refuseToDropDeltas(char *indexFile, AnagramIndex *index, char *infile)
+{
+    if (index->header->sourceSize == 0 && index->header->sourceMtime == 0) {
+        fprintf(stderr,"Index %s has been updated with --delta, so rebuilding it from %s would lose\n"
+                "those updates. Query or serve the index without an infile, or remove it to\n"
+                "rebuild it from the dictionary.\n", indexFile, infile);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/************************************************************************
+ * Same as printAnagramArray, but prints the groups of a mapped index:	*
+ * the base groups in order, each replaced by its overlay version if it	*
+ * has one, then the groups added by deltas.							*
+ ************************************************************************/
+void printAnagramIndex(char *outfile, AnagramIndex *index)
+{
+    uint64_t *overlayGroup = calloc(index->base.nbrGroups + 1, sizeof(uint64_t));
+    OutputBuffer out;
+    uint64_t g;
+    
+    if (overlayGroup == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initOutputBuffer(&out, openOutputFile(outfile), OUTPUT_BUFFER_SIZE);
+    for (g = 0; g < index->overlay.nbrGroups; g++) {
+        if (index->replaces[g] >= 0) {
+            overlayGroup[index->replaces[g]] = g + 1;
+        }
+    }
+    for (g = 0; g < index->base.nbrGroups; g++) {
+        if (overlayGroup[g] != 0) {
+            printIndexGroup(&out, &index->overlay, overlayGroup[g] - 1);
+        } else {
+            printIndexGroup(&out, &index->base, g);
+        }
+    }
+    for (g = 0; g < index->overlay.nbrGroups; g++) {
+        if (index->replaces[g] < 0) {
+            printIndexGroup(&out, &index->overlay, g);
+        }
+    }
+    free(overlayGroup);
+    flushOutput(&out);
+    free(out.data);
+    if (out.fd != STDOUT_FILENO) {
+        close(out.fd);
+    }
+}
+
+/************************************************************************
+ * Appends group g of a part of an index to an output buffer if it has	*
+ * at least two words.													*
+ ************************************************************************/
+void printIndexGroup(OutputBuffer *out, IndexPart *part, uint64_t g)
+{
+    uint64_t w;
+    
+    if (part->groupStart[g+1] - part->groupStart[g] > 1) {
+        for (w = part->groupStart[g]; w < part->groupStart[g+1]; w++) {
+            writeOutput(out, part->pool + part->wordOffset[w], part->wordOffset[w+1] - part->wordOffset[w]);
+            writeOutput(out, " ", 1);
+        }
+        writeOutput(out, "\n", 1);
+    }
+}
+
+/************************************************************************
+ * Unmaps an index opened by openAnagramIndex.							*
+ ************************************************************************/
+void closeAnagramIndex(AnagramIndex *index)
+{
+    munmap(index->map, index->mapLen);
+}
+
+/************************************************************************
+ * Appends bytes to the index file and adds them to the checksum.		*
+ ************************************************************************/
+void writeIndexBytes(IndexWriter *writer, const void *data, size_t bytes)
+{
+    const unsigned char *p = data;
+    size_t take, units;
+    
+    fwrite(data, 1, bytes, writer->fp);
+    writer->bytes += bytes;
+    
+    if (writer->nbrPending > 0) {
+        take = 8 - writer->nbrPending;
+        take = (take < bytes) ? take : bytes;
+        memcpy(writer->pending + writer->nbrPending, p, take);
+        writer->nbrPending += take;
+        p += take;
+        bytes -= take;
+        if (writer->nbrPending < 8) {
+            return;
+        }
+        writer->checksum = checksumUnits(writer->checksum, writer->pending, 1);
+        writer->nbrPending = 0;
+    }
+    units = bytes / 8;
+    writer->checksum = checksumUnits(writer->checksum, p, units);
+    writer->nbrPending = bytes - 8 * units;
+    memcpy(writer->pending, p + 8 * units, writer->nbrPending);
+}
+
+/************************************************************************
+ * Writes zero bytes until the file size is a multiple of 8.			*
+ ************************************************************************/
+void padIndexWriter(IndexWriter *writer)
+{
+    static const unsigned char zeros[8] = {0};
+    
+    if (writer->bytes % 8 != 0) {
+        writeIndexBytes(writer, zeros, 8 - writer->bytes % 8);
+    }
+}
+
+/************************************************************************
+ * Adds nbrUnits 8-byte units to a 64-bit FNV-1a style checksum.		*
+ * Working on whole units keeps the checksum close to memory speed.		*
+ ************************************************************************/
+uint64_t checksumUnits(uint64_t checksum, const unsigned char *data, size_t nbrUnits)
+{
+    uint64_t unit;
+    size_t i;
+    
+    for (i = 0; i < nbrUnits; i++) {
+        memcpy(&unit, data + 8 * i, 8);
+        checksum = (checksum ^ unit) * 0x100000001B3ull;
+        checksum ^= checksum >> 29;
+    }
+    return checksum;
+}
+
+/************************************************************************
+ * Reads query words, one per line, from queryFile and writes the group	*
+ * of each one to outfile in the format of printAnagramArray, or an		*
+ * empty line if the index has no group for it (so answer n is always	*
+ * line n). Either file name may be - for stdin or stdout.				*
+ * Queries go through in batches of QUERY_BATCH: the keys of the whole	*
+ * batch are computed and their table slots prefetched first, then the	*
+ * group arrays of the first candidates are prefetched, and only then	*
+ * are the lookups done. The cache misses of a batch thus overlap		*
+ * instead of being paid one query after the other.						*
+ ************************************************************************/
+void answerQueries(char *queryFile, char *outfile, AnagramIndex *index)
+{
+    FILE *fp = (strcmp(queryFile, "-") == 0) ? stdin : fopen(queryFile, "r");
+    int fd = openOutputFile(outfile);
+    SignatureKernel kernel = selectSignatureKernel();
+    uint64_t mask = index->base.tableSlots - 1;
+    Query batch[QUERY_BATCH];
+    OutputBuffer out;
+    Signature sig;
+    ssize_t len;
+    uint32_t slot;
+    int nbrQueries, q;
+    bool done = false;
+    
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", queryFile);
+        exit(EXIT_FAILURE);
+    }
+    initOutputBuffer(&out, fd, OUTPUT_BUFFER_SIZE);
+    for (q = 0; q < QUERY_BATCH; q++) {
+        batch[q].text = NULL;
+        batch[q].capacity = 0;
+    }
+    
+    while (!done) {
+        for (nbrQueries = 0; nbrQueries < QUERY_BATCH; nbrQueries++) {
+            Query *query = &batch[nbrQueries];
+    
+            if ((len = getline(&query->text, &query->capacity, fp)) == -1) {
+                done = true;
+                break;
+            }
+            while (len > 0 && (query->text[len-1] == '\n' || query->text[len-1] == '\r')) {
+                len--;
+            }
+            query->length = len;
+            kernel(query->text, query->length, &sig);
+            computeAnagramKey(&sig, &query->key);
+            query->hash = hashAnagramKey(&query->key);
+            __builtin_prefetch(&index->base.slots[query->hash & mask]);
+        }
+        for (q = 0; q < nbrQueries; q++) {
+            slot = index->base.slots[batch[q].hash & mask];
+            if (slot != 0) {
+                __builtin_prefetch(&index->base.keys[slot-1]);
+                __builtin_prefetch(&index->base.groupStart[slot-1]);
+            }
+        }
+        for (q = 0; q < nbrQueries; q++) {
+            batch[q].group = (batch[q].length > 0) ? lookupAnagramIndex(index, &batch[q]) : -1;
+            if (batch[q].group >= 0) {
+                __builtin_prefetch(&batch[q].part->wordOffset[batch[q].part->groupStart[batch[q].group]]);
+            }
+        }
+        for (q = 0; q < nbrQueries; q++) {
+            writeQueryAnswer(&out, &batch[q]);
+        }
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    for (q = 0; q < QUERY_BATCH; q++) {
+        free(batch[q].text);
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * Returns the group of the index whose words are anagrams of the query	*
+ * word, or -1 if there is none, and points query->part at the part of	*
+ * the index the group is in. The key and hash of the query must be		*
+ * set. The overlay is searched first, since its groups hide the base	*
+ * groups they replace.													*
+ ************************************************************************/
+int64_t lookupAnagramIndex(AnagramIndex *index, Query *query)
+{
+    int64_t g = lookupIndexPart(&index->overlay, query);
+    
+    if (g >= 0) {
+        query->part = &index->overlay;
+        return g;
+    }
+    query->part = &index->base;
+    return lookupIndexPart(&index->base, query);
+}
+
+/************************************************************************
+ * Returns the group of one part of the index whose key is the key of	*
+ * the query, or -1 if there is none. Keys that overflowed are			*
+ * confirmed by comparing the signature of the query with that of the	*
+ * first word of the group.												*
+ ************************************************************************/
+int64_t lookupIndexPart(IndexPart *part, Query *query)
+{
+    uint64_t mask = part->tableSlots - 1;
+    uint64_t s = query->hash & mask;
+    uint64_t w;
+    Signature sig1, sig2;
+    uint32_t g;
+    
+    if (part->tableSlots == 0) {
+        return -1;
+    }
+    while ((g = part->slots[s]) != 0) {
+        g--;
+        if (part->keys[g].lo == query->key.lo && part->keys[g].hi == query->key.hi) {
+            w = part->groupStart[g];
+            if ((query->key.hi & KEY_OVERFLOW) == 0 || w == part->groupStart[g+1]) {
+                return g;
+            }
+            computeSignature(part->pool + part->wordOffset[w], part->wordOffset[w+1] - part->wordOffset[w], &sig1);
+            computeSignature(query->text, query->length, &sig2);
+            if (signaturesMatch(&sig1, part->pool + part->wordOffset[w], part->wordOffset[w+1] - part->wordOffset[w],
+                                &sig2, query->text, query->length)) {
+                return g;
+            }
+        }
+        s = (s + 1) & mask;
+    }
+    return -1;
+}
+
+/************************************************************************
+ * Writes the group found for a query (see lookupAnagramIndex) as one	*
+ * line in the format of printAnagramArray, or an empty line if the		*
+ * query has no group.													*
+ ************************************************************************/
+void writeQueryAnswer(OutputBuffer *out, Query *query)
+{
+    IndexPart *part = query->part;
+    uint64_t w;
+    
+    if (query->group >= 0) {
+        for (w = part->groupStart[query->group]; w < part->groupStart[query->group+1]; w++) {
+            writeOutput(out, part->pool + part->wordOffset[w], part->wordOffset[w+1] - part->wordOffset[w]);
+            writeOutput(out, " ", 1);
+        }
+    }
+    writeOutput(out, "\n", 1);
+}
+
+/************************************************************************
+ * Same as answerQueries, but looks the query words up in a				*
+ * CompactStore (indexed with indexCompactStore) and decodes the words	*
+ * of each group found, so they are written in sorted order.			*
+ ************************************************************************/
+void answerCompactQueries(char *queryFile, char *outfile, CompactStore *store)
+{
+    FILE *fp = (strcmp(queryFile, "-") == 0) ? stdin : fopen(queryFile, "r");
+    int fd = openOutputFile(outfile);
+    SignatureKernel kernel = selectSignatureKernel();
+    OutputBuffer out;
+    Signature sig;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    int g;
+    
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", queryFile);
+        exit(EXIT_FAILURE);
+    }
+    initOutputBuffer(&out, fd, OUTPUT_BUFFER_SIZE);
+    while ((len = getline(&line, &capacity, fp)) != -1) {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+            len--;
+        }
+        kernel(line, len, &sig);
+        g = (len > 0) ? lookupCompactStore(store, &sig, line, len) : -1;
+        if (g >= 0) {
+            writeCompactGroup(&out, store, g);
+        } else {
+            writeOutput(&out, "\n", 1);
+        }
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    free(line);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * Runs the query daemon: answers the clients of a Unix domain socket	*
+ * at socketPath from the index until SIGINT or SIGTERM arrives.		*
+ * Clients send query words one per line and get one answer line per	*
+ * query, in order, exactly as --query writes them; they may send any	*
+ * number of queries before reading the answers.						*
+ * The daemon is an epoll event loop run by nbrWorkers threads at		*
+ * once. Every descriptor is watched EPOLLONESHOT, so whichever thread	*
+ * is free takes the next ready connection, answers all complete lines	*
+ * it has sent, writes the answers and hands the connection back to		*
+ * epoll. Signals and the report timer arrive through descriptors too.	*
+ * Every SERVE_REPORT_SECONDS seconds (if there were queries), and once	*
+ * more at exit, a JSON line with the number of queries, queries/sec	*
+ * and the p50 and p99 time from reading a query to writing its answer	*
+ * goes to stderr.														*
+ ************************************************************************/
+void serveAnagramIndex(char *socketPath, AnagramIndex *index, int nbrWorkers)
+{
+    QueryServer server;
+    pthread_t *threads = malloc(nbrWorkers * sizeof(pthread_t));
+    struct itimerspec period = {{SERVE_REPORT_SECONDS, 0}, {SERVE_REPORT_SECONDS, 0}};
+    sigset_t signals;
+    Connection *conn;
+    int t;
+    
+    server.workers = malloc(nbrWorkers * sizeof(ServerWorker));
+    if (threads == NULL || server.workers == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    
+    server.index = index;
+    server.kernel = selectSignatureKernel();
+    server.nbrWorkers = nbrWorkers;
+    server.connections = NULL;
+    memset(&server.total, 0, sizeof(LatencyHistogram));
+    pthread_mutex_init(&server.lock, NULL);
+    server.listenFd = openServerSocket(socketPath);
+    server.signalFd = signalfd(-1, &signals, 0);
+    server.timerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+    server.epollFd = epoll_create1(0);
+    if (server.signalFd < 0 || server.timerFd < 0 || server.epollFd < 0 || pipe(server.stopPipe) != 0
+            || timerfd_settime(server.timerFd, 0, &period, NULL) != 0) {
+        fprintf(stderr,"Error setting up the daemon\n");
+        exit(EXIT_FAILURE);
+    }
+    watchDescriptor(&server, EPOLL_CTL_ADD, server.listenFd, &server.listenFd, EPOLLIN | EPOLLONESHOT);
+    watchDescriptor(&server, EPOLL_CTL_ADD, server.signalFd, &server.signalFd, EPOLLIN | EPOLLONESHOT);
+    watchDescriptor(&server, EPOLL_CTL_ADD, server.timerFd, &server.timerFd, EPOLLIN | EPOLLONESHOT);
+    watchDescriptor(&server, EPOLL_CTL_ADD, server.stopPipe[0], &server.stopPipe, EPOLLIN);
+    
+    clock_gettime(CLOCK_MONOTONIC, &server.start);
+    server.lastReport = server.start;
+    fprintf(stderr, "Serving %s with %d threads\n", socketPath, nbrWorkers);
+    for (t = 0; t < nbrWorkers; t++) {
+        server.workers[t].server = &server;
+        pthread_mutex_init(&server.workers[t].lock, NULL);
+        memset(&server.workers[t].histogram, 0, sizeof(LatencyHistogram));
+        if (pthread_create(&threads[t], NULL, serverWorker, &server.workers[t]) != 0) {
+            fprintf(stderr,"Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (t = 0; t < nbrWorkers; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    reportServer(&server, true);
+    
+    while ((conn = server.connections) != NULL) {
+        closeConnection(&server, conn);
+    }
+    for (t = 0; t < nbrWorkers; t++) {
+        pthread_mutex_destroy(&server.workers[t].lock);
+    }
+    pthread_mutex_destroy(&server.lock);
+    close(server.listenFd);
+    close(server.signalFd);
+    close(server.timerFd);
+    close(server.stopPipe[0]);
+    close(server.stopPipe[1]);
+    close(server.epollFd);
+    unlink(socketPath);
+    free(server.workers);
+    free(threads);
+}
+
+/************************************************************************
+ * Returns a non-blocking socket listening at socketPath. A socket file	*
+ * left there by an earlier daemon is removed first.					*
+ ************************************************************************/
+int openServerSocket(char *socketPath)
+{
+    struct sockaddr_un address;
+    struct stat st;
+    int fd;
+    
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr,"Socket path %s is too long\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+    if (stat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socketPath);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0
+            || listen(fd, SERVE_BACKLOG) != 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+        fprintf(stderr,"Error listening on %s\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/************************************************************************
+ * Adds (op EPOLL_CTL_ADD) or re-arms (op EPOLL_CTL_MOD) the watch of	*
+ * the daemon's epoll descriptor on fd, with the given epoll data and	*
+ * events.																*
+ ************************************************************************/
+void watchDescriptor(QueryServer *server, int op, int fd, void *data, uint32_t events)
+{
+    struct epoll_event event;
+    
+    event.events = events;
+    event.data.ptr = data;
+    if (epoll_ctl(server->epollFd, op, fd, &event) != 0) {
+        fprintf(stderr,"Error watching descriptor %d\n", fd);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/************************************************************************
+ * Body of a worker thread of the daemon (arg is its ServerWorker):		*
+ * handles one ready descriptor at a time until the stop pipe becomes	*
+ * readable. The stop pipe is watched without EPOLLONESHOT, so one		*
+ * byte written to it wakes and stops every worker.						*
+ ************************************************************************/
+void *serverWorker(void *arg)
+{
+    ServerWorker *worker = arg;
+    QueryServer *server = worker->server;
+    struct epoll_event event;
+    struct signalfd_siginfo info;
+    uint64_t expirations;
+    
+    while (true) {
+        if (epoll_wait(server->epollFd, &event, 1, -1) != 1) {
+            continue;
+        }
+        if (event.data.ptr == &server->stopPipe) {
+            return NULL;
+        } else if (event.data.ptr == &server->listenFd) {
+            acceptConnections(server);
+            watchDescriptor(server, EPOLL_CTL_MOD, server->listenFd, &server->listenFd, EPOLLIN | EPOLLONESHOT);
+        } else if (event.data.ptr == &server->signalFd) {
+            if (read(server->signalFd, &info, sizeof(info)) == sizeof(info)) {
+                writeAll(server->stopPipe[1], "x", 1);
+            } else {
+                watchDescriptor(server, EPOLL_CTL_MOD, server->signalFd, &server->signalFd, EPOLLIN | EPOLLONESHOT);
+            }
+        } else if (event.data.ptr == &server->timerFd) {
+            if (read(server->timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                reportServer(server, false);
+            }
+            watchDescriptor(server, EPOLL_CTL_MOD, server->timerFd, &server->timerFd, EPOLLIN | EPOLLONESHOT);
+        } else {
+            serveConnection(worker, event.data.ptr, event.events);
+        }
+    }
+}
+
+/************************************************************************
+ * Accepts every pending client of the daemon and starts watching it.	*
+ ************************************************************************/
+void acceptConnections(QueryServer *server)
+{
+    Connection *conn;
+    int fd;
+    
+    while ((fd = accept(server->listenFd, NULL, NULL)) >= 0) {
+        conn = malloc(sizeof(Connection));
+        if (conn == NULL || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = fd;
+        conn->inUsed = 0;
+        conn->inSize = SERVE_READ_SIZE;
+        conn->in = malloc(conn->inSize);
+        if (conn->in == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        initOutputBuffer(&conn->out, -1, SERVE_READ_SIZE);
+        conn->sent = 0;
+        conn->closing = false;
+        
+        pthread_mutex_lock(&server->lock);
+        conn->prev = NULL;
+        conn->next = server->connections;
+        if (server->connections != NULL) {
+            server->connections->prev = conn;
+        }
+        server->connections = conn;
+        pthread_mutex_unlock(&server->lock);
+        watchDescriptor(server, EPOLL_CTL_ADD, fd, conn, EPOLLIN | EPOLLONESHOT);
+    }
+}
+
+/************************************************************************
+ * Serves one ready connection. Answers that the client has not taken	*
+ * yet are written first; only when none are left is more input read	*
+ * (at most one buffer full) and answered, so a client that sends		*
+ * without reading cannot make the daemon buffer without limit. A		*
+ * client whose line outgrows SERVE_MAX_LINE bytes is dropped. The		*
+ * connection is then watched for whatever it waits for next, or		*
+ * closed once the client has closed its side and has every answer.		*
+ ************************************************************************/
+void serveConnection(ServerWorker *worker, Connection *conn, uint32_t events)
+{
+    struct timespec start;
+    ssize_t n;
+    bool failed = false;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (conn->sent == conn->out.used && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+        if (conn->inUsed == SERVE_MAX_LINE) {
+            closeConnection(worker->server, conn);
+            return;
+        }
+        if (conn->inUsed == conn->inSize) {
+            conn->inSize *= 2;
+            conn->in = realloc(conn->in, conn->inSize);
+            if (conn->in == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        n = read(conn->fd, conn->in + conn->inUsed, conn->inSize - conn->inUsed);
+        if (n > 0) {
+            conn->inUsed += n;
+        } else if (n == 0) {
+            conn->closing = true;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            failed = true;
+        }
+        answerServedLines(worker, conn, &start);
+    }
+    
+    while (!failed && conn->sent < conn->out.used) {
+        n = send(conn->fd, conn->out.data + conn->sent, conn->out.used - conn->sent, MSG_NOSIGNAL);
+        if (n >= 0) {
+            conn->sent += n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            failed = true;
+        }
+    }
+    if (conn->sent == conn->out.used) {
+        conn->sent = conn->out.used = 0;
+    }
+    
+    if (failed || (conn->closing && conn->out.used == 0)) {
+        closeConnection(worker->server, conn);
+    } else {
+        watchDescriptor(worker->server, EPOLL_CTL_MOD, conn->fd, conn, ((conn->out.used > 0) ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT);
+    }
+}
+
+/************************************************************************
+ * Answers every complete line in the input of a connection (and the	*
+ * rest of the input as a last line if the client has closed its side)	*
+ * into its output and keeps any incomplete line at the start of the	*
+ * input. The time from start (when the input was read) to each answer	*
+ * goes to the histogram of the worker, one latency per line.			*
+ ************************************************************************/
+void answerServedLines(ServerWorker *worker, Connection *conn, struct timespec *start)
+{
+    QueryServer *server = worker->server;
+    Query query;
+    Signature sig;
+    char *line = conn->in;
+    char *end = conn->in + conn->inUsed;
+    char *newline;
+    
+    pthread_mutex_lock(&worker->lock);
+    while (line < end) {
+        newline = memchr(line, '\n', end - line);
+        if (newline == NULL && !conn->closing) {
+            break;
+        }
+        query.text = line;
+        query.part = NULL;
+        query.length = ((newline != NULL) ? newline : end) - line;
+        while (query.length > 0 && query.text[query.length-1] == '\r') {
+            query.length--;
+        }
+        query.group = -1;
+        if (query.length > 0) {
+            server->kernel(query.text, query.length, &sig);
+            computeAnagramKey(&sig, &query.key);
+            query.hash = hashAnagramKey(&query.key);
+            query.group = lookupAnagramIndex(server->index, &query);
+        }
+        writeQueryAnswer(&conn->out, &query);
+        recordLatency(&worker->histogram, elapsedSeconds(start) * 1e9, 1);
+        line = (newline != NULL) ? newline + 1 : end;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    conn->inUsed = end - line;
+    memmove(conn->in, line, conn->inUsed);
+}
+
+/************************************************************************
+ * Closes a connection of the daemon and releases it.					*
+ ************************************************************************/
+void closeConnection(QueryServer *server, Connection *conn)
+{
+    pthread_mutex_lock(&server->lock);
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        server->connections = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    pthread_mutex_unlock(&server->lock);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out.data);
+    free(conn);
+}
+
+/************************************************************************
+ * Collects the latencies the workers recorded since the last report	*
+ * and writes them to stderr as one JSON line (if there were any). The	*
+ * final report covers every query since the daemon started instead.	*
+ ************************************************************************/
+void reportServer(QueryServer *server, bool final)
+{
+    LatencyHistogram interval;
+    LatencyHistogram *histogram = final ? &server->total : &interval;
+    double seconds;
+    int t, b;
+    
+    memset(&interval, 0, sizeof(LatencyHistogram));
+    for (t = 0; t < server->nbrWorkers; t++) {
+        pthread_mutex_lock(&server->workers[t].lock);
+        for (b = 0; b < LATENCY_BUCKETS; b++) {
+            interval.count[b] += server->workers[t].histogram.count[b];
+        }
+        interval.total += server->workers[t].histogram.total;
+        memset(&server->workers[t].histogram, 0, sizeof(LatencyHistogram));
+        pthread_mutex_unlock(&server->workers[t].lock);
+    }
+    for (b = 0; b < LATENCY_BUCKETS; b++) {
+        server->total.count[b] += interval.count[b];
+    }
+    server->total.total += interval.total;
+    
+    seconds = elapsedSeconds(final ? &server->start : &server->lastReport);
+    clock_gettime(CLOCK_MONOTONIC, &server->lastReport);
+    if (histogram->total == 0 && !final) {
+        return;
+    }
+    fprintf(stderr, "{\"report\": \"%s\", \"seconds\": %.3f, \"queries\": %llu, \"queries_per_s\": %.0f, "
+            "\"p50_us\": %.3f, \"p99_us\": %.3f}\n", final ? "total" : "interval", seconds,
+            (unsigned long long)histogram->total, histogram->total / seconds,
+            latencyPercentile(histogram, 0.50), latencyPercentile(histogram, 0.99));
+}
+
+
+
+
+
+
+
+/************************************************************************
+ * Reads racks (multisets of letters), one per line, from rackFile and	*
+ * writes for each one the words of ary that can be spelled from it		*
+ * (every letter used at most as often as the rack has it) to outfile:	*
+ * one line per rack, words in the order of printAnagramArray. Either	*
+ * file name may be - for stdin or stdout.								*
+ ************************************************************************/
+void answerRacks(char *rackFile, char *outfile, AryElement *ary, int aryLen)
+{
+    FILE *fp = (strcmp(rackFile, "-") == 0) ? stdin : fopen(rackFile, "r");
+    int fd = openOutputFile(outfile);
+    SubAnagramIndex index;
+    GroupList found = {NULL, 0, 0};
+    OutputBuffer out;
+    Rack rack;
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t len;
+    Node *node;
+    int i;
+    
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", rackFile);
+        exit(EXIT_FAILURE);
+    }
+    buildSubAnagramIndex(&index, ary, aryLen);
+    initOutputBuffer(&out, fd, OUTPUT_BUFFER_SIZE);
+    
+    while ((len = getline(&line, &lineCap, fp)) != -1) {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+            len--;
+        }
+        found.count = 0;
+        if (len > 0 && index.nbrNodes > 0) {
+            initRack(&index, &rack, line, len);
+            searchSubAnagrams(&index, &rack, 0, 0, &found);
+            qsort(found.groups, found.count, sizeof(int), compareInts);
+        }
+        for (i = 0; i < found.count; i++) {
+            for (node = ary[found.groups[i]].head; node != NULL; node = node->next) {
+                writeOutput(&out, node->text, node->length);
+                writeOutput(&out, " ", 1);
+            }
+        }
+        writeOutput(&out, "\n", 1);
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    free(found.groups);
+    free(line);
+    freeSubAnagramIndex(&index);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * Builds the histogram trie over the groups of ary. Level L of the		*
+ * trie splits on the count of letter order[L], the most common letters	*
+ * of English words first: those are the letters where a short rack		*
+ * most often has fewer copies than a word, so whole subtrees are cut	*
+ * off near the root. The last level is the other-character count.		*
+ * Nodes with at most TRIE_LEAF_SIZE groups are not split further;		*
+ * their groups are checked one by one with rackFits.					*
+ ************************************************************************/
+void buildSubAnagramIndex(SubAnagramIndex *index, AryElement *ary, int aryLen)
+{
+    static const char letterOrder[] = "esiarntolcdupmghbyfvkwzxqj";
+    SignatureKernel kernel = selectSignatureKernel();
+    TrieEntry *entries = malloc((aryLen + 1) * sizeof(TrieEntry));
+    Signature sig;
+    int g, level;
+    
+    index->groups = malloc((aryLen + 1) * sizeof(int));
+    index->keys = malloc((aryLen + 1) * sizeof(AnagramKey));
+    if (entries == NULL || index->groups == NULL || index->keys == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (level = 0; level < ALPHABET_SIZE; level++) {
+        index->order[level] = letterOrder[level] - 'a';
+    }
+    index->order[ALPHABET_SIZE] = ALPHABET_SIZE;
+    index->ary = ary;
+    index->nbrGroups = aryLen;
+    index->nodes = NULL;
+    index->nbrNodes = 0;
+    index->capacity = 0;
+    
+    for (g = 0; g < aryLen; g++) {
+        kernel(ary[g].head->text, ary[g].head->length, &sig);
+        for (level = 0; level < TRIE_LEVELS; level++) {
+            entries[g].counts[level] = sig.count[index->order[level]];
+        }
+        entries[g].counts[TRIE_LEVELS] = 0;
+        entries[g].group = g;
+    }
+    qsort(entries, aryLen, sizeof(TrieEntry), compareTrieEntries);
+    for (g = 0; g < aryLen; g++) {
+        index->groups[g] = entries[g].group;
+        kernel(ary[entries[g].group].head->text, ary[entries[g].group].head->length, &sig);
+        computeAnagramKey(&sig, &index->keys[g]);
+    }
+    
+    if (aryLen > 0) {
+        addTrieNodes(index, 1);
+        index->nodes[0].count = 0;
+        index->nodes[0].start = 0;
+        index->nodes[0].end = aryLen;
+        buildTrieNode(index, entries, 0, 0);
+    }
+    free(entries);
+}
+
+/************************************************************************
+ * Appends nbrNodes nodes to the trie and returns the position of the	*
+ * first one. The node array may move, so nodes are referred to by		*
+ * position while the trie is built.									*
+ ************************************************************************/
+int addTrieNodes(SubAnagramIndex *index, int nbrNodes)
+{
+    int first = index->nbrNodes;
+    
+    if (index->nbrNodes + nbrNodes > index->capacity) {
+        index->capacity = (index->capacity == 0) ? 1024 : 2 * index->capacity;
+        if (index->capacity < index->nbrNodes + nbrNodes) {
+            index->capacity = index->nbrNodes + nbrNodes;
+        }
+        index->nodes = realloc(index->nodes, index->capacity * sizeof(TrieNode));
+        if (index->nodes == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    index->nbrNodes += nbrNodes;
+    return first;
+}
+
+/************************************************************************
+ * Splits the groups of a trie node at the given level into one child	*
+ * per distinct count of the level's letter, then splits the children.	*
+ * The entries of the node's range are sorted, so each child is a run.	*
+ ************************************************************************/
+void buildTrieNode(SubAnagramIndex *index, TrieEntry *entries, int nodeNo, int level)
+{
+    int start = index->nodes[nodeNo].start;
+    int end = index->nodes[nodeNo].end;
+    int nbrChildren = 1, first, child, i;
+    
+    index->nodes[nodeNo].nbrChildren = 0;
+    index->nodes[nodeNo].firstChild = 0;
+    if (end - start <= TRIE_LEAF_SIZE || level == TRIE_LEVELS) {
+        return;
+    }
+    for (i = start + 1; i < end; i++) {
+        if (entries[i].counts[level] != entries[i-1].counts[level]) {
+            nbrChildren++;
+        }
+    }
+    
+    first = addTrieNodes(index, nbrChildren);
+    index->nodes[nodeNo].nbrChildren = nbrChildren;
+    index->nodes[nodeNo].firstChild = first;
+    child = first;
+    index->nodes[child].start = start;
+    index->nodes[child].count = entries[start].counts[level];
+    for (i = start + 1; i < end; i++) {
+        if (entries[i].counts[level] != entries[i-1].counts[level]) {
+            index->nodes[child].end = i;
+            child++;
+            index->nodes[child].start = i;
+            index->nodes[child].count = entries[i].counts[level];
+        }
+    }
+    index->nodes[child].end = end;
+    
+    for (child = first; child < first + nbrChildren; child++) {
+        buildTrieNode(index, entries, child, level + 1);
+    }
+}
+
+/************************************************************************
+ * Frees the memory of a SubAnagramIndex, but not the indexed array.	*
+ ************************************************************************/
+void freeSubAnagramIndex(SubAnagramIndex *index)
+{
+    free(index->nodes);
+    free(index->groups);
+    free(index->keys);
+}
+
+/************************************************************************
+ * Sets up a rack query from the letters of a line.						*
+ ************************************************************************/
+void initRack(SubAnagramIndex *index, Rack *rack, char *letters, int length)
+{
+    int counts[ALPHABET_SIZE + 1];
+    int i;
+    
+    rack->letters = letters;
+    rack->length = length;
+    if (length < LONG_WORD) {
+        computeSignature(letters, length, &rack->sig);
+    } else {
+        memset(&rack->sig, 0, sizeof(Signature));
+        countLetters(letters, length, counts);
+        for (i = 0; i <= ALPHABET_SIZE; i++) {
+            rack->sig.count[i] = (counts[i] > 255) ? 255 : counts[i];
+        }
+    }
+    for (i = 0; i < TRIE_LEVELS; i++) {
+        rack->count[i] = rack->sig.count[index->order[i]];
+    }
+    rack->key.lo = 0;
+    rack->key.hi = 0;
+    for (i = 0; i < ALPHABET_SIZE; i++) {
+        uint64_t nibble = (rack->sig.count[i] > 15) ? 15 : rack->sig.count[i];
+    
+        if (i < 16) {
+            rack->key.lo |= nibble << (4 * i);
+        } else {
+            rack->key.hi |= nibble << (4 * (i - 16));
+        }
+    }
+}
+
+/************************************************************************
+ * Adds to found every group below a trie node that can be spelled from	*
+ * the rack. Children are in increasing order of count, so the first	*
+ * child needing more copies of the level's letter than the rack has	*
+ * ends the loop, and with it every later subtree.						*
+ ************************************************************************/
+void searchSubAnagrams(SubAnagramIndex *index, Rack *rack, int nodeNo, int level, GroupList *found)
+{
+    TrieNode *node = &index->nodes[nodeNo];
+    int i;
+    
+    if (node->nbrChildren == 0) {
+        for (i = node->start; i < node->end; i++) {
+            if (rackFits(index, rack, i)) {
+                appendGroup(found, index->groups[i]);
+            }
+        }
+        return;
+    }
+    for (i = node->firstChild; i < node->firstChild + node->nbrChildren; i++) {
+        if (index->nodes[i].count > rack->count[level]) {
+            break;
+        }
+        searchSubAnagrams(index, rack, i, level + 1, found);
+    }
+}
+
+/************************************************************************
+ * Returns true if the words of an entry of the sorted group array can	*
+ * be spelled from the rack. Keys hold 4-bit letter counts, so the test	*
+ * is two nibble-wise comparisons of 64-bit words (see nibblesFit). The	*
+ * rack's counts are capped at 15 in its key, which is exact because no	*
+ * count of a word key is above 15; words whose keys overflowed are		*
+ * checked byte by byte (by their exact counts for words of LONG_WORD	*
+ * letters or more), and their characters other than 'a'..'z' one by	*
+ * one.																	*
+ ************************************************************************/
+bool rackFits(SubAnagramIndex *index, Rack *rack, int entry)
+{
+    AnagramKey *key = &index->keys[entry];
+    int counts[ALPHABET_SIZE + 1], rackCounts[ALPHABET_SIZE + 1];
+    int others[256], rackOthers[256];
+    Node *head;
+    Signature sig;
+    int i;
+    
+    if ((key->hi & KEY_OVERFLOW) == 0) {
+        return nibblesFit(key->lo, rack->key.lo)
+            && nibblesFit(key->hi & 0xFFFFFFFFFFull, rack->key.hi & 0xFFFFFFFFFFull);
+    }
+    head = index->ary[index->groups[entry]].head;
+    if (head->length >= LONG_WORD) {
+        if (head->length > rack->length) {
+            return false;
+        }
+        countLetters(head->text, head->length, counts);
+        countLetters(rack->letters, rack->length, rackCounts);
+    } else {
+        computeSignature(head->text, head->length, &sig);
+        for (i = 0; i <= ALPHABET_SIZE; i++) {
+            counts[i] = sig.count[i];
+            rackCounts[i] = rack->sig.count[i];
+        }
+    }
+    for (i = 0; i <= ALPHABET_SIZE; i++) {
+        if (counts[i] > rackCounts[i]) {
+            return false;
+        }
+    }
+    if (counts[ALPHABET_SIZE] == 0) {
+        return true;
+    }
+    countOtherCharacters(head->text, head->length, others);
+    countOtherCharacters(rack->letters, rack->length, rackOthers);
+    for (i = 0; i < 256; i++) {
+        if (others[i] > rackOthers[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/************************************************************************
+ * Returns true if every 4-bit count in word is at most the count in	*
+ * the same place in rack. The even and odd nibbles are spread into		*
+ * bytes; setting the top bit of every rack byte and subtracting the	*
+ * word bytes then clears a top bit exactly where the word count is		*
+ * larger.																*
+ ************************************************************************/
+bool nibblesFit(uint64_t word, uint64_t rack)
+{
+    const uint64_t low = 0x0F0F0F0F0F0F0F0Full;
+    const uint64_t high = 0x8080808080808080ull;
+    
+    return (((((rack & low) | high) - (word & low))
+            & (((rack >> 4 & low) | high) - (word >> 4 & low))) & high) == high;
+}
+
+/************************************************************************
+ * qsort comparison of trie entries: by counts in trie order, then by	*
+ * group number.														*
+ ************************************************************************/
+int compareTrieEntries(const void *a, const void *b)
+{
+    const TrieEntry *entry1 = a, *entry2 = b;
+    int diff = memcmp(entry1->counts, entry2->counts, TRIE_LEVELS);
+    
+    if (diff != 0) {
+        return diff;
+    }
+    return (entry1->group > entry2->group) - (entry1->group < entry2->group);
+}
+
+/************************************************************************
+ * qsort comparison of ints in increasing order.						*
+ ************************************************************************/
+int compareInts(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    
+    return (x > y) - (x < y);
+}
+
+/************************************************************************
+ * Appends a group number to a list.									*
+ ************************************************************************/
+void appendGroup(GroupList *list, int group)
+{
+    if (list->count == list->capacity) {
+        list->capacity = (list->capacity == 0) ? 64 : 2 * list->capacity;
+        list->groups = realloc(list->groups, list->capacity * sizeof(int));
+        if (list->groups == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->groups[list->count++] = group;
+}
+
+/************************************************************************
+ * Reads phrases, one per line, from phraseFile and writes every way to	*
+ * spell the letters of each phrase (upper case counts as lower case,	*
+ * other characters are ignored) as one to maxWords dictionary words to	*
+ * outfile: one answer per line, each word followed by a space as in	*
+ * the other outputs, and an empty line after the answers to a phrase.	*
+ * The words of an answer come longest first. The dictionary classes	*
+ * that fit the phrase are found with the histogram trie of --racks;	*
+ * nbrThreads threads then search from different first words while the	*
+ * calling thread writes the answers of each first word, in order, as	*
+ * soon as they are complete. Phrases of more than PHRASE_MAX_LETTERS	*
+ * letters get no answers. Either file name may be - for stdin or		*
+ * stdout.																*
+ ************************************************************************/
+void answerPhrases(char *phraseFile, char *outfile, AryElement *ary, int aryLen, int nbrThreads, int maxWords)
+{
+    FILE *fp = (strcmp(phraseFile, "-") == 0) ? stdin : fopen(phraseFile, "r");
+    int fd = openOutputFile(outfile);
+    PhraseWorker *workers = calloc(nbrThreads, sizeof(PhraseWorker));
+    pthread_t *threads = malloc(nbrThreads * sizeof(pthread_t));
+    SubAnagramIndex index;
+    GroupList found = {NULL, 0, 0};
+    PhraseSearch search;
+    OutputBuffer out;
+    Rack rack;
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t len;
+    int nbrLetters, nbrWorkers, i, t;
+    
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", phraseFile);
+        exit(EXIT_FAILURE);
+    }
+    if (workers == NULL || threads == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    buildSubAnagramIndex(&index, ary, aryLen);
+    initOutputBuffer(&out, fd, OUTPUT_BUFFER_SIZE);
+    search.ary = ary;
+    search.candidates = NULL;
+    search.maxWords = maxWords;
+    pthread_mutex_init(&search.lock, NULL);
+    pthread_cond_init(&search.taskDone, NULL);
+    for (i = 0; i < nbrThreads; i++) {
+        workers[i].search = &search;
+        workers[i].chosen = malloc(maxWords * sizeof(int));
+        workers[i].words = malloc(maxWords * sizeof(Node *));
+        if (workers[i].chosen == NULL || workers[i].words == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    while ((len = getline(&line, &lineCap, fp)) != -1) {
+        nbrLetters = 0;
+        for (i = 0; i < len; i++) {
+            if (line[i] >= 'A' && line[i] <= 'Z') {
+                line[nbrLetters++] = line[i] - 'A' + 'a';
+            } else if (line[i] >= 'a' && line[i] <= 'z') {
+                line[nbrLetters++] = line[i];
+            }
+        }
+        found.count = 0;
+        if (nbrLetters > 0 && nbrLetters <= PHRASE_MAX_LETTERS && index.nbrNodes > 0) {
+            initRack(&index, &rack, line, nbrLetters);
+            searchSubAnagrams(&index, &rack, 0, 0, &found);
+        }
+        
+        search.candidates = realloc(search.candidates, (found.count + 1) * sizeof(PhraseCandidate));
+        search.outputs = calloc(found.count + 1, sizeof(PhraseOutput));
+        if (search.candidates == NULL || search.outputs == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < found.count; i++) {
+            search.candidates[i].group = found.groups[i];
+            search.candidates[i].length = ary[found.groups[i]].head->length;
+            computeSignature(ary[found.groups[i]].head->text, search.candidates[i].length,
+                             &search.candidates[i].sig);
+        }
+        qsort(search.candidates, found.count, sizeof(PhraseCandidate), comparePhraseCandidates);
+        search.nbrCandidates = found.count;
+        computeSignature(line, nbrLetters, &search.letters);
+        search.nbrLetters = nbrLetters;
+        search.nextTask = 0;
+        
+        nbrWorkers = (nbrThreads < found.count) ? nbrThreads : found.count;
+        for (t = 0; t < nbrWorkers; t++) {
+            if (pthread_create(&threads[t], NULL, phraseWorker, &workers[t]) != 0) {
+                fprintf(stderr,"Error creating thread\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (i = 0; i < found.count; i++) {
+            pthread_mutex_lock(&search.lock);
+            while (!search.outputs[i].done) {
+                pthread_cond_wait(&search.taskDone, &search.lock);
+            }
+            pthread_mutex_unlock(&search.lock);
+            if (search.outputs[i].length > 0) {
+                writeOutput(&out, search.outputs[i].data, search.outputs[i].length);
+            }
+            free(search.outputs[i].data);
+        }
+        for (t = 0; t < nbrWorkers; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        writeOutput(&out, "\n", 1);
+        free(search.outputs);
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    for (i = 0; i < nbrThreads; i++) {
+        free(workers[i].memo.entries);
+        free(workers[i].lists);
+        free(workers[i].chosen);
+        free(workers[i].words);
+    }
+    pthread_mutex_destroy(&search.lock);
+    pthread_cond_destroy(&search.taskDone);
+    free(search.candidates);
+    free(workers);
+    free(threads);
+    free(found.groups);
+    free(line);
+    freeSubAnagramIndex(&index);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * Body of a phrase search thread (arg is its PhraseWorker): takes the	*
+ * next first word until there are none left and finds every answer		*
+ * that starts with it. Dead ends are remembered for the whole phrase,	*
+ * as the same letters are often left over after different words.		*
+ ************************************************************************/
+void *phraseWorker(void *arg)
+{
+    PhraseWorker *worker = arg;
+    PhraseSearch *search = worker->search;
+    int n = search->nbrCandidates;
+    int t;
+    
+    worker->lists = realloc(worker->lists, (size_t)search->maxWords * n * sizeof(int));
+    if (worker->lists == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (t = 0; t < n; t++) {
+        worker->lists[t] = t;
+    }
+    clearPhraseMemo(&worker->memo);
+    
+    while ((t = __atomic_fetch_add(&search->nextTask, 1, __ATOMIC_RELAXED)) < n) {
+        extendPhrase(worker, &search->letters, search->nbrLetters, worker->lists + t, n - t, 1, 0,
+                     &search->outputs[t]);
+        pthread_mutex_lock(&search->lock);
+        search->outputs[t].done = true;
+        pthread_cond_broadcast(&search->taskDone);
+        pthread_mutex_unlock(&search->lock);
+    }
+    return NULL;
+}
+
+/************************************************************************
+ * Finds the answers whose first depth words are worker->chosen and		*
+ * whose other words spell exactly the letters left, and writes them to	*
+ * out. The next word is one of the first nbrChoices entries of list;	*
+ * the entries of list are the candidates that fit the letters left, in	*
+ * candidate order. Returns whether there was any answer.				*
+ * Prunes the words after a choice by what still fits (a word fits		*
+ * when no letter count is higher than in the letters left), by length	*
+ * (the words after it are no longer than it), and by the dead ends in	*
+ * the worker's memo.													*
+ ************************************************************************/
+bool extendPhrase(PhraseWorker *worker, Signature *letters, int nbrLetters, int *list, int listLen,
+                  int nbrChoices, int depth, PhraseOutput *out)
+{
+    PhraseSearch *search = worker->search;
+    PhraseCandidate *candidate;
+    Signature rest;
+    int *next = worker->lists + (size_t)(depth + 1) * search->nbrCandidates;
+    int wordsLeft = search->maxWords - depth - 1;
+    int nbrLeft, nbrNext, p, q, k;
+    bool found = false;
+    
+    for (p = 0; p < nbrChoices; p++) {
+        candidate = &search->candidates[list[p]];
+        nbrLeft = nbrLetters - candidate->length;
+        if (nbrLeft < 0 || !signatureFits(&candidate->sig, letters)) {
+            continue;
+        }
+        worker->chosen[depth] = list[p];
+        if (nbrLeft == 0) {
+            writePhraseAnswers(worker, depth + 1, 0, out);
+            found = true;
+            continue;
+        }
+        if (wordsLeft == 0 || nbrLeft > wordsLeft * candidate->length) {
+            continue;
+        }
+        for (k = 0; k < SIGNATURE_BYTES / 8; k++) {
+            rest.word[k] = letters->word[k] - candidate->sig.word[k];
+        }
+        if (isPhraseDeadEnd(&worker->memo, &rest, list[p], wordsLeft)) {
+            continue;
+        }
+        
+        nbrNext = 0;
+        for (q = p; q < listLen; q++) {
+            if (search->candidates[list[q]].length <= nbrLeft
+                    && signatureFits(&search->candidates[list[q]].sig, &rest)) {
+                next[nbrNext++] = list[q];
+            }
+        }
+        if (extendPhrase(worker, &rest, nbrLeft, next, nbrNext, nbrNext, depth + 1, out)) {
+            found = true;
+        } else {
+            addPhraseDeadEnd(&worker->memo, &rest, list[p], wordsLeft);
+        }
+    }
+    return found;
+}
+
+/************************************************************************
+ * Returns whether every letter count of word is at most the count in	*
+ * letters. Counts stay below 128, so subtracting the counts of word	*
+ * from those of letters with the top bit of every byte set leaves that	*
+ * bit set exactly in the bytes where word fits.						*
+ ************************************************************************/
+bool signatureFits(Signature *word, Signature *letters)
+{
+    const uint64_t high = 0x8080808080808080ull;
+    int k;
+    
+    for (k = 0; k < SIGNATURE_BYTES / 8; k++) {
+        if ((((letters->word[k] | high) - word->word[k]) & high) != high) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/************************************************************************
+ * Writes every answer made of the classes in worker->chosen[0] up to	*
+ * worker->chosen[nbrWords-1], picking the words from level on. A class	*
+ * chosen twice in a row takes its words in list order, so each set of	*
+ * words is written once.												*
+ ************************************************************************/
+void writePhraseAnswers(PhraseWorker *worker, int nbrWords, int level, PhraseOutput *out)
+{
+    PhraseSearch *search = worker->search;
+    Node *node;
+    int i;
+    
+    if (level == nbrWords) {
+        for (i = 0; i < nbrWords; i++) {
+            appendPhraseText(out, worker->words[i]->text, worker->words[i]->length);
+            appendPhraseText(out, " ", 1);
+        }
+        appendPhraseText(out, "\n", 1);
+        return;
+    }
+    if (level > 0 && worker->chosen[level] == worker->chosen[level-1]) {
+        node = worker->words[level-1];
+    } else {
+        node = search->ary[search->candidates[worker->chosen[level]].group].head;
+    }
+    for (; node != NULL; node = node->next) {
+        worker->words[level] = node;
+        writePhraseAnswers(worker, nbrWords, level + 1, out);
+    }
+}
+
+/************************************************************************
+ * Appends length bytes of text to the answers of one first word.		*
+ ************************************************************************/
+void appendPhraseText(PhraseOutput *out, char *text, size_t length)
+{
+    if (out->length + length > out->capacity) {
+        out->capacity = (out->capacity == 0) ? 4096 : 2 * out->capacity;
+        if (out->capacity < out->length + length) {
+            out->capacity = out->length + length;
+        }
+        out->data = realloc(out->data, out->capacity);
+        if (out->data == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+}
+
+/************************************************************************
+ * Empties a memo of dead ends, keeping its memory.						*
+ ************************************************************************/
+void clearPhraseMemo(PhraseMemo *memo)
+{
+    if (memo->used > 0) {
+        memset(memo->entries, 0, memo->capacity * sizeof(PhraseMemoEntry));
+        memo->used = 0;
+    }
+}
+
+/************************************************************************
+ * Returns the slot of the memo that holds letters and start, or the	*
+ * empty slot where they belong.										*
+ ************************************************************************/
+PhraseMemoEntry *findPhraseMemoEntry(PhraseMemo *memo, Signature *letters, int start)
+{
+    uint64_t hash = (letters->word[0] * 0x9E3779B97F4A7C15ull ^ letters->word[1] * 0xC2B2AE3D27D4EB4Full
+                     ^ letters->word[2] * 0x165667B19E3779F9ull ^ (uint64_t)start * 0xD6E8FEB86659FD93ull);
+    int i = (int)(hash >> 32) & (memo->capacity - 1);
+    PhraseMemoEntry *entry;
+    
+    for (;;) {
+        entry = &memo->entries[i];
+        if (entry->wordsLeft == 0 || (entry->start == start && entry->sig.word[0] == letters->word[0]
+                && entry->sig.word[1] == letters->word[1] && entry->sig.word[2] == letters->word[2]
+                && entry->sig.word[3] == letters->word[3])) {
+            return entry;
+        }
+        i = (i + 1) & (memo->capacity - 1);
+    }
+}
+
+/************************************************************************
+ * Returns whether the memo knows that no answer spells letters with at	*
+ * most wordsLeft candidates from start on. A dead end with more words	*
+ * left is a dead end with fewer too.									*
+ ************************************************************************/
+bool isPhraseDeadEnd(PhraseMemo *memo, Signature *letters, int start, int wordsLeft)
+{
+    if (memo->used == 0) {
+        return false;
+    }
+    return findPhraseMemoEntry(memo, letters, start)->wordsLeft >= wordsLeft;
+}
+
+/************************************************************************
+ * Remembers a dead end (see isPhraseDeadEnd). The memo doubles when it	*
+ * is half full and stops taking new entries at PHRASE_MEMO_LIMIT.		*
+ ************************************************************************/
+void addPhraseDeadEnd(PhraseMemo *memo, Signature *letters, int start, int wordsLeft)
+{
+    PhraseMemoEntry *old, *entry;
+    int oldCapacity = memo->capacity, i;
+    
+    if (2 * (memo->used + 1) > memo->capacity) {
+        if (memo->capacity >= PHRASE_MEMO_LIMIT) {
+            return;
+        }
+        old = memo->entries;
+        memo->capacity = (oldCapacity == 0) ? 1024 : 2 * oldCapacity;
+        memo->entries = calloc(memo->capacity, sizeof(PhraseMemoEntry));
+        if (memo->entries == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < oldCapacity; i++) {
+            if (old[i].wordsLeft > 0) {
+                *findPhraseMemoEntry(memo, &old[i].sig, old[i].start) = old[i];
+            }
+        }
+        free(old);
+    }
+    entry = findPhraseMemoEntry(memo, letters, start);
+    if (entry->wordsLeft == 0) {
+        entry->sig = *letters;
+        entry->start = start;
+        memo->used++;
+    }
+    if (wordsLeft > entry->wordsLeft) {
+        entry->wordsLeft = wordsLeft;
+    }
+}
+
+/************************************************************************
+ * qsort comparison of phrase candidates: longest first, then by group	*
+ * number.																*
+ ************************************************************************/
+int comparePhraseCandidates(const void *a, const void *b)
+{
+    const PhraseCandidate *x = a, *y = b;
+    
+    if (x->length != y->length) {
+        return y->length - x->length;
+    }
+    return (x->group > y->group) - (x->group < y->group);
+}
+
+/************************************************************************
+ * Reads query words, one per line, from queryFile and writes for each	*
+ * one the groups of ary that are one letter away from being its		*
+ * anagrams, as one line: every group is written as its change and its	*
+ * words, each followed by a space; "+c" means the group has one more	*
+ * c, "-c" one c less and "c>d" a d in place of a c. Additions come		*
+ * first, then for each letter of the word, in alphabetical order, its	*
+ * removal and its substitutions. Either file name may be - for stdin	*
+ * or stdout.															*
+ ************************************************************************/
+void answerNearAnagrams(char *queryFile, char *outfile, AryElement *ary, int aryLen)
+{
+    FILE *fp = (strcmp(queryFile, "-") == 0) ? stdin : fopen(queryFile, "r");
+    int fd = openOutputFile(outfile);
+    NearAnagram found[NEAR_ANAGRAMS_MAX];
+    NearIndex index;
+    OutputBuffer out;
+    Signature sig;
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t len;
+    int nbrFound, i;
+    
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", queryFile);
+        exit(EXIT_FAILURE);
+    }
+    buildNearIndex(&index, ary, aryLen);
+    initOutputBuffer(&out, fd, OUTPUT_BUFFER_SIZE);
+    
+    while ((len = getline(&line, &lineCap, fp)) != -1) {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+            len--;
+        }
+        if (len > 0) {
+            computeSignature(line, len, &sig);
+            nbrFound = findNearAnagrams(&index, line, len, &sig, found);
+            prefetchNearAnagrams(found, nbrFound, ary);
+            for (i = 0; i < nbrFound; i++) {
+                writeNearAnagram(&out, &found[i], ary);
+            }
+        }
+        writeOutput(&out, "\n", 1);
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    free(line);
+    freeNearIndex(&index);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * Writes every pair of groups of ary that are one letter away from		*
+ * being anagrams of each other to outfile, one pair per line: the		*
+ * words of the first group, then the change and the words of the		*
+ * second group as answerNearAnagrams writes them. Each pair is written	*
+ * once: from the group without the letter for an addition, and from	*
+ * the group that comes first in ary for a substitution. Pairs are in	*
+ * the order of their first group.										*
+ ************************************************************************/
+void writeNearAnagramPairs(char *outfile, AryElement *ary, int aryLen)
+{
+    int fd = openOutputFile(outfile);
+    NearAnagram found[NEAR_ANAGRAMS_MAX];
+    NearIndex index;
+    OutputBuffer out;
+    Signature sig;
+    Node *node;
+    int nbrFound, g, i;
+    
+    buildNearIndex(&index, ary, aryLen);
+    initOutputBuffer(&out, fd, OUTPUT_BUFFER_SIZE);
+    for (g = 0; g < aryLen; g++) {
+        computeSignature(ary[g].head->text, ary[g].head->length, &sig);
+        nbrFound = findNearAnagrams(&index, ary[g].head->text, ary[g].head->length, &sig, found);
+        prefetchNearAnagrams(found, nbrFound, ary);
+        for (i = 0; i < nbrFound; i++) {
+            if (found[i].added < 0 || (found[i].removed >= 0 && found[i].group < g)) {
+                continue;
+            }
+            for (node = ary[g].head; node != NULL; node = node->next) {
+                writeOutput(&out, node->text, node->length);
+                writeOutput(&out, " ", 1);
+            }
+            writeNearAnagram(&out, &found[i], ary);
+            writeOutput(&out, "\n", 1);
+        }
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    freeNearIndex(&index);
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * Prefetches the first words of the groups in found, which are about	*
+ * to be written: the array entries first, then the head nodes, then	*
+ * their text, so that the cache misses of all the groups overlap.		*
+ ************************************************************************/
+void prefetchNearAnagrams(NearAnagram *found, int nbrFound, AryElement *ary)
+{
+    int i;
+    
+    for (i = 0; i < nbrFound; i++) {
+        __builtin_prefetch(&ary[found[i].group]);
+    }
+    for (i = 0; i < nbrFound; i++) {
+        __builtin_prefetch(ary[found[i].group].head);
+    }
+    for (i = 0; i < nbrFound; i++) {
+        __builtin_prefetch(ary[found[i].group].head->text);
+    }
+}
+
+/************************************************************************
+ * Writes one near anagram: its change, then its words, each followed	*
+ * by a space.															*
+ ************************************************************************/
+void writeNearAnagram(OutputBuffer *out, NearAnagram *near, AryElement *ary)
+{
+    char change[4];
+    int length = 0;
+    Node *node;
+    
+    if (near->added < 0) {
+        change[length++] = '-';
+        change[length++] = 'a' + near->removed;
+    } else if (near->removed < 0) {
+        change[length++] = '+';
+        change[length++] = 'a' + near->added;
+    } else {
+        change[length++] = 'a' + near->removed;
+        change[length++] = '>';
+        change[length++] = 'a' + near->added;
+    }
+    change[length++] = ' ';
+    writeOutput(out, change, length);
+    for (node = ary[near->group].head; node != NULL; node = node->next) {
+        writeOutput(out, node->text, node->length);
+        writeOutput(out, " ", 1);
+    }
+}
+
+/************************************************************************
+ * Builds the key table of a NearIndex over the groups of ary. The		*
+ * table is at most half full.											*
+ ************************************************************************/
+void buildNearIndex(NearIndex *index, AryElement *ary, int aryLen)
+{
+    SignatureKernel kernel = selectSignatureKernel();
+    Signature sig;
+    unsigned int hash;
+    int g;
+    
+    index->ary = ary;
+    index->capacity = 16;
+    while (index->capacity < 2 * (unsigned int)aryLen) {
+        index->capacity *= 2;
+    }
+    index->keys = malloc((aryLen + 1) * sizeof(AnagramKey));
+    index->slots = calloc(index->capacity, sizeof(int));
+    if (index->keys == NULL || index->slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (g = 0; g < aryLen; g++) {
+        kernel(ary[g].head->text, ary[g].head->length, &sig);
+        computeAnagramKey(&sig, &index->keys[g]);
+        hash = hashAnagramKey(&index->keys[g]) & (index->capacity - 1);
+        while (index->slots[hash] != 0) {
+            hash = (hash + 1) & (index->capacity - 1);
+        }
+        index->slots[hash] = g + 1;
+    }
+}
+
+/************************************************************************
+ * Frees the memory of a NearIndex, but not the indexed array.			*
+ ************************************************************************/
+void freeNearIndex(NearIndex *index)
+{
+    free(index->keys);
+    free(index->slots);
+}
+
+/************************************************************************
+ * Stores in found every group of the index whose words are one letter	*
+ * added, removed or replaced by another letter away from being			*
+ * anagrams of the first length characters of word, whose signature is	*
+ * sig, and returns how many there are (at most NEAR_ANAGRAMS_MAX).		*
+ * The key of each neighbour is the key of sig with one or two 4-bit	*
+ * counts stepped up or down, so it costs an add or two; only counts	*
+ * above 15 need a key computed from the signature. All the neighbours	*
+ * are looked up together, as answerQueries does with a batch: their	*
+ * table slots are prefetched first, then the keys of the groups in		*
+ * those slots, and only then are the keys compared. Words whose		*
+ * neighbours may be LONG_WORD letters or more, and words with			*
+ * characters other than 'a'..'z', go to findLongNearAnagrams.			*
+ ************************************************************************/
+int findNearAnagrams(NearIndex *index, char *word, int length, Signature *sig, NearAnagram *found)
+{
+    AnagramKey base;
+    int nbrNear = 0, nbrFound = 0, removed, added, i;
+    
+    if (length + 1 >= LONG_WORD || sig->count[ALPHABET_SIZE] != 0) {
+        return findLongNearAnagrams(index, word, length, found);
+    }
+    computeAnagramKey(sig, &base);
+    for (removed = -1; removed < ALPHABET_SIZE; removed++) {
+        if (removed >= 0 && sig->count[removed] == 0) {
+            continue;
+        }
+        for (added = -1; added < ALPHABET_SIZE; added++) {
+            if (added == removed) {
+                continue;
+            }
+            found[nbrNear].key = base;
+            if (removed >= 0) {
+                stepNearKey(&found[nbrNear].key, sig, removed, -1);
+            }
+            if (added >= 0) {
+                stepNearKey(&found[nbrNear].key, sig, added, 1);
+                sig->count[added]--;
+            }
+            if (removed >= 0) {
+                sig->count[removed]++;
+            }
+            found[nbrNear].slot = hashAnagramKey(&found[nbrNear].key) & (index->capacity - 1);
+            found[nbrNear].added = added;
+            found[nbrNear].removed = removed;
+            __builtin_prefetch(&index->slots[found[nbrNear].slot]);
+            nbrNear++;
+        }
+    }
+    
+    for (i = 0; i < nbrNear; i++) {
+        if (index->slots[found[i].slot] != 0) {
+            __builtin_prefetch(&index->keys[index->slots[found[i].slot] - 1]);
+        }
+    }
+    for (i = 0; i < nbrNear; i++) {
+        found[i].group = lookupNearKey(index, &found[i], sig);
+        if (found[i].group >= 0) {
+            found[nbrFound++] = found[i];
+        }
+    }
+    return nbrFound;
+}
+
+/************************************************************************
+ * Same as findNearAnagrams, for words so long that their neighbours	*
+ * may wrap a signature count around, or with characters other than		*
+ * 'a'..'z': every neighbour is made from the exact letter counts of	*
+ * the word, and the groups with its key are confirmed by their exact	*
+ * counts and other characters. This is slower, but such words are		*
+ * rare.																*
+ ************************************************************************/
+int findLongNearAnagrams(NearIndex *index, char *word, int length, NearAnagram *found)
+{
+    int counts[ALPHABET_SIZE + 1], nearCounts[ALPHABET_SIZE + 1], groupCounts[ALPHABET_SIZE + 1];
+    unsigned int mask = index->capacity - 1;
+    NearAnagram *near;
+    Signature nearSig;
+    Node *head;
+    unsigned int i;
+    int nbrFound = 0, removed, added, nearLength, letter, g;
+    
+    countLetters(word, length, counts);
+    for (removed = -1; removed < ALPHABET_SIZE; removed++) {
+        if (removed >= 0 && counts[removed] == 0) {
+            continue;
+        }
+        for (added = -1; added < ALPHABET_SIZE; added++) {
+            if (added == removed) {
+                continue;
+            }
+            memcpy(nearCounts, counts, sizeof(counts));
+            nearLength = length;
+            if (removed >= 0) {
+                nearCounts[removed]--;
+                nearLength--;
+            }
+            if (added >= 0) {
+                nearCounts[added]++;
+                nearLength++;
+            }
+            memset(&nearSig, 0, sizeof(Signature));
+            for (letter = 0; letter <= ALPHABET_SIZE; letter++) {
+                nearSig.count[letter] = (unsigned char)nearCounts[letter];
+            }
+            if (nearLength >= LONG_WORD) {
+                markLongSignature(&nearSig, nearCounts);
+            }
+            if (nearCounts[ALPHABET_SIZE] != 0) {
+                markOtherCharacters(&nearSig, word, length);
+            }
+            
+            near = &found[nbrFound];
+            computeAnagramKey(&nearSig, &near->key);
+            near->slot = hashAnagramKey(&near->key) & mask;
+            near->added = added;
+            near->removed = removed;
+            near->group = -1;
+            for (i = near->slot; index->slots[i] != 0 && near->group < 0; i = (i + 1) & mask) {
+                g = index->slots[i] - 1;
+                head = index->ary[g].head;
+                if (index->keys[g].lo != near->key.lo || index->keys[g].hi != near->key.hi
+                        || head->length != nearLength) {
+                    continue;
+                }
+                countLetters(head->text, head->length, groupCounts);
+                if (memcmp(groupCounts, nearCounts, sizeof(groupCounts)) == 0
+                        && (nearCounts[ALPHABET_SIZE] == 0
+                            || sameOtherCharacters(head->text, head->length, word, length))) {
+                    near->group = g;
+                }
+            }
+            if (near->group >= 0) {
+                nbrFound++;
+            }
+        }
+    }
+    return nbrFound;
+}
+
+/************************************************************************
+ * Adds step (1 or -1) to the count of letter in sig and updates its	*
+ * key to match: in place while every count stays in 0..15, otherwise	*
+ * by computing the key from the signature.								*
+ ************************************************************************/
+void stepNearKey(AnagramKey *key, Signature *sig, int letter, int step)
+{
+    uint64_t unit = (uint64_t)1 << (4 * (letter % 16));
+    bool inPlace = (key->hi & KEY_OVERFLOW) == 0 && sig->count[letter] + step <= 15;
+    
+    sig->count[letter] += step;
+    if (!inPlace) {
+        computeAnagramKey(sig, key);
+    } else if (letter < 16) {
+        key->lo += (step > 0) ? unit : -unit;
+    } else {
+        key->hi += (step > 0) ? unit : -unit;
+    }
+}
+
+/************************************************************************
+ * Returns the group of the index with the key of near, or -1 if there	*
+ * is none; sig is the signature near was derived from. Keys of			*
+ * signatures with a count above 15 are only hashes, so for those the	*
+ * signature of the group is compared with that of near.				*
+ ************************************************************************/
+int lookupNearKey(NearIndex *index, NearAnagram *near, Signature *sig)
+{
+    unsigned int i = near->slot;
+    Node *head;
+    Signature nearSig, groupSig;
+    int g;
+    
+    for (; index->slots[i] != 0; i = (i + 1) & (index->capacity - 1)) {
+        g = index->slots[i] - 1;
+        if (index->keys[g].lo != near->key.lo || index->keys[g].hi != near->key.hi) {
+            continue;
+        }
+        if ((near->key.hi & KEY_OVERFLOW) == 0) {
+            return g;
+        }
+        nearSig = *sig;
+        if (near->added >= 0) {
+            nearSig.count[near->added]++;
+        }
+        if (near->removed >= 0) {
+            nearSig.count[near->removed]--;
+        }
+        head = index->ary[g].head;
+        computeSignature(head->text, head->length, &groupSig);
+        if (signaturesEqual(&groupSig, &nearSig)) {
+            return g;
+        }
+    }
+    return -1;
+}
+
+/************************************************************************
+ * Groups the words of infile, applies the delta in deltaFile to the	*
+ * groups in memory and writes the changed groups to outfile (see		*
+ * writeChanges).														*
+ ************************************************************************/
+void updateAnagramArray(char *deltaFile, char *infile, char *outfile)
+{
+    ArrayBuilder builder;
+    ChangeList changes = {NULL, 0, 0};
+    AryElement *ary;
+    int aryLen;
+    
+    initArrayBuilder(&builder);
+    addFileLines(&builder, infile);
+    applyDeltaFile(&builder, deltaFile, &changes, NULL, NULL);
+    writeChanges(&builder, &changes, outfile);
+    
+    ary = finishArrayBuilder(&builder, &aryLen);
+    freeAnagramArray(ary, aryLen);
+    free(changes.changes);
+}
+
+/************************************************************************
+ * Applies the delta in deltaFile to an index file and writes the		*
+ * changed groups to outfile (see writeChanges). Only the groups the	*
+ * delta touches are read from the index: they are loaded into a		*
+ * builder, together with the groups of the index's current overlay,	*
+ * the delta is applied there, and the builder's groups become the new	*
+ * overlay. The cost thus depends on the size of the deltas applied so	*
+ * far, not on the size of the dictionary. New overlays are appended to	*
+ * the file, so processes that have the index mapped keep a consistent	*
+ * view; once the old overlays take more room than the base groups the	*
+ * index is rewritten with the overlay merged in.						*
+ ************************************************************************/
+void updateAnagramIndex(char *indexFile, char *deltaFile, char *outfile)
+{
+    AnagramIndex index;
+    ArrayBuilder builder;
+    ChangeList changes = {NULL, 0, 0};
+    GroupList replaces = {NULL, 0, 0};
+    AryElement *ary;
+    int aryLen;
+    uint64_t g;
+    
+    if (!openAnagramIndex(indexFile, &index)) {
+        fprintf(stderr,"Cannot update index %s\n", indexFile);
+        exit(EXIT_FAILURE);
+    }
+    initArrayBuilder(&builder);
+    for (g = 0; g < index.overlay.nbrGroups; g++) {
+        addIndexGroup(&builder, &index.overlay, g);
+        appendGroup(&replaces, index.replaces[g]);
+    }
+    
+    applyDeltaFile(&builder, deltaFile, &changes, &index, &replaces);
+    writeChanges(&builder, &changes, outfile);
+    
+    if (index.header->fileSize - index.header->baseEnd > index.header->baseEnd) {
+        rewriteAnagramIndex(indexFile, &index, &builder, &replaces);
+    } else {
+        appendIndexOverlay(indexFile, &index, &builder, &replaces);
+    }
+    
+    ary = finishArrayBuilder(&builder, &aryLen);
+    freeAnagramArray(ary, aryLen);
+    free(changes.changes);
+    free(replaces.groups);
+    closeAnagramIndex(&index);
+}
+
+/************************************************************************
+ * Applies every line of a delta file (- for stdin) to the groups of a	*
+ * builder: +word adds a word unless it is already there and -word		*
+ * removes one occurrence of it. Blank lines are skipped and removing a	*
+ * missing word only warns. If											*
+ * index is not NULL, the index group of each word is loaded into the	*
+ * builder first and replaces records, for every group of the builder,	*
+ * the base group it replaces (or -1).									*
+ ************************************************************************/
+void applyDeltaFile(ArrayBuilder *builder, char *deltaFile, ChangeList *changes, AnagramIndex *index, GroupList *replaces)
+{
+    FILE *fp = (strcmp(deltaFile, "-") == 0) ? stdin : fopen(deltaFile, "r");
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t len;
+    int lineNo = 0;
+    
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", deltaFile);
+        exit(EXIT_FAILURE);
+    }
+    while ((len = getline(&line, &lineCap, fp)) != -1) {
+        lineNo++;
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+            len--;
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (len < 2 || (line[0] != '+' && line[0] != '-')) {
+            fprintf(stderr,"Bad line %d in delta file %s\n", lineNo, deltaFile);
+            exit(EXIT_FAILURE);
+        }
+        if (index != NULL) {
+            loadIndexGroup(builder, index, line + 1, len - 1, replaces);
+        }
+        applyDeltaLine(builder, line, len, changes);
+        while (replaces != NULL && replaces->count < builder->nbrUsedInAry) {
+            appendGroup(replaces, -1);
+        }
+    }
+    free(line);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+}
+
+/************************************************************************
+ * Applies one delta line (+word or -word) to the groups of a builder	*
+ * and records the group it changes. Adding a word the group already	*
+ * has changes nothing.													*
+ ************************************************************************/
+void applyDeltaLine(ArrayBuilder *builder, char *line, int length, ChangeList *changes)
+{
+    Node probe = {line + 1, length - 1, NULL};
+    Node *node;
+    Signature sig;
+    AnagramKey key;
+    TableSlot *slot;
+    
+    builder->kernel(probe.text, probe.length, &sig);
+    computeAnagramKey(&sig, &key);
+    slot = findSlot(&builder->table, &key, hashAnagramKey(&key), &probe);
+    if (line[0] == '+' && slot->index >= 0) {
+        for (node = builder->ary[slot->index].head; node != NULL; node = node->next) {
+            if (node->length == probe.length && memcmp(node->text, probe.text, probe.length) == 0) {
+                return;
+            }
+        }
+    }
+    recordChange(builder, changes, (slot->index >= 0) ? slot->index : builder->nbrUsedInAry);
+    
+    if (line[0] == '+') {
+        addNodeToArray(builder, createNodeInArena(&builder->arena, probe.text, probe.length));
+    } else if (!removeWordFromArray(builder, probe.text, probe.length)) {
+        fprintf(stderr,"Cannot remove %.*s: it is not in the dictionary\n", probe.length, probe.text);
+        changes->count--;
+    }
+}
+
+/************************************************************************
+ * Records that a group is about to change, keeping its current line.	*
+ * A group number equal to the number of groups stands for a group that	*
+ * is about to be started.												*
+ ************************************************************************/
+void recordChange(ArrayBuilder *builder, ChangeList *changes, int group)
+{
+    ChangedGroup *change;
+    
+    if (changes->count == changes->capacity) {
+        changes->capacity = (changes->capacity == 0) ? 64 : 2 * changes->capacity;
+        changes->changes = realloc(changes->changes, changes->capacity * sizeof(ChangedGroup));
+        if (changes->changes == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    change = &changes->changes[changes->count];
+    change->group = group;
+    change->order = changes->count;
+    if (group < builder->nbrUsedInAry) {
+        change->oldSize = builder->ary[group].size;
+        change->oldLine = formatGroup(builder, group, &change->oldLength);
+    } else {
+        change->oldSize = 0;
+        change->oldLine = NULL;
+        change->oldLength = 0;
+    }
+    changes->count++;
+}
+
+/************************************************************************
+ * Returns the words of a group as printAnagramArray prints them, minus	*
+ * the newline, in memory from the builder's arena, and stores the		*
+ * number of bytes in length.											*
+ ************************************************************************/
+char *formatGroup(ArrayBuilder *builder, int group, size_t *length)
+{
+    Node *node;
+    char *line, *p;
+    
+    *length = 0;
+    for (node = builder->ary[group].head; node != NULL; node = node->next) {
+        *length += node->length + 1;
+    }
+    line = p = arenaAlloc(&builder->arena, *length + 1);
+    for (node = builder->ary[group].head; node != NULL; node = node->next) {
+        memcpy(p, node->text, node->length);
+        p += node->length;
+        *p++ = ' ';
+    }
+    return line;
+}
+
+/************************************************************************
+ * Writes every group changed by a delta to outfile (- for stdout), in	*
+ * group order: a line - followed by the group as printAnagramArray		*
+ * printed it before the delta, then a line + followed by the group as	*
+ * it prints now. Lines of groups with fewer than two words, which are	*
+ * not printed, are left out, as are groups the delta did not change	*
+ * in the end. Applying these lines to the old output gives the new		*
+ * output, up to the order of the lines.								*
+ ************************************************************************/
+void writeChanges(ArrayBuilder *builder, ChangeList *changes, char *outfile)
+{
+    int fd = openOutputFile(outfile);
+    OutputBuffer out;
+    ChangedGroup *change;
+    char *line;
+    size_t length;
+    int i, newSize;
+    
+    initOutputBuffer(&out, fd, OUTPUT_BUFFER_SIZE);
+    qsort(changes->changes, changes->count, sizeof(ChangedGroup), compareChanges);
+    
+    for (i = 0; i < changes->count; i++) {
+        change = &changes->changes[i];
+        if (i > 0 && change->group == changes->changes[i-1].group) {
+            continue;
+        }
+        newSize = builder->ary[change->group].size;
+        line = formatGroup(builder, change->group, &length);
+        if (change->oldSize == newSize && length == change->oldLength
+                && memcmp(line, change->oldLine, length) == 0) {
+            continue;
+        }
+        if (change->oldSize > 1) {
+            writeOutput(&out, "-", 1);
+            writeOutput(&out, change->oldLine, change->oldLength);
+            writeOutput(&out, "\n", 1);
+        }
+        if (newSize > 1) {
+            writeOutput(&out, "+", 1);
+            writeOutput(&out, line, length);
+            writeOutput(&out, "\n", 1);
+        }
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+}
+
+/************************************************************************
+ * qsort comparison of changes: by group, then in delta order.			*
+ ************************************************************************/
+int compareChanges(const void *a, const void *b)
+{
+    const ChangedGroup *change1 = a, *change2 = b;
+    
+    if (change1->group != change2->group) {
+        return (change1->group > change2->group) - (change1->group < change2->group);
+    }
+    return (change1->order > change2->order) - (change1->order < change2->order);
+}
+
+/************************************************************************
+ * Makes sure the builder holds the group of a word if the index has	*
+ * one: unless the builder has the group already, the base group of the	*
+ * word is looked up and its words are added to the builder.			*
+ ************************************************************************/
+void loadIndexGroup(ArrayBuilder *builder, AnagramIndex *index, char *text, int length, GroupList *replaces)
+{
+    Node probe = {text, length, NULL};
+    Signature sig;
+    Query query;
+    int64_t g;
+    
+    builder->kernel(text, length, &sig);
+    computeAnagramKey(&sig, &query.key);
+    query.hash = hashAnagramKey(&query.key);
+    if (findSlot(&builder->table, &query.key, query.hash, &probe)->index >= 0) {
+        return;
+    }
+    query.text = text;
+    query.length = length;
+    g = lookupIndexPart(&index->base, &query);
+    if (g >= 0) {
+        addIndexGroup(builder, &index->base, g);
+        appendGroup(replaces, g);
+    }
+}
+
+/************************************************************************
+ * Adds group g of a part of an index to the builder as a new group,	*
+ * with nodes that view the words in the mapped index.					*
+ ************************************************************************/
+void addIndexGroup(ArrayBuilder *builder, IndexPart *part, uint64_t g)
+{
+    TableSlot *slot;
+    Node *node;
+    uint64_t w;
+    
+    if (part->groupStart[g] == part->groupStart[g+1]) {
+        unsigned int hash = hashAnagramKey(&part->keys[g]);
+    
+        slot = findSlot(&builder->table, &part->keys[g], hash, NULL);
+        addGroupToArray(builder, slot, &part->keys[g], hash, NULL);
+        return;
+    }
+    for (w = part->groupStart[g]; w < part->groupStart[g+1]; w++) {
+        node = arenaAlloc(&builder->arena, sizeof(Node));
+        node->text = part->pool + part->wordOffset[w];
+        node->length = part->wordOffset[w+1] - part->wordOffset[w];
+        node->next = NULL;
+        addNodeToArray(builder, node);
+    }
+}
+
+/************************************************************************
+ * Adds the words of a group of one builder to another builder, with	*
+ * new nodes viewing the same text.										*
+ ************************************************************************/
+void addBuilderGroup(ArrayBuilder *into, ArrayBuilder *from, int group)
+{
+    Node *word, *node;
+    
+    for (word = from->ary[group].head; word != NULL; word = word->next) {
+        node = arenaAlloc(&into->arena, sizeof(Node));
+        node->text = word->text;
+        node->length = word->length;
+        node->next = NULL;
+        addNodeToArray(into, node);
+    }
+}
+
+/************************************************************************
+ * Writes the groups of the builder as the new overlay at the end of	*
+ * the index file, syncs it, and only then writes the next generation	*
+ * of the header over the older header copy (see publishIndexHeader).	*
+ * Until that header is on disk the current one still describes the		*
+ * file, so a crash part way loses the update but not the index. The	*
+ * base groups and old overlays are left untouched, so a process that	*
+ * has the index mapped keeps reading the overlay it found when it		*
+ * opened the index.													*
+ ************************************************************************/
+void appendIndexOverlay(char *indexFile, AnagramIndex *index, ArrayBuilder *builder, GroupList *replaces)
+{
+    IndexHeader header = *index->header;
+    IndexWriter writer;
+    AnagramKey *keys = malloc((builder->nbrUsedInAry + 1) * sizeof(AnagramKey));
+    int32_t replaced;
+    int i;
+    
+    writer.fp = fopen(indexFile, "r+b");
+    if (keys == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (writer.fp == NULL || fseek(writer.fp, header.fileSize, SEEK_SET) != 0) {
+        fprintf(stderr,"Error opening file %s\n", indexFile);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < builder->table.capacity; i++) {
+        if (builder->table.slots[i].index >= 0) {
+            keys[builder->table.slots[i].index] = builder->table.slots[i].key;
+        }
+    }
+    
+    writer.checksum = CHECKSUM_SEED;
+    writer.nbrPending = 0;
+    writer.bytes = header.fileSize;
+    header.overlayOffset = writer.bytes;
+    for (i = 0; i < builder->nbrUsedInAry; i++) {
+        replaced = replaces->groups[i];
+        writeIndexBytes(&writer, &replaced, sizeof(int32_t));
+    }
+    padIndexWriter(&writer);
+    writeIndexSections(&writer, &header.overlay, builder->ary, builder->nbrUsedInAry, keys);
+    free(keys);
+    
+    // the index no longer describes the dictionary it was built from
+    header.sourceSize = 0;
+    header.sourceMtime = 0;
+    header.sourceMtimeNsec = 0;
+    header.fileSize = writer.bytes;
+    header.overlayChecksum = writer.checksum;
+    header.generation++;
+    publishIndexHeader(writer.fp, &header, indexFile);
+    if (fclose(writer.fp) != 0) {
+        fprintf(stderr,"Error writing file %s\n", indexFile);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/************************************************************************
+ * Rewrites the index file with the groups of the builder merged into	*
+ * the base groups: every base group is replaced by its version in the	*
+ * builder, if any, and the builder's new groups follow. Groups left	*
+ * without words are dropped.											*
+ ************************************************************************/
+void rewriteAnagramIndex(char *indexFile, AnagramIndex *index, ArrayBuilder *builder, GroupList *replaces)
+{
+    ArrayBuilder merged;
+    AryElement *ary;
+    int *builderGroup = calloc(index->base.nbrGroups + 1, sizeof(int));
+    int aryLen, i;
+    uint64_t g;
+    
+    if (builderGroup == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < builder->nbrUsedInAry; i++) {
+        if (replaces->groups[i] >= 0) {
+            builderGroup[replaces->groups[i]] = i + 1;
+        }
+    }
+    initArrayBuilder(&merged);
+    for (g = 0; g < index->base.nbrGroups; g++) {
+        if (builderGroup[g] != 0) {
+            addBuilderGroup(&merged, builder, builderGroup[g] - 1);
+        } else {
+            addIndexGroup(&merged, &index->base, g);
+        }
+    }
+    for (i = 0; i < builder->nbrUsedInAry; i++) {
+        if (replaces->groups[i] < 0) {
+            addBuilderGroup(&merged, builder, i);
+        }
+    }
+    free(builderGroup);
+    
+    ary = finishArrayBuilder(&merged, &aryLen);
+    saveAnagramIndex(indexFile, NULL, ary, aryLen);
+    freeAnagramArray(ary, aryLen);
+}
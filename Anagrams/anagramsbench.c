@@ -0,0 +1,1040 @@
+/************************************************************************
+ * filename: anagramsbench.c											*
+ *																		*
+ * Benchmarks and test inputs for the anagrams program, kept out of		*
+ * the program itself. Each run does one of:							*
+ *		--bench-keys infile												*
+ *			times areAnagrams against the old sum-of-squares check		*
+ *		--generate N outfile											*
+ *			writes a synthetic dictionary of N words; --seed S,			*
+ *			--lengths MIN-MAX, --mean-length M and --density D (words	*
+ *			per anagram class) may come before --generate				*
+ *		--bench infile resultsfile										*
+ *			times build, print and free of each group layout and		*
+ *			appends the results to resultsfile as JSON lines; with		*
+ *			--cold the input is dropped from the page cache before		*
+ *			every round, and --threads N sets the threads of the		*
+ *			pipeline layout												*
+ *		--load queryfile socket											*
+ *			load generator for ./anagrams --serve: N connections		*
+ *			(--threads N) send the lines of queryfile to the daemon in	*
+ *			batches of D queries (--depth D) for S seconds (10 by		*
+ *			default, set with --seconds S) and write queries/sec and	*
+ *			p50/p99 latency as JSON										*
+ *																		*
+ * Use the following commands to compile and run the program:			*
+ *		$ gcc -Wall -std=c99 -O2 -pthread -o anagramsbench \			*
+ *				anagramsbench.c anagram.c								*
+ *		$ ./anagramsbench  --generate 1000000  synthetic.txt			*
+ *		$ ./anagramsbench  --bench  synthetic.txt  results.jsonl		*
+ *																		*
+ * Author(s): Caitlin Crowe and Emily Peterson							*
+ ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "anagramcore.h"
+
+#define BENCH_ROUNDS 5
+#define GENERATE_BATCH (1 << 20)	// words shuffled together by --generate
+#define GENERATE_TRIES 1000	// draws in a row of used classes before --generate stops
+#define LOAD_DEPTH 64	// queries per batch of the load generator
+#define LOAD_SECONDS 10
+#define LOAD_BATCH_SIZE (1 << 16)	// most bytes of a batch of queries
+
+// pair of words compared by benchmarkAnagramKeys, given by their
+// positions among the words read
+typedef struct {
+    int first;
+    int second;
+} WordPair;
+
+// settings of a synthetic dictionary (see generateDictionary)
+//		- word lengths lie between minLength and maxLength and follow a
+//		  binomial distribution with mean meanLength
+//		- density field is the average number of words per anagram class
+//		- equal settings (including the seed) always give the same file
+typedef struct {
+    long nbrWords;
+    int minLength;
+    int maxLength;
+    double meanLength;
+    double density;
+    uint64_t seed;
+} GeneratorSpec;
+
+// anagram classes drawn so far by generateDictionary, as a set of
+// 64-bit fingerprints of their keys (see addClassKey): open addressing
+// with linear probing, 0 marking an empty slot, at most 3/4 full
+//		- capacity field is the number of slots (always a power of two)
+typedef struct {
+    uint64_t *slots;
+    size_t capacity;
+    size_t used;
+} ClassSet;
+
+// measurements of one build/print/free cycle (see benchmarkLayout)
+//		- times are in seconds; peakRss is in KiB
+typedef struct {
+    double buildTime;
+    double printTime;
+    double freeTime;
+    long peakRss;
+    uint64_t nbrAllocations;
+    long nbrWords;
+    long nbrGroups;
+} BenchResult;
+
+// one connection of the load generator (see generateLoad)
+//		- queries field holds the query lines back to back, each ending
+//		  in "\n", and lineStart the nbrLines+1 offsets of the lines
+//		- first field is the line the connection starts at
+typedef struct {
+    char *socketPath;
+    char *queries;
+    size_t *lineStart;
+    int nbrLines;
+    int first;
+    int depth;
+    double seconds;
+    LatencyHistogram histogram;
+} LoadClient;
+
+/************************************************************************
+ * YOU MUST NOT DEFINE ANY GLOBAL VARIABLES (i.e., OUTSIDE FUNCTIONS).  *
+ * COMMUNICATION BETWEEN FUNCTIONS MUST HAPPEN ONLY VIA PARAMETERS.     *
+ ************************************************************************/
+
+/************************************************************************
+ * Function declarations/prototypes										*
+ ************************************************************************/
+
+void printUsage(void);
+
+void benchmarkAnagramKeys(char *infile);
+
+int findAnagramPairs(Node **words, AnagramKey *keys, int nbrWords, WordPair **pairs);
+
+void timeWordPairs(char *label, Node **words, AnagramKey *keys, WordPair *pairs, int nbrPairs);
+
+void generateDictionary(char *outfile, GeneratorSpec *spec);
+
+void initClassSet(ClassSet *set, long nbrClasses);
+
+bool addClassKey(ClassSet *set, AnagramKey *key);
+
+void growClassSet(ClassSet *set);
+
+uint64_t nextRandom(uint64_t *state);
+
+void benchmarkPipeline(char *infile, char *resultsFile, bool cold, int nbrThreads);
+
+void benchmarkLayout(char *infile, char *layout, int nbrThreads, BenchResult *result);
+
+void dropCachedFile(char *infile);
+
+void writeJsonString(FILE *fp, char *text);
+
+void generateLoad(char *queryFile, char *socketPath, int nbrConnections, int depth, double seconds);
+
+void *loadWorker(void *arg);
+
+/************************************************************************
+ * Reads the options, then runs the benchmark they ask for.				*
+ ************************************************************************/
+int main(int argc, char *argv[])
+{
+    bool benchKeys = false;
+    bool bench = false;
+    bool cold = false;
+    bool load = false;
+    GeneratorSpec spec = {0, 3, 12, 0, 1.3, 1};
+    int nbrThreads = 1;
+    int depth = LOAD_DEPTH;
+    double loadSeconds = LOAD_SECONDS;
+    int arg = 1;
+    
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], "--bench-keys") == 0) {
+            benchKeys = true;
+        } else if (strcmp(argv[arg], "--bench") == 0) {
+            bench = true;
+        } else if (strcmp(argv[arg], "--cold") == 0) {
+            cold = true;
+        } else if (strcmp(argv[arg], "--generate") == 0 && arg + 1 < argc) {
+            spec.nbrWords = atol(argv[++arg]);
+            if (spec.nbrWords < 1) {
+                printf("Number of words must be at least 1.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc) {
+            spec.seed = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--lengths") == 0 && arg + 1 < argc) {
+            if (sscanf(argv[++arg], "%d-%d", &spec.minLength, &spec.maxLength) != 2
+                    || spec.minLength < 1 || spec.maxLength < spec.minLength) {
+                printf("Lengths must be given as MIN-MAX with 1 <= MIN <= MAX.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--mean-length") == 0 && arg + 1 < argc) {
+            spec.meanLength = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--density") == 0 && arg + 1 < argc) {
+            spec.density = atof(argv[++arg]);
+            if (spec.density < 1) {
+                printf("Density must be at least 1 word per class.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--load") == 0) {
+            load = true;
+        } else if (strcmp(argv[arg], "--depth") == 0 && arg + 1 < argc) {
+            depth = atoi(argv[++arg]);
+            if (depth < 1) {
+                printf("Depth must be at least 1.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--seconds") == 0 && arg + 1 < argc) {
+            loadSeconds = atof(argv[++arg]);
+            if (loadSeconds <= 0) {
+                printf("Seconds must be more than 0.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            nbrThreads = atoi(argv[++arg]);
+            if (nbrThreads < 1) {
+                printf("Number of threads must be at least 1.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            printf("Unknown option %s\n", argv[arg]);
+            printUsage();
+            exit(EXIT_FAILURE);
+        }
+        arg++;
+    }
+    
+    if (benchKeys + bench + load + (spec.nbrWords > 0) != 1) {
+        printf("Give exactly one of --bench-keys, --generate, --bench and --load.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if (argc - arg != (benchKeys ? 1 : 2) - (spec.nbrWords > 0)) {
+        printf("Wrong number of arguments to program.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if (cold && !bench) {
+        printf("--cold only works with --bench.\n");
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    
+    if (benchKeys) {
+        benchmarkAnagramKeys(argv[arg]);
+    } else if (bench) {
+        benchmarkPipeline(argv[arg], argv[arg+1], cold, nbrThreads);
+    } else if (load) {
+        generateLoad(argv[arg], argv[arg+1], nbrThreads, depth, loadSeconds);
+    } else {
+        if (spec.meanLength == 0) {
+            spec.meanLength = (spec.minLength + spec.maxLength) / 2.0;
+        }
+        if (spec.meanLength < spec.minLength || spec.meanLength > spec.maxLength) {
+            printf("Mean length must lie between the lengths.\n");
+            exit(EXIT_FAILURE);
+        }
+        generateDictionary(argv[arg], &spec);
+    }
+    return EXIT_SUCCESS;
+}
+
+/************************************************************************
+ * Prints how to run the program.										*
+ ************************************************************************/
+void printUsage(void)
+{
+    printf("Usage: ./anagramsbench --bench-keys infile\n");
+    printf("       ./anagramsbench [--seed S] [--lengths MIN-MAX] [--mean-length M] [--density D] --generate N outfile\n");
+    printf("       ./anagramsbench [--cold] [--threads N] --bench infile resultsfile\n");
+    printf("       ./anagramsbench [--threads N] [--depth D] [--seconds S] --load queryfile socket\n");
+}
+
+/************************************************************************
+ * Reads the words of a dictionary and times three ways of deciding		*
+ * whether two words are anagrams:										*
+ *		- the old sum-of-squares check (areAnagramsSumOfSquares)		*
+ *		- areAnagrams, which builds both exact keys for each compare	*
+ *		- a compare of keys computed once per word, which is what the	*
+ *		  builders do													*
+ * Neighbouring words in a dictionary are hardly ever anagrams, so the	*
+ * compares are timed twice: over every pair of neighbouring words,		*
+ * and over pairs of words of the same anagram group.					*
+ ************************************************************************/
+void benchmarkAnagramKeys(char *infile)
+{
+    Arena arena;
+    Node **words = NULL;
+    AnagramKey *keys;
+    WordPair *pairs;
+    Signature sig;
+    int nbrWords = 0, capacity = 0, nbrPairs;
+    int i;
+    char *word = NULL;
+    size_t wordCap = 0;
+    ssize_t len;
+    FILE *fp = fopen(infile,"r");
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    
+    initArena(&arena);
+    while((len = getline(&word, &wordCap, fp)) != -1){
+        while (len > 0 && (word[len-1] == '\n' || word[len-1] == '\r')) {
+            word[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (nbrWords == capacity) {
+            capacity = (capacity == 0) ? 1024 : 2 * capacity;
+            words = realloc(words, capacity * sizeof(Node *));
+            if (words == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        words[nbrWords++] = createNodeInArena(&arena, word, len);
+    }
+    free(word);
+    fclose(fp);
+    if (nbrWords < 2) {
+        printf("Need at least two words to compare.\n");
+        releaseArena(&arena);
+        free(words);
+        return;
+    }
+    
+    keys = malloc(nbrWords * sizeof(AnagramKey));
+    pairs = malloc((nbrWords - 1) * sizeof(WordPair));
+    if (keys == NULL || pairs == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nbrWords; i++) {
+        computeSignature(words[i]->text, words[i]->length, &sig);
+        computeAnagramKey(&sig, &keys[i]);
+    }
+    
+    printf("%d words, %d rounds\n", nbrWords, BENCH_ROUNDS);
+    for (i = 1; i < nbrWords; i++) {
+        pairs[i-1].first = i - 1;
+        pairs[i-1].second = i;
+    }
+    timeWordPairs("neighbouring pairs", words, keys, pairs, nbrWords - 1);
+    free(pairs);
+    
+    nbrPairs = findAnagramPairs(words, keys, nbrWords, &pairs);
+    if (nbrPairs > 0) {
+        timeWordPairs("anagram pairs", words, keys, pairs, nbrPairs);
+    } else {
+        printf("anagram pairs: none in the dictionary\n");
+    }
+    
+    free(pairs);
+    free(keys);
+    free(words);
+    releaseArena(&arena);
+}
+
+/************************************************************************
+ * Stores in *pairs every pair of words that follow each other within	*
+ * an anagram group (so a group of n words gives n - 1 pairs) and		*
+ * returns the number of pairs. A signature table gives the group of	*
+ * each word, and last holds the latest word of each group.				*
+ ************************************************************************/
+int findAnagramPairs(Node **words, AnagramKey *keys, int nbrWords, WordPair **pairs)
+{
+    SignatureTable table;
+    TableSlot *slot;
+    unsigned int hash;
+    int *last = malloc(nbrWords * sizeof(int));
+    int i, group, nbrGroups = 0, nbrPairs = 0;
+    
+    *pairs = malloc((nbrWords - 1) * sizeof(WordPair));
+    if (last == NULL || *pairs == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initSignatureTable(&table, INITIAL_TABLE_SIZE);
+    for (i = 0; i < nbrWords; i++) {
+        hash = hashAnagramKey(&keys[i]);
+        slot = findSlot(&table, &keys[i], hash, words[i]);
+        if (slot->index >= 0) {
+            group = slot->index;
+            (*pairs)[nbrPairs].first = last[group];
+            (*pairs)[nbrPairs].second = i;
+            nbrPairs++;
+        } else {
+            group = nbrGroups++;
+            slot->index = group;
+            slot->hash = hash;
+            slot->key = keys[i];
+            slot->tail = words[i];
+            table.used++;
+            if (4 * table.used > 3 * table.capacity) {
+                growSignatureTable(&table);
+            }
+        }
+        last[group] = i;
+    }
+    free(table.slots);
+    free(last);
+    return nbrPairs;
+}
+
+/************************************************************************
+ * Times the three anagram checks of benchmarkAnagramKeys over the		*
+ * given pairs and prints the time per compare, the number of matches	*
+ * and how many pairs the old check wrongly calls anagrams.				*
+ ************************************************************************/
+void timeWordPairs(char *label, Node **words, AnagramKey *keys, WordPair *pairs, int nbrPairs)
+{
+    long oldMatches = 0, falseMatches = 0, exactMatches = 0, keyMatches = 0;
+    int i, round;
+    Node *first, *second;
+    struct timespec start;
+    double oldTime, exactTime, keyTime;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < nbrPairs; i++) {
+            oldMatches += areAnagramsSumOfSquares(words[pairs[i].first]->text, words[pairs[i].second]->text);
+        }
+    }
+    oldTime = elapsedSeconds(&start);
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < nbrPairs; i++) {
+            exactMatches += areAnagrams(words[pairs[i].first]->text, words[pairs[i].second]->text);
+        }
+    }
+    exactTime = elapsedSeconds(&start);
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < nbrPairs; i++) {
+            first = words[pairs[i].first];
+            second = words[pairs[i].second];
+            keyMatches += keysMatch(&keys[pairs[i].first], first, &keys[pairs[i].second], second);
+        }
+    }
+    keyTime = elapsedSeconds(&start);
+    
+    for (i = 0; i < nbrPairs; i++) {
+        first = words[pairs[i].first];
+        second = words[pairs[i].second];
+        if (areAnagramsSumOfSquares(first->text, second->text) && !areAnagrams(first->text, second->text)) {
+            falseMatches++;
+        }
+    }
+    
+    printf("%s: %d pairs\n", label, nbrPairs);
+    printf("  sum of squares:   %8.2f ns/compare  %ld matches (%ld false)\n",
+           oldTime * 1e9 / ((double)BENCH_ROUNDS * nbrPairs), oldMatches / BENCH_ROUNDS, falseMatches);
+    printf("  exact key:        %8.2f ns/compare  %ld matches\n",
+           exactTime * 1e9 / ((double)BENCH_ROUNDS * nbrPairs), exactMatches / BENCH_ROUNDS);
+    printf("  precomputed keys: %8.2f ns/compare  %ld matches\n",
+           keyTime * 1e9 / ((double)BENCH_ROUNDS * nbrPairs), keyMatches / BENCH_ROUNDS);
+}
+
+/************************************************************************
+ * Writes a synthetic dictionary of spec->nbrWords words to outfile.	*
+ * Words come in anagram classes: a class is a random multiset of		*
+ * letters (drawn with their frequencies in English text) spelled in	*
+ * different orders, and the number of words per class is geometric		*
+ * with mean spec->density. Short classes run out of distinct spellings	*
+ * and end early, so the real density can be a little lower. No two		*
+ * classes share a multiset (a ClassSet of the keys drawn so far		*
+ * rejects repeats), so each class is one anagram group of the output	*
+ * and no word is written twice; the class count and density printed	*
+ * at the end are those of the output. If GENERATE_TRIES multisets in	*
+ * a row are already used, the lengths leave too few classes and the	*
+ * output ends early. The words of GENERATE_BATCH at a time are			*
+ * shuffled before being written, so the words of a class are spread	*
+ * over the file.														*
+ ************************************************************************/
+void generateDictionary(char *outfile, GeneratorSpec *spec)
+{
+    // relative frequencies of 'a'..'z' in English text (per mille)
+    static const int frequency[ALPHABET_SIZE] = {
+        82, 15, 28, 43, 127, 22, 20, 61, 70, 2, 8, 40, 24,
+        67, 75, 19, 1, 60, 63, 91, 28, 10, 24, 2, 20, 1
+    };
+    int stride = spec->maxLength + 1;
+    char *pool = malloc((size_t)GENERATE_BATCH * stride);
+    int *lengths = malloc(GENERATE_BATCH * sizeof(int));
+    int *order = malloc(GENERATE_BATCH * sizeof(int));
+    char *letters = malloc(stride);
+    uint64_t state = spec->seed;
+    uint64_t lengthLimit, moreLimit;
+    long written = 0, nbrClasses = 0, nbrGroups = 0;
+    ClassSet classes;
+    Signature sig;
+    AnagramKey key;
+    OutputBuffer out;
+    int total = 0, n, length, size, pick, tries, misses = 0, i, j, k;
+    bool distinct;
+    char c;
+    
+    if (pool == NULL || lengths == NULL || order == NULL || letters == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initClassSet(&classes, spec->nbrWords / spec->density);
+    for (i = 0; i < ALPHABET_SIZE; i++) {
+        total += frequency[i];
+    }
+    // thresholds on the top 32 bits of a random number: one more
+    // letter than minLength, and one more word in the class
+    lengthLimit = (spec->maxLength == spec->minLength) ? 0 : (uint64_t)((spec->meanLength - spec->minLength)
+            / (spec->maxLength - spec->minLength) * 4294967296.0);
+    moreLimit = (uint64_t)((spec->density - 1) / spec->density * 4294967296.0);
+    initOutputBuffer(&out, openOutputFile(outfile), OUTPUT_BUFFER_SIZE);
+    
+    while (written < spec->nbrWords && misses < GENERATE_TRIES) {
+        n = 0;
+        while (n < GENERATE_BATCH && written + n < spec->nbrWords && misses < GENERATE_TRIES) {
+            length = spec->minLength;
+            for (i = spec->minLength; i < spec->maxLength; i++) {
+                length += (nextRandom(&state) >> 32) < lengthLimit;
+            }
+            for (i = 0; i < length; i++) {
+                pick = nextRandom(&state) % total;
+                for (j = 0; pick >= frequency[j]; j++) {
+                    pick -= frequency[j];
+                }
+                letters[i] = 'a' + j;
+            }
+            computeSignature(letters, length, &sig);
+            computeAnagramKey(&sig, &key);
+            if (!addClassKey(&classes, &key)) {
+                misses++;
+                continue;
+            }
+            misses = 0;
+            size = 1;
+            while ((nextRandom(&state) >> 32) < moreLimit) {
+                size++;
+            }
+            
+            for (k = 0; k < size && n < GENERATE_BATCH && written + n < spec->nbrWords; k++) {
+                // look for a spelling the class does not have yet
+                distinct = false;
+                for (tries = 0; tries < 8 && !distinct; tries++) {
+                    for (i = length - 1; i > 0; i--) {
+                        j = nextRandom(&state) % (i + 1);
+                        c = letters[i];
+                        letters[i] = letters[j];
+                        letters[j] = c;
+                    }
+                    distinct = true;
+                    for (j = n - k; j < n && distinct; j++) {
+                        distinct = memcmp(pool + (size_t)j * stride, letters, length) != 0;
+                    }
+                }
+                if (!distinct) {
+                    break;
+                }
+                memcpy(pool + (size_t)n * stride, letters, length);
+                lengths[n] = length;
+                n++;
+            }
+            nbrClasses++;
+            nbrGroups += (k >= 2);
+        }
+        
+        for (i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        for (i = n - 1; i > 0; i--) {
+            j = nextRandom(&state) % (i + 1);
+            k = order[i];
+            order[i] = order[j];
+            order[j] = k;
+        }
+        for (i = 0; i < n; i++) {
+            writeOutput(&out, pool + (size_t)order[i] * stride, lengths[order[i]]);
+            writeOutput(&out, "\n", 1);
+        }
+        written += n;
+    }
+    
+    flushOutput(&out);
+    free(out.data);
+    if (out.fd != STDOUT_FILENO) {
+        close(out.fd);
+    }
+    free(pool);
+    free(lengths);
+    free(order);
+    free(letters);
+    free(classes.slots);
+    if (written < spec->nbrWords) {
+        fprintf(stderr, "Only %ld distinct words could be drawn with lengths %d-%d\n",
+                written, spec->minLength, spec->maxLength);
+    }
+    fprintf(stderr, "%ld words in %ld classes (%.2f words per class), %ld classes of two or more words\n",
+            written, nbrClasses, (double)written / nbrClasses, nbrGroups);
+}
+
+/************************************************************************
+ * Prepares an empty ClassSet with room for about nbrClasses classes.	*
+ ************************************************************************/
+void initClassSet(ClassSet *set, long nbrClasses)
+{
+    set->capacity = INITIAL_TABLE_SIZE;
+    while (3 * set->capacity < 4 * (size_t)nbrClasses) {
+        set->capacity *= 2;
+    }
+    set->slots = calloc(set->capacity, sizeof(uint64_t));
+    if (set->slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    set->used = 0;
+}
+
+/************************************************************************
+ * Adds the class of a key to a ClassSet and returns true, or returns	*
+ * false if the set already has it. A class is stored as a 64-bit		*
+ * fingerprint of its key, so two classes may share a slot (when their	*
+ * fingerprints or their overflowed keys are equal); the second one is	*
+ * then taken as drawn already, which only costs the generator a draw.	*
+ ************************************************************************/
+bool addClassKey(ClassSet *set, AnagramKey *key)
+{
+    uint64_t state = key->lo ^ (key->hi * 0xC2B2AE3D27D4EB4Full);
+    uint64_t print = nextRandom(&state);
+    size_t mask = set->capacity - 1;
+    size_t i;
+    
+    print = (print == 0) ? 1 : print;
+    for (i = print & mask; set->slots[i] != 0; i = (i + 1) & mask) {
+        if (set->slots[i] == print) {
+            return false;
+        }
+    }
+    set->slots[i] = print;
+    set->used++;
+    if (4 * set->used > 3 * set->capacity) {
+        growClassSet(set);
+    }
+    return true;
+}
+
+/************************************************************************
+ * Doubles the number of slots of a ClassSet and re-inserts every		*
+ * fingerprint.															*
+ ************************************************************************/
+void growClassSet(ClassSet *set)
+{
+    uint64_t *old = set->slots;
+    size_t oldCapacity = set->capacity;
+    size_t mask, i, j;
+    
+    set->capacity *= 2;
+    set->slots = calloc(set->capacity, sizeof(uint64_t));
+    if (set->slots == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    mask = set->capacity - 1;
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i] != 0) {
+            for (j = old[i] & mask; set->slots[j] != 0; j = (j + 1) & mask) {
+            }
+            set->slots[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+/************************************************************************
+ * Returns the next number of a splitmix64 random sequence whose state	*
+ * is kept in state.													*
+ ************************************************************************/
+uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/************************************************************************
+ * Times building, printing and freeing the groups of infile with each	*
+ * layout: linked lists of copied words (buildAnagramArray), linked		*
+ * lists of mapped words (buildAnagramArrayMapped), flat arrays			*
+ * (buildGroupStore), front-coded groups (buildCompactStore) and linked	*
+ * lists built by the pipelined builder with nbrThreads signature		*
+ * threads (buildAnagramArrayPipelined). Each layout runs BENCH_ROUNDS	*
+ * times, every time in a child process of its own so that its peak		*
+ * RSS is its own; the best time of each phase is kept. If cold is		*
+ * true the input is dropped from the page cache before every round,	*
+ * so the build phase includes reading the disk. Groups are printed to	*
+ * /dev/null, so the print phase measures formatting and write() calls	*
+ * but not the disk. One JSON object per layout is appended to			*
+ * resultsFile (so runs on different versions can be compared line by	*
+ * line) and a summary is printed.										*
+ ************************************************************************/
+void benchmarkPipeline(char *infile, char *resultsFile, bool cold, int nbrThreads)
+{
+    static const char *layouts[] = {"list", "mmap", "store", "compact", "pipeline"};
+    BenchResult result, best = {0};
+    struct stat st;
+    int pipeFds[2];
+    pid_t pid;
+    int status, round, l;
+    FILE *fp;
+    
+    if (stat(infile, &st) != 0) {
+        fprintf(stderr,"Error opening file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    fp = fopen(resultsFile, "a");
+    if (fp == NULL) {
+        fprintf(stderr,"Error opening file %s\n", resultsFile);
+        exit(EXIT_FAILURE);
+    }
+    
+    printf("%-8s %10s %10s %8s %8s %8s %12s %10s %12s\n", "layout", "words", "groups",
+           "build s", "print s", "free s", "words/s", "peak KiB", "allocations");
+    for (l = 0; l < 5; l++) {
+        for (round = 0; round < BENCH_ROUNDS; round++) {
+            if (cold) {
+                dropCachedFile(infile);
+            }
+            if (pipe(pipeFds) != 0 || (pid = fork()) < 0) {
+                fprintf(stderr,"Error starting benchmark process\n");
+                exit(EXIT_FAILURE);
+            }
+            if (pid == 0) {
+                close(pipeFds[0]);
+                benchmarkLayout(infile, (char *)layouts[l], nbrThreads, &result);
+                writeAll(pipeFds[1], (char *)&result, sizeof(result));
+                _exit(EXIT_SUCCESS);
+            }
+            close(pipeFds[1]);
+            if (read(pipeFds[0], &result, sizeof(result)) != sizeof(result)
+                    || waitpid(pid, &status, 0) != pid || status != 0) {
+                fprintf(stderr,"Benchmark process failed\n");
+                exit(EXIT_FAILURE);
+            }
+            close(pipeFds[0]);
+            if (round == 0) {
+                best = result;
+            }
+            best.buildTime = (result.buildTime < best.buildTime) ? result.buildTime : best.buildTime;
+            best.printTime = (result.printTime < best.printTime) ? result.printTime : best.printTime;
+            best.freeTime = (result.freeTime < best.freeTime) ? result.freeTime : best.freeTime;
+            best.peakRss = (result.peakRss > best.peakRss) ? result.peakRss : best.peakRss;
+        }
+        
+        fprintf(fp, "{\"input\": ");
+        writeJsonString(fp, infile);
+        fprintf(fp, ", \"input_bytes\": %lld, \"layout\": \"%s\", \"threads\": %d, \"cold\": %s, \"rounds\": %d, "
+                "\"words\": %ld, \"groups\": %ld, "
+                "\"build_s\": %.6f, \"print_s\": %.6f, \"free_s\": %.6f, \"build_words_per_s\": %.0f, "
+                "\"words_per_s\": %.0f, \"peak_rss_kib\": %ld, \"build_allocations\": %llu}\n",
+                (long long)st.st_size, layouts[l], (l == 4) ? nbrThreads : 1, cold ? "true" : "false",
+                BENCH_ROUNDS, best.nbrWords, best.nbrGroups,
+                best.buildTime, best.printTime, best.freeTime, best.nbrWords / best.buildTime,
+                best.nbrWords / (best.buildTime + best.printTime + best.freeTime), best.peakRss,
+                (unsigned long long)best.nbrAllocations);
+        printf("%-8s %10ld %10ld %8.3f %8.3f %8.3f %12.0f %10ld %12llu\n", layouts[l], best.nbrWords,
+               best.nbrGroups, best.buildTime, best.printTime, best.freeTime,
+               best.nbrWords / (best.buildTime + best.printTime + best.freeTime), best.peakRss,
+               (unsigned long long)best.nbrAllocations);
+    }
+    fclose(fp);
+}
+
+/************************************************************************
+ * Builds, prints (to /dev/null) and frees the groups of infile once in	*
+ * the given layout ("list", "mmap", "store", "compact" or "pipeline",	*
+ * which uses nbrThreads signature threads) and stores the times, sizes	*
+ * and the peak RSS of the process in result.							*
+ ************************************************************************/
+void benchmarkLayout(char *infile, char *layout, int nbrThreads, BenchResult *result)
+{
+    struct timespec start;
+    struct rusage usage;
+    AryElement *ary = NULL;
+    GroupStore store;
+    CompactStore compact;
+    int aryLen = 0, g;
+    
+    memset(result, 0, sizeof(BenchResult));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (strcmp(layout, "store") == 0) {
+        buildGroupStore(infile, &store);
+    } else if (strcmp(layout, "compact") == 0) {
+        buildCompactStore(infile, &compact);
+    } else if (strcmp(layout, "mmap") == 0) {
+        ary = buildAnagramArrayMapped(infile, &aryLen);
+    } else if (strcmp(layout, "pipeline") == 0) {
+        ary = buildAnagramArrayPipelined(infile, &aryLen, nbrThreads);
+    } else {
+        ary = buildAnagramArray(infile, &aryLen);
+    }
+    result->buildTime = elapsedSeconds(&start);
+    
+    if (ary != NULL) {
+        result->nbrGroups = aryLen;
+        for (g = 0; g < aryLen; g++) {
+            result->nbrWords += ary[g].size;
+        }
+        result->nbrAllocations = getAryHeader(ary)->arena.nbrAllocations;
+    } else if (strcmp(layout, "compact") == 0) {
+        result->nbrGroups = compact.nbrGroups;
+        result->nbrWords = compact.nbrWords;
+        result->nbrAllocations = compact.nbrAllocations;
+    } else {
+        result->nbrGroups = store.nbrGroups;
+        result->nbrWords = store.nbrWords;
+        result->nbrAllocations = store.nbrAllocations;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ary != NULL) {
+        printAnagramArray("/dev/null", ary, aryLen);
+    } else if (strcmp(layout, "compact") == 0) {
+        printCompactStore("/dev/null", &compact);
+    } else {
+        printGroupStore("/dev/null", &store);
+    }
+    result->printTime = elapsedSeconds(&start);
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ary != NULL) {
+        freeAnagramArray(ary, aryLen);
+    } else if (strcmp(layout, "compact") == 0) {
+        freeCompactStore(&compact);
+    } else {
+        freeGroupStore(&store);
+    }
+    result->freeTime = elapsedSeconds(&start);
+    
+    getrusage(RUSAGE_SELF, &usage);
+    result->peakRss = usage.ru_maxrss;
+}
+
+/************************************************************************
+ * Asks the kernel to drop the cached pages of infile, so that the next	*
+ * read of it has to go to the disk. Dirty pages are written out first,	*
+ * since the kernel only drops clean ones.								*
+ ************************************************************************/
+void dropCachedFile(char *infile)
+{
+    int fd = open(infile, O_RDONLY);
+    
+    if (fd < 0) {
+        fprintf(stderr,"Error opening file %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/************************************************************************
+ * Writes text to fp as a JSON string (in double quotes, with quotes,	*
+ * backslashes and control characters escaped).							*
+ ************************************************************************/
+void writeJsonString(FILE *fp, char *text)
+{
+    unsigned char *p;
+    
+    fputc('"', fp);
+    for (p = (unsigned char *)text; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(fp, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(fp, "\\u%04x", *p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/************************************************************************
+ * Load generator for the query daemon: nbrConnections threads, each	*
+ * with its own connection, send the lines of queryFile (starting at	*
+ * different lines and wrapping around) in batches of depth queries		*
+ * for about the given number of seconds. A thread sends a whole batch	*
+ * (at most LOAD_BATCH_SIZE bytes, so that it always fits in the		*
+ * socket), then reads its answers, and the latency of a query is the	*
+ * time from sending its batch to receiving its answer. Writes the		*
+ * number of queries, queries/sec and the p50 and p99 latency to stdout	*
+ * as JSON.																*
+ ************************************************************************/
+void generateLoad(char *queryFile, char *socketPath, int nbrConnections, int depth, double seconds)
+{
+    LoadClient *clients = malloc(nbrConnections * sizeof(LoadClient));
+    pthread_t *threads = malloc(nbrConnections * sizeof(pthread_t));
+    LatencyHistogram total;
+    struct timespec start;
+    size_t bytes;
+    size_t *lineStart = NULL;
+    char *queries = mapInputFile(queryFile, &bytes);
+    char *text, *line, *p = queries, *end = queries + bytes;
+    int nbrLines = 0, capacity = 0, length, maxLength = 0, t, b;
+    double elapsed;
+    
+    text = malloc(bytes + 1);
+    if (clients == NULL || threads == NULL || text == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    bytes = 0;
+    while ((line = nextMappedLine(&p, end, &length)) != NULL) {
+        if (nbrLines + 1 >= capacity) {
+            capacity = (capacity == 0) ? 64 : 2 * capacity;
+            lineStart = realloc(lineStart, capacity * sizeof(size_t));
+            if (lineStart == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        lineStart[nbrLines++] = bytes;
+        memcpy(text + bytes, line, length);
+        bytes += length;
+        text[bytes++] = '\n';
+        maxLength = (length + 1 > maxLength) ? length + 1 : maxLength;
+    }
+    if (queries != NULL) {
+        munmap(queries, end - queries);
+    }
+    if (nbrLines == 0) {
+        fprintf(stderr,"%s has no queries\n", queryFile);
+        exit(EXIT_FAILURE);
+    }
+    lineStart[nbrLines] = bytes;
+    if ((size_t)maxLength * depth > LOAD_BATCH_SIZE) {
+        fprintf(stderr,"A batch of %d queries may not fit in %d bytes\n", depth, LOAD_BATCH_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < nbrConnections; t++) {
+        clients[t].socketPath = socketPath;
+        clients[t].queries = text;
+        clients[t].lineStart = lineStart;
+        clients[t].nbrLines = nbrLines;
+        clients[t].first = (int)((int64_t)nbrLines * t / nbrConnections);
+        clients[t].depth = depth;
+        clients[t].seconds = seconds;
+        memset(&clients[t].histogram, 0, sizeof(LatencyHistogram));
+        if (pthread_create(&threads[t], NULL, loadWorker, &clients[t]) != 0) {
+            fprintf(stderr,"Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(&total, 0, sizeof(LatencyHistogram));
+    for (t = 0; t < nbrConnections; t++) {
+        pthread_join(threads[t], NULL);
+        for (b = 0; b < LATENCY_BUCKETS; b++) {
+            total.count[b] += clients[t].histogram.count[b];
+        }
+        total.total += clients[t].histogram.total;
+    }
+    elapsed = elapsedSeconds(&start);
+    
+    printf("{\"connections\": %d, \"depth\": %d, \"seconds\": %.3f, \"queries\": %llu, \"queries_per_s\": %.0f, "
+            "\"p50_us\": %.3f, \"p99_us\": %.3f}\n", nbrConnections, depth, elapsed,
+            (unsigned long long)total.total, total.total / elapsed,
+            latencyPercentile(&total, 0.50), latencyPercentile(&total, 0.99));
+    free(text);
+    free(lineStart);
+    free(clients);
+    free(threads);
+}
+
+/************************************************************************
+ * Body of a load generator connection (arg is its LoadClient).			*
+ ************************************************************************/
+void *loadWorker(void *arg)
+{
+    LoadClient *client = arg;
+    struct sockaddr_un address;
+    struct timespec start, sent;
+    char *batch, *answers;
+    size_t batchUsed, length;
+    int line = client->first;
+    int fd, q, pending;
+    ssize_t n, i;
+    
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, client->socketPath, sizeof(address.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr,"Error connecting to %s\n", client->socketPath);
+        exit(EXIT_FAILURE);
+    }
+    batch = malloc(LOAD_BATCH_SIZE);
+    answers = malloc(LOAD_BATCH_SIZE);
+    if (batch == NULL || answers == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (elapsedSeconds(&start) < client->seconds) {
+        batchUsed = 0;
+        for (q = 0; q < client->depth; q++) {
+            length = client->lineStart[line+1] - client->lineStart[line];
+            memcpy(batch + batchUsed, client->queries + client->lineStart[line], length);
+            batchUsed += length;
+            if (++line == client->nbrLines) {
+                line = 0;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &sent);
+        writeAll(fd, batch, batchUsed);
+        for (pending = client->depth; pending > 0; ) {
+            n = read(fd, answers, LOAD_BATCH_SIZE);
+            if (n <= 0) {
+                fprintf(stderr,"Connection to %s lost\n", client->socketPath);
+                exit(EXIT_FAILURE);
+            }
+            for (i = 0, q = 0; i < n; i++) {
+                q += (answers[i] == '\n');
+            }
+            recordLatency(&client->histogram, elapsedSeconds(&sent) * 1e9, q);
+            pending -= q;
+        }
+    }
+    close(fd);
+    free(batch);
+    free(answers);
+    return NULL;
+}
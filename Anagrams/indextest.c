@@ -0,0 +1,210 @@
+/************************************************************************
+ * filename: indextest.c												*
+ *																		*
+ * Regression test for damaged index files. Builds an index of a small	*
+ * dictionary with the anagrams program, then damages the body of the	*
+ * index one 8-byte unit at a time (the header copies are left alone,	*
+ * so the header checksum still passes) and runs the program on the		*
+ * damaged file, both to print the groups of the dictionary and to		*
+ * answer queries. No run may be killed by a signal; a print run must	*
+ * succeed, and when it rebuilds the index its output must be the one	*
+ * of the undamaged index. The program prints every run that fails and	*
+ * exits with a failure status if there is one.							*
+ *																		*
+ * Use the following commands to compile and run the program:			*
+ *		$ gcc -Wall -std=c99 -pthread -o anagrams anagrams.c anagram.c	*
+ *		$ gcc -Wall -std=c99 -o indextest indextest.c					*
+ *		$ ./indextest  [anagramsProgram]								*
+ *																		*
+ * Author(s): Caitlin Crowe and Emily Peterson							*
+ ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DICT_FILE "indextest-dict.txt"
+#define QUERY_FILE "indextest-queries.txt"
+#define INDEX_FILE "indextest.idx"
+#define OUT_FILE "indextest-out.txt"
+#define HEADER_BYTES 432	// two copies of the IndexHeader of anagrams.c
+#define DAMAGE 0x4000000000000000ull	// value written over each unit
+
+/************************************************************************
+ * YOU MUST NOT DEFINE ANY GLOBAL VARIABLES (i.e., OUTSIDE FUNCTIONS).  *
+ * COMMUNICATION BETWEEN FUNCTIONS MUST HAPPEN ONLY VIA PARAMETERS.     *
+ ************************************************************************/
+
+/************************************************************************
+ * Function declarations/prototypes										*
+ ************************************************************************/
+
+void writeTextFile(char *filename, char *text);
+
+char *readWholeFile(char *filename, size_t *length);
+
+void writeWholeFile(char *filename, char *data, size_t length);
+
+int runProgram(char *program, char **args);
+
+/************************************************************************
+ * Runs every check and reports the result.								*
+ ************************************************************************/
+int main(int argc, char *argv[])
+{
+    char *program = (argc > 1) ? argv[1] : "./anagrams";
+    char *printArgs[] = {program, "--index", INDEX_FILE, DICT_FILE, OUT_FILE, NULL};
+    char *queryArgs[] = {program, "--index", INDEX_FILE, "--query", QUERY_FILE, OUT_FILE, NULL};
+    char *index, *damaged, *expected, *output, *rebuilt;
+    size_t indexLength, expectedLength, outputLength, rebuiltLength, at;
+    uint64_t damage = DAMAGE;
+    int nbrRuns = 0, nbrRebuilt = 0, nbrFailed = 0;
+    int status;
+    
+    writeTextFile(DICT_FILE, "listen\nsilent\nenlist\ntinsel\nstop\npots\ntops\nspot\nopts\n"
+                  "evil\nvile\nlive\nveil\nzebra\nbrazen\nheart\nearth\nhater\n");
+    writeTextFile(QUERY_FILE, "inlets\npost\nlevi\nzebra\nnothing\nthrea\n");
+    unlink(INDEX_FILE);
+    if (runProgram(program, printArgs) != 0) {
+        fprintf(stderr,"Cannot build an index with %s\n", program);
+        exit(EXIT_FAILURE);
+    }
+    expected = readWholeFile(OUT_FILE, &expectedLength);
+    index = readWholeFile(INDEX_FILE, &indexLength);
+    damaged = malloc(indexLength);
+    if (damaged == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (at = HEADER_BYTES; at + sizeof(uint64_t) <= indexLength; at += sizeof(uint64_t)) {
+        memcpy(damaged, index, indexLength);
+        memcpy(damaged + at, &damage, sizeof(uint64_t));
+    
+        writeWholeFile(INDEX_FILE, damaged, indexLength);
+        status = runProgram(program, queryArgs);
+        nbrRuns++;
+        if (status < 0) {
+            printf("FAILED: queries on an index damaged at byte %zu were killed by a signal\n", at);
+            nbrFailed++;
+        }
+    
+        writeWholeFile(INDEX_FILE, damaged, indexLength);
+        status = runProgram(program, printArgs);
+        nbrRuns++;
+        rebuilt = readWholeFile(INDEX_FILE, &rebuiltLength);
+        output = readWholeFile(OUT_FILE, &outputLength);
+        if (status != 0) {
+            printf("FAILED: printing with an index damaged at byte %zu %s\n", at,
+                   (status < 0) ? "was killed by a signal" : "failed");
+            nbrFailed++;
+        } else if (rebuiltLength != indexLength || memcmp(rebuilt, damaged, indexLength) != 0) {
+            nbrRebuilt++;
+            if (outputLength != expectedLength || memcmp(output, expected, expectedLength) != 0) {
+                printf("FAILED: the index damaged at byte %zu was rebuilt, but printed other groups\n", at);
+                nbrFailed++;
+            }
+        }
+        free(rebuilt);
+        free(output);
+    }
+    
+    printf("%d runs on damaged indexes, %d rebuilds, %d failed\n", nbrRuns, nbrRebuilt, nbrFailed);
+    if (nbrRebuilt == 0) {
+        printf("FAILED: no damaged index was rebuilt\n");
+        nbrFailed++;
+    }
+    unlink(DICT_FILE);
+    unlink(QUERY_FILE);
+    unlink(INDEX_FILE);
+    unlink(OUT_FILE);
+    free(index);
+    free(damaged);
+    free(expected);
+    return (nbrFailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/************************************************************************
+ * Replaces the contents of a file with a '\0'-terminated text.			*
+ ************************************************************************/
+void writeTextFile(char *filename, char *text)
+{
+    writeWholeFile(filename, text, strlen(text));
+}
+
+/************************************************************************
+ * Reads a whole file into a new buffer and stores its size in length.	*
+ * A file that does not exist reads as empty.							*
+ ************************************************************************/
+char *readWholeFile(char *filename, size_t *length)
+{
+    FILE *fp = fopen(filename, "rb");
+    char *data;
+    long size = 0;
+    
+    if (fp != NULL && (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)) {
+        fprintf(stderr,"Error reading file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    data = malloc(size + 1);
+    if (data == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fp != NULL) {
+        if (fread(data, 1, size, fp) != (size_t)size) {
+            fprintf(stderr,"Error reading file %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        fclose(fp);
+    }
+    *length = size;
+    return data;
+}
+
+/************************************************************************
+ * Replaces the contents of a file with length bytes of data.			*
+ ************************************************************************/
+void writeWholeFile(char *filename, char *data, size_t length)
+{
+    FILE *fp = fopen(filename, "wb");
+    
+    if (fp == NULL || fwrite(data, 1, length, fp) != length || fclose(fp) != 0) {
+        fprintf(stderr,"Error writing file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/************************************************************************
+ * Runs a program with the given arguments (NULL-terminated, the first	*
+ * being the program) with its output thrown away, and returns its exit	*
+ * status, or -1 if a signal killed it.									*
+ ************************************************************************/
+int runProgram(char *program, char **args)
+{
+    pid_t pid = fork();
+    int status;
+    
+    if (pid < 0) {
+        fprintf(stderr,"Error starting %s\n", program);
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL || freopen("/dev/null", "w", stderr) == NULL) {
+            _exit(127);
+        }
+        execv(program, args);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) != pid) {
+        fprintf(stderr,"Error waiting for %s\n", program);
+        exit(EXIT_FAILURE);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
@@ -0,0 +1,171 @@
+/************************************************************************
+ * filename: longwordtest.c												*
+ *																		*
+ * Regression test for words of LONG_WORD (256) characters or more,		*
+ * whose signature counts wrap around, and for words with characters	*
+ * other than 'a'..'z', which signatures only count. Each pair of words	*
+ * below is checked with areAnagrams, through an AnagramSet and through	*
+ * the groups buildAnagramArrayMapped makes of a file holding the pair;	*
+ * the program prints every check that fails and exits with a failure	*
+ * status if there is one.												*
+ *																		*
+ * Use the following commands to compile and run the program:			*
+ *		$ gcc -Wall -std=c99 -pthread -o longwordtest \					*
+ *				longwordtest.c anagram.c								*
+ *		$ ./longwordtest												*
+ *																		*
+ * Author(s): Caitlin Crowe and Emily Peterson							*
+ ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "anagramcore.h"
+
+#define MAX_TEST_WORD 400
+
+// pair of words to check, each given as runs of repeated characters
+//		- text fields alternate a character and the length of its run,
+//		  so {'a', 257} is "a" repeated 257 times
+//		- anagrams field is the expected answer
+typedef struct {
+    int text1[6];
+    int text2[6];
+    bool anagrams;
+} WordPair;
+
+/************************************************************************
+ * YOU MUST NOT DEFINE ANY GLOBAL VARIABLES (i.e., OUTSIDE FUNCTIONS).  *
+ * COMMUNICATION BETWEEN FUNCTIONS MUST HAPPEN ONLY VIA PARAMETERS.     *
+ ************************************************************************/
+
+/************************************************************************
+ * Function declarations/prototypes										*
+ ************************************************************************/
+
+int expandRuns(int *runs, char *word);
+
+bool checkPair(char *word1, int length1, char *word2, int length2, bool anagrams);
+
+int countFileGroups(char *word1, int length1, char *word2, int length2);
+
+/************************************************************************
+ * Runs every check and reports the result.								*
+ ************************************************************************/
+int main(void)
+{
+    static const WordPair pairs[] = {
+        {{'a', 1}, {'a', 257}, false},
+        {{'a', 1, 'b', 1}, {'b', 1, 'a', 257}, false},
+        {{'q', 16}, {'q', 272}, false},
+        {{'a', 256}, {'b', 256}, false},
+        {{'a', 257}, {'a', 1, 'b', 256}, false},
+        {{'a', 128, 'b', 1, 'a', 128}, {'b', 1, 'a', 256}, true},
+        {{'x', 300, 'y', 1}, {'y', 1, 'x', 300}, true},
+        {{'a', 257}, {'a', 257}, true},
+        {{'B', 1, 'o', 1, 'b', 1}, {'R', 1, 'o', 1, 'b', 1}, false},
+        {{'B', 1, 'o', 1, 'b', 1}, {'b', 1, 'o', 1, 'B', 1}, true},
+        {{'a', 1, 'b', 1, '1', 1}, {'a', 1, 'b', 1, '2', 1}, false},
+        {{'x', 300, '1', 1}, {'x', 300, '2', 1}, false},
+        {{'-', 1, 'x', 300}, {'x', 300, '-', 1}, true}
+    };
+    char word1[MAX_TEST_WORD], word2[MAX_TEST_WORD];
+    int length1, length2, p, failed = 0;
+    
+    for (p = 0; p < (int)(sizeof(pairs) / sizeof(pairs[0])); p++) {
+        length1 = expandRuns((int *)pairs[p].text1, word1);
+        length2 = expandRuns((int *)pairs[p].text2, word2);
+        if (!checkPair(word1, length1, word2, length2, pairs[p].anagrams)) {
+            printf("pair %d failed (lengths %d and %d)\n", p, length1, length2);
+            failed++;
+        }
+    }
+    
+    printf("%d of %d pairs passed\n", p - failed, p);
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/************************************************************************
+ * Writes the word described by runs (see WordPair) into word, '\0'-	*
+ * terminated, and returns its length.									*
+ ************************************************************************/
+int expandRuns(int *runs, char *word)
+{
+    int length = 0, r;
+    
+    for (r = 0; r < 6 && runs[r] != 0; r += 2) {
+        memset(word + length, runs[r], runs[r+1]);
+        length += runs[r+1];
+    }
+    word[length] = '\0';
+    return length;
+}
+
+/************************************************************************
+ * Returns true if areAnagrams, an AnagramSet and a built array all say	*
+ * the two words are anagrams exactly when anagrams is true.			*
+ ************************************************************************/
+bool checkPair(char *word1, int length1, char *word2, int length2, bool anagrams)
+{
+    AnagramSet *set = createAnagramSet();
+    int group1, group2, wordLength;
+    bool ok = true;
+    
+    if (areAnagrams(word1, word2) != anagrams) {
+        printf("  areAnagrams is wrong\n");
+        ok = false;
+    }
+    
+    addAnagramWord(set, word1, length1);
+    addAnagramWord(set, word2, length2);
+    freezeAnagramSet(set);
+    group1 = lookupAnagramGroup(set, word1, length1);
+    group2 = lookupAnagramGroup(set, word2, length2);
+    if (group1 < 0 || group2 < 0 || (group1 == group2) != anagrams
+            || countAnagramGroups(set) != (anagrams ? 1 : 2)) {
+        printf("  AnagramSet groups are wrong\n");
+        ok = false;
+    } else if (anagramGroupWord(set, group1, 0, &wordLength) == NULL || wordLength != length1) {
+        printf("  AnagramSet lookup returns another word\n");
+        ok = false;
+    }
+    destroyAnagramSet(set);
+    
+    if (countFileGroups(word1, length1, word2, length2) != (anagrams ? 1 : 2)) {
+        printf("  buildAnagramArrayMapped groups are wrong\n");
+        ok = false;
+    }
+    return ok;
+}
+
+/************************************************************************
+ * Writes the two words to a temporary file, one per line, and returns	*
+ * the number of groups buildAnagramArrayMapped makes of it.			*
+ ************************************************************************/
+int countFileGroups(char *word1, int length1, char *word2, int length2)
+{
+    char path[] = "/tmp/longwordtestXXXXXX";
+    int fd = mkstemp(path);
+    AryElement *ary;
+    int aryLen;
+    
+    if (fd < 0) {
+        fprintf(stderr,"Error creating a temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+    writeAll(fd, word1, length1);
+    writeAll(fd, "\n", 1);
+    writeAll(fd, word2, length2);
+    writeAll(fd, "\n", 1);
+    close(fd);
+    
+    ary = buildAnagramArrayMapped(path, &aryLen);
+    freeAnagramArray(ary, aryLen);
+    unlink(path);
+    return aryLen;
+}
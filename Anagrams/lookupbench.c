@@ -0,0 +1,284 @@
+/************************************************************************
+ * filename: lookupbench.c												*
+ *																		*
+ * Multi-threaded lookup test and benchmark for the anagram library.	*
+ * Builds and freezes an AnagramSet from a dictionary (one word per		*
+ * line), checks that every word is found in a group that holds it,		*
+ * and then lets 1, 2, 4, ... up to maxThreads threads look up the		*
+ * dictionary words in the one shared set at the same time. Each run	*
+ * prints the lookups per second of all threads together and checks		*
+ * that every thread got the same answers as the single-threaded check.	*
+ *																		*
+ * Use the following commands to compile and run the program:			*
+ *		$ gcc -Wall -std=c99 -O2 -pthread -o lookupbench \				*
+ *				lookupbench.c anagram.c									*
+ *		$ ./lookupbench  dictionary1.txt  [maxThreads]  [rounds]		*
+ *																		*
+ * Author(s): Caitlin Crowe and Emily Peterson							*
+ ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "anagram.h"
+
+// word of the dictionary used as a query
+//		- text field points to the line buffer of the word (not
+//		  '\0'-terminated at length)
+//		- group field stores the answer of the single-threaded check
+typedef struct {
+    char *text;
+    int length;
+    int group;
+} Word;
+
+// argument and result of one lookup thread
+//		- first field is the word the thread starts at, so that the
+//		  threads do not walk through the words in lockstep
+//		- groupSum field adds up the answers, to be compared with the
+//		  answers of the single-threaded check
+typedef struct {
+    AnagramSet *set;
+    Word *words;
+    int nbrWords;
+    int first;
+    int rounds;
+    int64_t groupSum;
+} LookupWorker;
+
+/************************************************************************
+ * YOU MUST NOT DEFINE ANY GLOBAL VARIABLES (i.e., OUTSIDE FUNCTIONS).  *
+ * COMMUNICATION BETWEEN FUNCTIONS MUST HAPPEN ONLY VIA PARAMETERS.     *
+ ************************************************************************/
+
+/************************************************************************
+ * Function declarations/prototypes										*
+ ************************************************************************/
+
+Word *readWords(char *infile, int *nbrWords);
+
+bool checkLookups(AnagramSet *set, Word *words, int nbrWords);
+
+double runLookups(AnagramSet *set, Word *words, int nbrWords, int nbrThreads, int rounds, int64_t expected);
+
+void *lookupWorker(void *arg);
+
+/************************************************************************
+ * Builds the set, checks it and prints the throughput of each thread	*
+ * count.																*
+ ************************************************************************/
+int main(int argc, char *argv[])
+{
+    AnagramSet *set;
+    Word *words;
+    int nbrWords, maxThreads = 8, rounds = 10;
+    int nbrThreads, i;
+    int64_t expected = 0;
+    double rate, single = 0;
+    
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s dictionary [maxThreads] [rounds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        maxThreads = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        rounds = atoi(argv[3]);
+    }
+    if (maxThreads < 1 || rounds < 1) {
+        fprintf(stderr, "maxThreads and rounds must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    words = readWords(argv[1], &nbrWords);
+    if (nbrWords == 0) {
+        fprintf(stderr, "%s has no words\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    set = createAnagramSet();
+    for (i = 0; i < nbrWords; i++) {
+        addAnagramWord(set, words[i].text, words[i].length);
+    }
+    freezeAnagramSet(set);
+    if (!checkLookups(set, words, nbrWords)) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nbrWords; i++) {
+        expected += words[i].group;
+    }
+    printf("%d words, %d groups\n", nbrWords, countAnagramGroups(set));
+    
+    for (nbrThreads = 1; ; nbrThreads *= 2) {
+        if (nbrThreads > maxThreads) {
+            nbrThreads = maxThreads;
+        }
+        rate = runLookups(set, words, nbrWords, nbrThreads, rounds, expected);
+        if (nbrThreads == 1) {
+            single = rate;
+        }
+        printf("threads %3d: %12.0f lookups/sec (%.2fx one thread)\n", nbrThreads, rate, rate / single);
+        if (nbrThreads == maxThreads) {
+            break;
+        }
+    }
+    
+    destroyAnagramSet(set);
+    for (i = 0; i < nbrWords; i++) {
+        free(words[i].text);
+    }
+    free(words);
+    return 0;
+}
+
+/************************************************************************
+ * Reads the non-empty lines of infile (without "\n" or "\r\n") into a	*
+ * new array and stores the number of words in nbrWords.				*
+ ************************************************************************/
+Word *readWords(char *infile, int *nbrWords)
+{
+    FILE *fp = fopen(infile, "r");
+    Word *words = NULL;
+    int capacity = 0;
+    char *line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open %s\n", infile);
+        exit(EXIT_FAILURE);
+    }
+    *nbrWords = 0;
+    while ((length = getline(&line, &lineSize, fp)) != -1) {
+        while (length > 0 && (line[length-1] == '\n' || line[length-1] == '\r')) {
+            length--;
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (*nbrWords == capacity) {
+            capacity = (capacity == 0) ? 64 : 2 * capacity;
+            words = realloc(words, capacity * sizeof(Word));
+            if (words == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        words[*nbrWords].text = line;
+        words[*nbrWords].length = length;
+        (*nbrWords)++;
+        line = NULL;
+        lineSize = 0;
+    }
+    free(line);
+    fclose(fp);
+    return words;
+}
+
+/************************************************************************
+ * Looks up every word on one thread, checks that its group holds the	*
+ * word and stores the group in the word. Returns false (after saying	*
+ * why on stderr) if some word is not found where it should be.			*
+ ************************************************************************/
+bool checkLookups(AnagramSet *set, Word *words, int nbrWords)
+{
+    char *text;
+    int i, j, g, length;
+    
+    for (i = 0; i < nbrWords; i++) {
+        g = lookupAnagramGroup(set, words[i].text, words[i].length);
+        if (g < 0) {
+            fprintf(stderr, "%.*s: not found\n", words[i].length, words[i].text);
+            return false;
+        }
+        for (j = 0; j < anagramGroupSize(set, g); j++) {
+            text = anagramGroupWord(set, g, j, &length);
+            if (length == words[i].length && memcmp(text, words[i].text, length) == 0) {
+                break;
+            }
+        }
+        if (j == anagramGroupSize(set, g)) {
+            fprintf(stderr, "%.*s: not in its group %d\n", words[i].length, words[i].text, g);
+            return false;
+        }
+        words[i].group = g;
+    }
+    return true;
+}
+
+/************************************************************************
+ * Lets nbrThreads threads look up every word rounds times in the		*
+ * shared set and returns the number of lookups per second of all of	*
+ * them together. Exits if a thread's answers do not add up to expected	*
+ * (the sum of the single-threaded answers) in every round.				*
+ ************************************************************************/
+double runLookups(AnagramSet *set, Word *words, int nbrWords, int nbrThreads, int rounds, int64_t expected)
+{
+    pthread_t *threads = malloc(nbrThreads * sizeof(pthread_t));
+    LookupWorker *workers = malloc(nbrThreads * sizeof(LookupWorker));
+    struct timespec start, end;
+    double seconds;
+    int t;
+    
+    if (threads == NULL || workers == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < nbrThreads; t++) {
+        workers[t].set = set;
+        workers[t].words = words;
+        workers[t].nbrWords = nbrWords;
+        workers[t].first = (int)((int64_t)nbrWords * t / nbrThreads);
+        workers[t].rounds = rounds;
+        if (pthread_create(&threads[t], NULL, lookupWorker, &workers[t]) != 0) {
+            fprintf(stderr, "Cannot create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (t = 0; t < nbrThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    
+    for (t = 0; t < nbrThreads; t++) {
+        if (workers[t].groupSum != expected * rounds) {
+            fprintf(stderr, "thread %d of %d got different answers\n", t, nbrThreads);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(threads);
+    free(workers);
+    return (double)nbrWords * rounds * nbrThreads / seconds;
+}
+
+/************************************************************************
+ * Body of one lookup thread (arg is its LookupWorker): looks up every	*
+ * word, starting at word first, rounds times and adds up the answers.	*
+ ************************************************************************/
+void *lookupWorker(void *arg)
+{
+    LookupWorker *worker = arg;
+    int64_t sum = 0;
+    int r, i, w;
+    
+    for (r = 0; r < worker->rounds; r++) {
+        w = worker->first;
+        for (i = 0; i < worker->nbrWords; i++) {
+            sum += lookupAnagramGroup(worker->set, worker->words[w].text, worker->words[w].length);
+            if (++w == worker->nbrWords) {
+                w = 0;
+            }
+        }
+    }
+    worker->groupSum = sum;
+    return NULL;
+}
@@ -3,6 +3,17 @@
 #include <limits.h>
 #include "matrix.h"
 
+// Blocking of multiply(). The sizes are in ints (4 bytes each).
+#define MR 4		// rows of the register tile computed by multiplyTile
+#define NR 8		// columns of the register tile
+#define KC 256		// depth of a panel: MR x KC and KC x NR slivers fit in L1
+#define MC 96		// rows of a packed block of m1 (MC x KC ints fit in L2)
+#define NC 2048		// columns of a packed panel of m2 (KC x NC ints fit in L3)
+
+void packRows(Matrix *m, int row, int rows, int depth, int depthLen, unsigned int *packed);
+void packColumns(Matrix *m, int depth, int depthLen, int column, int columns, unsigned int *packed);
+void multiplyTile(int depthLen, unsigned int *a, unsigned int *b, unsigned int *c, int ldc, int rows, int columns);
+
 /****************************************************************************
  * Creates and returns a pointer to a matrix object with the specified		*
  * number of rows and columns. The "data" field is set to a dynamically 	*
@@ -22,7 +33,7 @@ Matrix *create(int rows, int columns)
     
     result->rows = rows;
     result->columns = columns;
-    result->data = (int *) calloc(rows*columns, sizeof(int));
+    result->data = (int *) calloc((size_t)rows*columns, sizeof(int));
     
     return result;
 }
@@ -37,7 +48,7 @@ int getValueAt(Matrix *m, int row, int column)
     if(row<0 || column<0  || row>= m->rows || column>= m->columns){
         return INT_MIN;
     }
-    return *(m->data + (m->columns*row) + column);
+    return *(m->data + ((size_t)m->columns*row) + column);
 }
 
 /****************************************************************************
@@ -48,7 +59,7 @@ int getValueAt(Matrix *m, int row, int column)
 void setValueAt(Matrix *m, int row, int column, int value)
 {
     if(row>=0 || column>=0  || row< m->rows || column< m->columns){
-        *(m->data + (m->columns*row) + column) = value;
+        *(m->data + ((size_t)m->columns*row) + column) = value;
     }
 }
 
@@ -143,30 +154,143 @@ Matrix *scalarMultiply(Matrix *m, int scalar)
 
 /****************************************************************************
  * If the input matrices are compatible, then multiplies the input matrices	*
- * and returns a pointer to the result matrix. Use create(), getValueAt(), 	*
- * and setValueAt() functions to implement this function.					*
- * If the input matrices are not compatible, return NULL.					*
+ * and returns a pointer to the result matrix. If the input matrices are	*
+ * not compatible (or memory runs out), return NULL.						*
  * DO NOT modify the input matrices.										*
+ *																			*
+ * The product is computed on the "data" arrays directly, blocked for the	*
+ * caches: for each panel of NC columns of m2 and each slice of KC of the	*
+ * shared dimension, the panel of m2 is packed into KC x NR slivers			*
+ * (packColumns), then each block of MC rows of m1 is packed into MR x KC	*
+ * slivers (packRows) and every MR x NR tile of the result is updated from	*
+ * one sliver of each (multiplyTile). The sums are done in unsigned			*
+ * arithmetic, which wraps around on overflow, so the result is bit for		*
+ * bit the one of the plain triple loop in any order of the additions.		*
  ***************************************************************************/
 Matrix *multiply(Matrix *m1, Matrix *m2)
 {
     Matrix *result = NULL;
-    int value = 0;
-    int r,c, cc;
+    unsigned int *packedRows, *packedColumns, *c;
+    int rows, depth, columns;
+    int jc, pc, ic, jr, ir, nc, kc, mc;
     
-    if (m1->columns == m2->rows){
-        result = create(m1->rows,m2->columns);
-        for (r=0; r>m1->rows; r++) {
-            for (c=0; c>m2->columns; c++) {
-                
-                for (cc=c; cc>m1->columns; cc++) { //Calculating value
-                    value += getValueAt(m1,r,cc)*getValueAt(m2,cc,r);
+    if (m1->columns != m2->rows){
+        return NULL;
+    }
+    rows = m1->rows;
+    depth = m1->columns;
+    columns = m2->columns;
+    result = create(rows,columns);
+    packedRows = malloc(MC * KC * sizeof(unsigned int));
+    packedColumns = malloc(KC * NC * sizeof(unsigned int));
+    if (result == NULL || result->data == NULL || packedRows == NULL || packedColumns == NULL) {
+        if (result != NULL) {
+            free(result->data);
+            free(result);
+        }
+        free(packedRows);
+        free(packedColumns);
+        return NULL;
+    }
+    c = (unsigned int *)result->data;
+    
+    for (jc=0; jc<columns; jc+=NC) {
+        nc = (columns - jc < NC) ? columns - jc : NC;
+        for (pc=0; pc<depth; pc+=KC) {
+            kc = (depth - pc < KC) ? depth - pc : KC;
+            packColumns(m2, pc, kc, jc, nc, packedColumns);
+            for (ic=0; ic<rows; ic+=MC) {
+                mc = (rows - ic < MC) ? rows - ic : MC;
+                packRows(m1, ic, mc, pc, kc, packedRows);
+                for (jr=0; jr<nc; jr+=NR) {
+                    for (ir=0; ir<mc; ir+=MR) {
+                        multiplyTile(kc, packedRows + ir*kc, packedColumns + jr*kc,
+                                     c + (size_t)(ic+ir)*columns + jc+jr, columns,
+                                     (mc - ir < MR) ? mc - ir : MR, (nc - jr < NR) ? nc - jr : NR);
+                    }
                 }
-                
-                setValueAt(result,r,c,value);
             }
         }
     }
     
-	return result;
+    free(packedRows);
+    free(packedColumns);
+    return result;
+}
+
+/****************************************************************************
+ * Copies rows row..row+rows-1, columns depth..depth+depthLen-1 of m into	*
+ * packed as slivers of MR rows: sliver s holds, for each column in turn,	*
+ * its MR values, so multiplyTile reads it front to back. Rows past the		*
+ * end of the block are filled with zeros.									*
+ ***************************************************************************/
+void packRows(Matrix *m, int row, int rows, int depth, int depthLen, unsigned int *packed)
+{
+    unsigned int *data = (unsigned int *)m->data;
+    int r, i, p;
+    
+    for (r=0; r<rows; r+=MR) {
+        for (p=0; p<depthLen; p++) {
+            for (i=0; i<MR; i++) {
+                *packed++ = (r+i < rows) ? data[(size_t)(row+r+i)*m->columns + depth+p] : 0;
+            }
+        }
+    }
+}
+
+/****************************************************************************
+ * Copies rows depth..depth+depthLen-1, columns column..column+columns-1	*
+ * of m into packed as slivers of NR columns: sliver s holds, for each		*
+ * row in turn, its NR values. Columns past the end of the panel are		*
+ * filled with zeros.														*
+ ***************************************************************************/
+void packColumns(Matrix *m, int depth, int depthLen, int column, int columns, unsigned int *packed)
+{
+    unsigned int *data = (unsigned int *)m->data;
+    unsigned int *src;
+    int c, j, p;
+    
+    for (c=0; c<columns; c+=NR) {
+        for (p=0; p<depthLen; p++) {
+            src = data + (size_t)(depth+p)*m->columns + column+c;
+            if (c + NR <= columns) {
+                for (j=0; j<NR; j++) {
+                    *packed++ = src[j];
+                }
+            } else {
+                for (j=0; j<NR; j++) {
+                    *packed++ = (c+j < columns) ? src[j] : 0;
+                }
+            }
+        }
+    }
+}
+
+/****************************************************************************
+ * Adds the product of an MR x depthLen sliver a and a depthLen x NR		*
+ * sliver b (see packRows and packColumns) to the tile of the result at c,	*
+ * whose rows are ldc ints apart. The MR x NR sums are kept in a local		*
+ * array the compiler holds in (vector) registers; only the first rows x	*
+ * columns of them are added to c, for tiles on the edge of the result.		*
+ ***************************************************************************/
+void multiplyTile(int depthLen, unsigned int *a, unsigned int *b, unsigned int *c, int ldc, int rows, int columns)
+{
+    unsigned int sum[MR][NR] = {{0}};
+    int i, j, p;
+    
+    for (p=0; p<depthLen; p++) {
+        for (i=0; i<MR; i++) {
+            for (j=0; j<NR; j++) {
+                sum[i][j] += a[i] * b[j];
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+    
+    for (i=0; i<rows; i++) {
+        for (j=0; j<columns; j++) {
+            c[(size_t)i*ldc + j] += sum[i][j];
+        }
+    }
 }
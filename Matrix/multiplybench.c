@@ -0,0 +1,138 @@
+/****************************************************************************
+ * Benchmark of multiply() against the reference triple loop that goes		*
+ * through getValueAt() and setValueAt() for every element. Both multiply	*
+ * the same two n x n matrices of random ints; the results are checked to	*
+ * be identical and the speed of each is printed in GFLOP/s, counting one	*
+ * multiplication and one addition per inner step (2 n^3 operations).		*
+ *																			*
+ * Use the following commands to compile and run the program:				*
+ *		$ gcc -Wall -std=c99 -O3 -march=native -o multiplybench \			*
+ *				multiplybench.c matrix.c									*
+ *		$ ./multiplybench  [n]  [rounds]									*
+ * n is 2000 by default. multiply() runs rounds times (3 by default) and	*
+ * its best time is kept; the reference loop runs once.						*
+ ***************************************************************************/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "matrix.h"
+
+Matrix *multiplyReference(Matrix *m1, Matrix *m2);
+Matrix *randomMatrix(int rows, int columns, unsigned int seed);
+void freeMatrix(Matrix *m);
+double secondsSince(struct timespec *start);
+
+int main(int argc, char *argv[])
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 2000;
+    int rounds = (argc > 2) ? atoi(argv[2]) : 3;
+    Matrix *matA, *matB, *expected, *actual;
+    struct timespec start;
+    double operations, reference, seconds, best = 0;
+    int round;
+    
+    if (n <= 0 || rounds <= 0) {
+        printf("Usage: ./multiplybench [n] [rounds]\n");
+        return EXIT_FAILURE;
+    }
+    matA = randomMatrix(n, n, 1);
+    matB = randomMatrix(n, n, 2);
+    operations = 2.0 * n * n * n;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    expected = multiplyReference(matA, matB);
+    reference = secondsSince(&start);
+    printf("%-10s n=%d %9.3f s %8.3f GFLOP/s\n", "reference", n, reference, operations / reference / 1e9);
+    
+    for (round = 0; round < rounds; round++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        actual = multiply(matA, matB);
+        seconds = secondsSince(&start);
+        if (actual == NULL) {
+            printf("multiply() failed.\n");
+            return EXIT_FAILURE;
+        }
+        if (memcmp(actual->data, expected->data, (size_t)n * n * sizeof(int)) != 0) {
+            printf("multiply() differs from the reference.\n");
+            return EXIT_FAILURE;
+        }
+        freeMatrix(actual);
+        best = (round == 0 || seconds < best) ? seconds : best;
+    }
+    printf("%-10s n=%d %9.3f s %8.3f GFLOP/s (%.1fx faster)\n", "multiply", n, best,
+           operations / best / 1e9, reference / best);
+    
+    freeMatrix(matA);
+    freeMatrix(matB);
+    freeMatrix(expected);
+    return EXIT_SUCCESS;
+}
+
+/****************************************************************************
+ * The plain triple loop multiply() replaces, one getValueAt() call per		*
+ * operand and one setValueAt() call per result element. The sums are		*
+ * done in unsigned arithmetic so that overflow wraps around instead of		*
+ * being undefined, as it does in multiply().								*
+ ***************************************************************************/
+Matrix *multiplyReference(Matrix *m1, Matrix *m2)
+{
+    Matrix *result = create(m1->rows,m2->columns);
+    unsigned int value;
+    int r, c, i;
+    
+    for (r=0; r<m1->rows; r++) {
+        for (c=0; c<m2->columns; c++) {
+            value = 0;
+            for (i=0; i<m1->columns; i++) {
+                value += (unsigned int)getValueAt(m1,r,i) * (unsigned int)getValueAt(m2,i,c);
+            }
+            setValueAt(result,r,c,(int)value);
+        }
+    }
+    return result;
+}
+
+/****************************************************************************
+ * Creates a matrix of the given size filled with ints from a simple		*
+ * xorshift generator started at seed, so every run uses the same values.	*
+ * The values cover the whole int range, so the products overflow.			*
+ ***************************************************************************/
+Matrix *randomMatrix(int rows, int columns, unsigned int seed)
+{
+    Matrix *m = create(rows,columns);
+    unsigned int state = seed * 2654435761u + 1;
+    int r, c;
+    
+    for (r=0; r<rows; r++) {
+        for (c=0; c<columns; c++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            setValueAt(m,r,c,(int)state);
+        }
+    }
+    return m;
+}
+
+/****************************************************************************
+ * Releases a matrix made by create().										*
+ ***************************************************************************/
+void freeMatrix(Matrix *m)
+{
+    free(m->data);
+    free(m);
+}
+
+/****************************************************************************
+ * Returns the seconds elapsed since start (taken with CLOCK_MONOTONIC).	*
+ ***************************************************************************/
+double secondsSince(struct timespec *start)
+{
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}